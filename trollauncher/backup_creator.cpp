@@ -0,0 +1,555 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/backup_creator.hpp"
+
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <set>
+
+#include <nlohmann/json.hpp>
+
+#include "trollauncher/file_lock.hpp"
+#include "trollauncher/hashing.hpp"
+#include "trollauncher/worker_pool.hpp"
+#include "trollauncher/zip_utils.hpp"
+#include "trollauncher/zip_writer.hpp"
+
+#ifndef ITS_A_UNIX_SYSTEM
+#ifndef _WIN32
+#define ITS_A_UNIX_SYSTEM true
+#else
+#define ITS_A_UNIX_SYSTEM false
+#endif
+#endif
+
+#if ITS_A_UNIX_SYSTEM
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+namespace nl = nlohmann;
+
+constexpr int DEDUP_MANIFEST_VERSION = 1;
+
+class BackupReporter {
+ public:
+  BackupReporter(const BackupProgressFunc& progress_func, const BackupFileFunc& file_func,
+                 std::size_t num_total);
+  void Report(std::size_t num_done);
+  // This can be called from any thread
+  void FileDone(std::size_t path_index);
+  // Once files are handed off, they might be gone from the profile, so the backup has to stay
+  bool KeepsPartialBackup() const;
+
+ private:
+  BackupProgressFunc progress_func_;
+  BackupFileFunc file_func_;
+  std::size_t num_total_;
+  std::size_t last_percent_;
+};
+
+std::string GetBackupTimeString();
+bool CreateZipBackup(std::uint16_t method, const fs::path& backup_path,
+                     const fs::path& profile_path, const std::vector<fs::path>& paths,
+                     std::size_t num_jobs, BackupReporter* reporter_ptr,
+                     std::uint64_t* num_written_bytes_ptr);
+bool CreateReflinkBackup(const fs::path& backup_path, const fs::path& profile_path,
+                         const std::vector<fs::path>& paths, std::size_t num_jobs,
+                         BackupReporter* reporter_ptr, std::uint64_t* num_written_bytes_ptr);
+bool CreateMoveBackup(const fs::path& backup_path, const fs::path& profile_path,
+                      const std::vector<fs::path>& paths, BackupReporter* reporter_ptr,
+                      std::uint64_t* num_written_bytes_ptr);
+bool CreateDedupBackup(const fs::path& backup_path, const fs::path& blobs_path,
+                       const fs::path& profile_path, const std::vector<fs::path>& paths,
+                       std::size_t num_jobs, BackupReporter* reporter_ptr,
+                       std::uint64_t* num_written_bytes_ptr);
+bool WriteDedupManifest(const fs::path& backup_path, const std::vector<fs::path>& paths,
+                        const std::vector<std::uint64_t>& sizes,
+                        const std::vector<std::string>& sha1s);
+bool CreateParentDirectories(const fs::path& dest_path, const std::vector<fs::path>& paths);
+bool CloneFile(const fs::path& from_path, const fs::path& to_path, bool* was_copied_ptr);
+bool MoveFile(const fs::path& from_path, const fs::path& to_path, bool* was_copied_ptr);
+
+}  // namespace
+
+std::optional<BackupMethod> BackupMethodFromString(const std::string& method_str)
+{
+  if (method_str == "dedup") {
+    return BackupMethod::DEDUP;
+  }
+  else if (method_str == "deflate") {
+    return BackupMethod::DEFLATE_ZIP;
+  }
+  else if (method_str == "store") {
+    return BackupMethod::STORE_ZIP;
+  }
+  else if (method_str == "reflink") {
+    return BackupMethod::REFLINK;
+  }
+  else if (method_str == "move") {
+    return BackupMethod::MOVE;
+  }
+  return std::nullopt;
+}
+
+std::string BackupMethodToString(BackupMethod method)
+{
+  switch (method) {
+  case BackupMethod::DEDUP:
+    return "dedup";
+  case BackupMethod::DEFLATE_ZIP:
+    return "deflate";
+  case BackupMethod::STORE_ZIP:
+    return "store";
+  case BackupMethod::REFLINK:
+    return "reflink";
+  case BackupMethod::MOVE:
+    return "move";
+  }
+  return "unknown";
+}
+
+bool BackupMethodRemovesFiles(BackupMethod method)
+{
+  return method == BackupMethod::MOVE;
+}
+
+fs::path GetBackupsPath(const fs::path& dot_minecraft_path)
+{
+  return dot_minecraft_path / "trollauncher" / "backups";
+}
+
+fs::path GetProfileBackupsPath(const fs::path& dot_minecraft_path, const std::string& profile_id)
+{
+  return GetBackupsPath(dot_minecraft_path) / profile_id;
+}
+
+fs::path GetBackupBlobsPath(const fs::path& backups_path)
+{
+  return backups_path / "blobs";
+}
+
+fs::path GetBackupBlobsLockPath(const fs::path& backups_path)
+{
+  return backups_path / "blobs.lock";
+}
+
+fs::path GetBackupBlobPath(const fs::path& blobs_path, const std::string& sha1)
+{
+  // Split like git objects, so no single directory gets huge
+  return blobs_path / sha1.substr(0, 2) / sha1.substr(2);
+}
+
+std::optional<BackupStats> CreateBackup(BackupMethod method, const fs::path& backups_path,
+                                        const fs::path& profile_path,
+                                        const std::vector<fs::path>& paths, std::size_t num_jobs,
+                                        const BackupProgressFunc& progress_func,
+                                        const BackupFileFunc& file_func)
+{
+  const auto start_time = std::chrono::steady_clock::now();
+  std::error_code fs_ec;
+  const bool is_zip = (method == BackupMethod::DEFLATE_ZIP || method == BackupMethod::STORE_ZIP);
+  const std::string extension = (is_zip ? ".zip" : method == BackupMethod::DEDUP ? ".json" : "");
+  BackupStats backup_stats;
+  backup_stats.backup_path = backups_path / (GetBackupTimeString() + extension);
+  backup_stats.num_files = paths.size();
+  backup_stats.num_bytes = 0;
+  backup_stats.num_written_bytes = 0;
+  if (fs::exists(backup_stats.backup_path)) {
+    return std::nullopt;
+  }
+  if (!fs::exists(backups_path)) {
+    fs::create_directories(backups_path, fs_ec);
+    if (fs_ec) {
+      return std::nullopt;
+    }
+  }
+  for (const fs::path& path : paths) {
+    const std::uintmax_t size = fs::file_size(profile_path / path, fs_ec);
+    if (fs_ec) {
+      return std::nullopt;
+    }
+    backup_stats.num_bytes += size;
+  }
+  BackupReporter reporter(progress_func, file_func, paths.size());
+  bool success = false;
+  switch (method) {
+  case BackupMethod::DEDUP: {
+    const FileLock::Ptr lock_ptr =
+        FileLock::Acquire(GetBackupBlobsLockPath(backups_path.parent_path()));
+    if (lock_ptr == nullptr) {
+      return std::nullopt;
+    }
+    success = CreateDedupBackup(backup_stats.backup_path,
+                                GetBackupBlobsPath(backups_path.parent_path()),
+                                profile_path, paths, num_jobs, &reporter,
+                                &backup_stats.num_written_bytes);
+    break;
+  }
+  case BackupMethod::DEFLATE_ZIP:
+  case BackupMethod::STORE_ZIP: {
+    const std::uint16_t zip_method =
+        (method == BackupMethod::DEFLATE_ZIP ? ZIP_METHOD_DEFLATE : ZIP_METHOD_STORE);
+    success = CreateZipBackup(zip_method, backup_stats.backup_path, profile_path, paths, num_jobs,
+                              &reporter, &backup_stats.num_written_bytes);
+    break;
+  }
+  case BackupMethod::REFLINK:
+    success = CreateReflinkBackup(backup_stats.backup_path, profile_path, paths, num_jobs,
+                                  &reporter, &backup_stats.num_written_bytes);
+    break;
+  case BackupMethod::MOVE:
+    success = CreateMoveBackup(backup_stats.backup_path, profile_path, paths, &reporter,
+                               &backup_stats.num_written_bytes);
+    break;
+  }
+  if (!success) {
+    return std::nullopt;
+  }
+  backup_stats.elapsed = std::chrono::steady_clock::now() - start_time;
+  return backup_stats;
+}
+
+namespace {
+
+BackupReporter::BackupReporter(const BackupProgressFunc& progress_func,
+                               const BackupFileFunc& file_func, std::size_t num_total)
+    : progress_func_(progress_func), file_func_(file_func), num_total_(num_total), last_percent_(0)
+{
+  if (!progress_func_) return;
+  progress_func_(0);
+}
+
+void BackupReporter::Report(std::size_t num_done)
+{
+  if (!progress_func_ || num_total_ == 0) return;
+  const std::size_t next_percent = (100 * std::min(num_done, num_total_)) / num_total_;
+  if (next_percent != last_percent_) {
+    progress_func_(next_percent);
+    last_percent_ = next_percent;
+  }
+}
+
+void BackupReporter::FileDone(std::size_t path_index)
+{
+  if (!file_func_) return;
+  file_func_(path_index);
+}
+
+bool BackupReporter::KeepsPartialBackup() const
+{
+  return static_cast<bool>(file_func_);
+}
+
+std::string GetBackupTimeString()
+{
+  const auto now_chrono = std::chrono::system_clock::now();
+  std::time_t now_time_t = std::chrono::system_clock::to_time_t(now_chrono);
+  char time_c_str[sizeof "00000000_000000"];
+  std::strftime(time_c_str, sizeof time_c_str, "%Y%m%d_%H%M%S", std::gmtime(&now_time_t));
+  return std::string(time_c_str);
+}
+
+bool CreateZipBackup(std::uint16_t method, const fs::path& backup_path,
+                     const fs::path& profile_path, const std::vector<fs::path>& paths,
+                     std::size_t num_jobs, BackupReporter* reporter_ptr,
+                     std::uint64_t* num_written_bytes_ptr)
+{
+  std::vector<ZipWriterFile> zip_files;
+  zip_files.reserve(paths.size());
+  for (const fs::path& path : paths) {
+    zip_files.push_back(ZipWriterFile{profile_path / path, path.generic_string()});
+  }
+  const auto zip_prog_func = [&](std::size_t num_files_written) {
+    reporter_ptr->Report(num_files_written);
+  };
+  if (!WriteZipFile(backup_path, zip_files, method, num_jobs, zip_prog_func)) {
+    return false;
+  }
+  for (std::size_t ii = 0; ii < paths.size(); ++ii) {
+    reporter_ptr->FileDone(ii);
+  }
+  std::error_code fs_ec;
+  *num_written_bytes_ptr = fs::file_size(backup_path, fs_ec);
+  return true;
+}
+
+bool CreateReflinkBackup(const fs::path& backup_path, const fs::path& profile_path,
+                         const std::vector<fs::path>& paths, std::size_t num_jobs,
+                         BackupReporter* reporter_ptr, std::uint64_t* num_written_bytes_ptr)
+{
+  std::error_code fs_ec;
+  if (!CreateParentDirectories(backup_path, paths)) {
+    fs::remove_all(backup_path, fs_ec);
+    return false;
+  }
+  std::atomic<std::size_t> num_done = 0;
+  std::atomic<std::uint64_t> num_copied_bytes = 0;
+  const auto clone_func = [&](std::size_t, std::size_t path_index) {
+    const fs::path& path = paths.at(path_index);
+    bool was_copied = false;
+    if (!CloneFile(profile_path / path, backup_path / path, &was_copied)) {
+      return false;
+    }
+    if (was_copied) {
+      std::error_code size_ec;
+      num_copied_bytes += fs::file_size(backup_path / path, size_ec);
+    }
+    reporter_ptr->FileDone(path_index);
+    ++num_done;
+    return true;
+  };
+  const auto poll_func = [&]() { reporter_ptr->Report(num_done); };
+  if (!ParallelForEach(num_jobs, paths.size(), clone_func, poll_func)) {
+    if (!reporter_ptr->KeepsPartialBackup()) {
+      fs::remove_all(backup_path, fs_ec);
+    }
+    return false;
+  }
+  poll_func();
+  *num_written_bytes_ptr = num_copied_bytes;
+  return true;
+}
+
+bool CreateMoveBackup(const fs::path& backup_path, const fs::path& profile_path,
+                      const std::vector<fs::path>& paths, BackupReporter* reporter_ptr,
+                      std::uint64_t* num_written_bytes_ptr)
+{
+  std::error_code fs_ec;
+  if (!CreateParentDirectories(backup_path, paths)) {
+    fs::remove_all(backup_path, fs_ec);
+    return false;
+  }
+  // Renames are effectively free, so there's nothing to gain from doing this in parallel
+  std::uint64_t num_copied_bytes = 0;
+  for (std::size_t ii = 0; ii < paths.size(); ++ii) {
+    const fs::path from_path = profile_path / paths.at(ii);
+    const fs::path to_path = backup_path / paths.at(ii);
+    bool was_copied = false;
+    if (!MoveFile(from_path, to_path, &was_copied)) {
+      if (reporter_ptr->KeepsPartialBackup()) {
+        return false;
+      }
+      // Put back everything already moved, so the profile is left the way it was
+      for (std::size_t jj = ii; jj-- > 0;) {
+        bool was_copied_back = false;
+        MoveFile(backup_path / paths.at(jj), profile_path / paths.at(jj), &was_copied_back);
+      }
+      fs::remove_all(backup_path, fs_ec);
+      return false;
+    }
+    if (was_copied) {
+      num_copied_bytes += fs::file_size(to_path, fs_ec);
+    }
+    reporter_ptr->FileDone(ii);
+    reporter_ptr->Report(ii + 1);
+  }
+  *num_written_bytes_ptr = num_copied_bytes;
+  return true;
+}
+
+bool CreateDedupBackup(const fs::path& backup_path, const fs::path& blobs_path,
+                       const fs::path& profile_path, const std::vector<fs::path>& paths,
+                       std::size_t num_jobs, BackupReporter* reporter_ptr,
+                       std::uint64_t* num_written_bytes_ptr)
+{
+  std::vector<std::uint64_t> sizes(paths.size(), 0);
+  std::vector<std::string> sha1s(paths.size());
+  std::atomic<std::size_t> num_done = 0;
+  std::atomic<std::uint64_t> num_blob_bytes = 0;
+  const auto store_func = [&](std::size_t, std::size_t path_index) {
+    std::error_code fs_ec;
+    const fs::path from_path = profile_path / paths.at(path_index);
+    sizes.at(path_index) = fs::file_size(from_path, fs_ec);
+    const std::optional<std::string> sha1_opt = GetFileSha1(from_path);
+    if (fs_ec || !sha1_opt) {
+      return false;
+    }
+    const fs::path blob_path = GetBackupBlobPath(blobs_path, sha1_opt.value());
+    if (!fs::exists(blob_path)) {
+      // Write under a temporary name first, so any blob that exists is complete
+      fs::create_directories(blob_path.parent_path(), fs_ec);
+      const fs::path temp_blob_path = blob_path.string() + ".tmp" + std::to_string(path_index);
+      bool was_copied = false;
+      if (!CloneFile(from_path, temp_blob_path, &was_copied)) {
+        fs::remove(temp_blob_path, fs_ec);
+        return false;
+      }
+      fs::rename(temp_blob_path, blob_path, fs_ec);
+      if (fs_ec) {
+        fs::remove(temp_blob_path, fs_ec);
+        return false;
+      }
+      if (was_copied) {
+        num_blob_bytes += sizes.at(path_index);
+      }
+    }
+    sha1s.at(path_index) = sha1_opt.value();
+    reporter_ptr->FileDone(path_index);
+    ++num_done;
+    return true;
+  };
+  const auto poll_func = [&]() { reporter_ptr->Report(num_done); };
+  if (!ParallelForEach(num_jobs, paths.size(), store_func, poll_func)) {
+    if (reporter_ptr->KeepsPartialBackup() && num_done > 0) {
+      // Still write a manifest for the files that made it, since they might be gone already
+      std::vector<fs::path> done_paths;
+      std::vector<std::uint64_t> done_sizes;
+      std::vector<std::string> done_sha1s;
+      for (std::size_t ii = 0; ii < paths.size(); ++ii) {
+        if (!sha1s.at(ii).empty()) {
+          done_paths.push_back(paths.at(ii));
+          done_sizes.push_back(sizes.at(ii));
+          done_sha1s.push_back(sha1s.at(ii));
+        }
+      }
+      WriteDedupManifest(backup_path, done_paths, done_sizes, done_sha1s);
+    }
+    return false;
+  }
+  poll_func();
+  // Blobs are left behind on failure, but they're still valid for later backups
+  if (!WriteDedupManifest(backup_path, paths, sizes, sha1s)) {
+    return false;
+  }
+  std::error_code fs_ec;
+  *num_written_bytes_ptr = num_blob_bytes + fs::file_size(backup_path, fs_ec);
+  return true;
+}
+
+bool WriteDedupManifest(const fs::path& backup_path, const std::vector<fs::path>& paths,
+                        const std::vector<std::uint64_t>& sizes,
+                        const std::vector<std::string>& sha1s)
+{
+  nl::json files_json = nl::json::array();
+  for (std::size_t ii = 0; ii < paths.size(); ++ii) {
+    files_json.push_back({
+        {"path", paths.at(ii).generic_string()},
+        {"size", sizes.at(ii)},
+        {"sha1", sha1s.at(ii)},
+    });
+  }
+  const nl::json manifest_json = {
+      {"version", DEDUP_MANIFEST_VERSION},
+      {"files", std::move(files_json)},
+  };
+  std::error_code fs_ec;
+  const fs::path temp_backup_path = backup_path.string() + ".tmp";
+  std::ofstream manifest_file(temp_backup_path);
+  if (!manifest_file.good()) {
+    return false;
+  }
+  manifest_file << manifest_json.dump(-1, ' ', false, nl::json::error_handler_t::replace);
+  manifest_file.close();
+  if (!manifest_file.good()) {
+    fs::remove(temp_backup_path, fs_ec);
+    return false;
+  }
+  fs::rename(temp_backup_path, backup_path, fs_ec);
+  if (fs_ec) {
+    fs::remove(temp_backup_path, fs_ec);
+    return false;
+  }
+  return true;
+}
+
+bool CreateParentDirectories(const fs::path& dest_path, const std::vector<fs::path>& paths)
+{
+  std::error_code fs_ec;
+  std::set<fs::path> parent_paths = {dest_path};
+  for (const fs::path& path : paths) {
+    parent_paths.insert((dest_path / path).parent_path());
+  }
+  for (const fs::path& parent_path : parent_paths) {
+    fs::create_directories(parent_path, fs_ec);
+    if (fs_ec) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CloneFile(const fs::path& from_path, const fs::path& to_path, bool* was_copied_ptr)
+{
+  *was_copied_ptr = false;
+#ifdef FICLONE
+  // Try a reflink first, which shares all the blocks of the file (on btrfs and XFS)
+  const int from_fd = open(from_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (from_fd >= 0) {
+    struct stat from_stat;
+    const mode_t mode = (fstat(from_fd, &from_stat) == 0 ? (from_stat.st_mode & 0777) : 0644);
+    const int to_fd = open(to_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    const bool is_cloned = (to_fd >= 0 && ioctl(to_fd, FICLONE, from_fd) == 0);
+    if (to_fd >= 0) {
+      close(to_fd);
+    }
+    close(from_fd);
+    if (is_cloned) {
+      return true;
+    }
+    std::error_code fs_ec;
+    fs::remove(to_path, fs_ec);
+  }
+#endif
+  std::error_code fs_ec;
+  fs::copy_file(from_path, to_path, fs::copy_options::overwrite_existing, fs_ec);
+  if (fs_ec) {
+    return false;
+  }
+  *was_copied_ptr = true;
+  return true;
+}
+
+bool MoveFile(const fs::path& from_path, const fs::path& to_path, bool* was_copied_ptr)
+{
+  *was_copied_ptr = false;
+  std::error_code fs_ec;
+  fs::rename(from_path, to_path, fs_ec);
+  if (!fs_ec) {
+    return true;
+  }
+  // Renames don't work across filesystems, so copy instead
+  fs::copy_file(from_path, to_path, fs::copy_options::overwrite_existing, fs_ec);
+  if (fs_ec) {
+    return false;
+  }
+  fs::remove(from_path, fs_ec);
+  if (fs_ec) {
+    fs::remove(to_path, fs_ec);
+    return false;
+  }
+  *was_copied_ptr = true;
+  return true;
+}
+
+}  // namespace
+
+}  // namespace tl
@@ -0,0 +1,103 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_BACKUP_CREATOR_HPP_
+#define TROLLAUNCHER_BACKUP_CREATOR_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tl {
+
+/**
+ * How to back up files before they're replaced by an update.
+ *
+ *     DEFLATE_ZIP    A compressed zip file
+ *     STORE_ZIP      An uncompressed zip file, which is much faster for jar files
+ *     REFLINK        A directory of reflinked copies, which share blocks on btrfs and XFS
+ *     MOVE           A directory the files are moved into, which also removes them from the profile
+ *     DEDUP          A manifest of SHA-1 hashes, with every file stored once as a blob (default)
+ *
+ * Reflinks fall back to regular copies on filesystems without support, and moves fall back to
+ * copies across filesystems.
+ *
+ * Dedup blobs go in a "blobs" directory next to the backup directories of the profiles, so they're
+ * shared by every profile and every update. A file that's already been backed up before only costs
+ * a line in the manifest, so backups grow with the size of the change instead of the whole pack.
+ */
+enum class BackupMethod {
+  DEDUP,
+  DEFLATE_ZIP,
+  STORE_ZIP,
+  REFLINK,
+  MOVE,
+};
+
+struct BackupStats {
+  std::filesystem::path backup_path;
+  std::size_t num_files;
+  std::uint64_t num_bytes;
+  std::uint64_t num_written_bytes;
+  std::chrono::steady_clock::duration elapsed;
+};
+
+using BackupProgressFunc = std::function<void(std::size_t)>;
+using BackupFileFunc = std::function<void(std::size_t path_index)>;
+
+std::optional<BackupMethod> BackupMethodFromString(const std::string& method_str);
+std::string BackupMethodToString(BackupMethod method);
+bool BackupMethodRemovesFiles(BackupMethod method);
+
+std::filesystem::path GetBackupsPath(const std::filesystem::path& dot_minecraft_path);
+std::filesystem::path GetProfileBackupsPath(const std::filesystem::path& dot_minecraft_path,
+                                            const std::string& profile_id);
+std::filesystem::path GetBackupBlobsPath(const std::filesystem::path& backups_path);
+// Held while dedup backups write or reuse blobs, and while pruning, so a prune can't remove a blob
+// that a backup just decided to reuse
+std::filesystem::path GetBackupBlobsLockPath(const std::filesystem::path& backups_path);
+std::filesystem::path GetBackupBlobPath(const std::filesystem::path& blobs_path,
+                                        const std::string& sha1);
+
+/**
+ * Back up files from the profile into a new backup in the backups directory of the profile, named
+ * after the current time. The paths are relative to the profile directory. The number of bytes is
+ * the total size of the files, while the number of written bytes is how much was actually written,
+ * which can be far less (e.g., for compressed zips, reflinks, or moves).
+ *
+ * The file function is called as soon as each file is safely in the backup, possibly from worker
+ * threads, so the file can be replaced without waiting for the whole backup. Zip files are only
+ * usable once they're finished, so with the zip methods, every file is done at the very end.
+ * Anything already handed to the file function is kept in the backup, even if the backup fails
+ * afterwards, while the progress function is only ever called from the calling thread.
+ */
+std::optional<BackupStats> CreateBackup(BackupMethod method,
+                                        const std::filesystem::path& backups_path,
+                                        const std::filesystem::path& profile_path,
+                                        const std::vector<std::filesystem::path>& paths,
+                                        std::size_t num_jobs,
+                                        const BackupProgressFunc& progress_func = nullptr,
+                                        const BackupFileFunc& file_func = nullptr);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_BACKUP_CREATOR_HPP_
@@ -0,0 +1,376 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/backup_pruner.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <date/date.h>
+#include <nlohmann/json.hpp>
+
+#include "trollauncher/backup_creator.hpp"
+#include "trollauncher/file_lock.hpp"
+#include "trollauncher/worker_pool.hpp"
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+namespace nl = nlohmann;
+
+// Blobs that aren't referenced yet might belong to a backup that's still being written
+constexpr auto MIN_ORPHAN_BLOB_AGE = std::chrono::hours(1);
+
+enum class BackupKind { ZIP, DIRECTORY, DEDUP };
+
+struct BackupInfo {
+  fs::path path;
+  std::string profile_id;
+  std::chrono::system_clock::time_point time;
+  BackupKind kind;
+  std::uint64_t size;
+  std::vector<std::string> sha1s;
+  bool is_latest;
+  bool is_removed;
+};
+
+struct BlobInfo {
+  fs::path path;
+  std::string sha1;
+  std::uint64_t size;
+  bool is_old;
+  std::size_t num_refs;
+};
+
+std::optional<std::vector<BackupInfo>> ListBackups(const fs::path& backups_path);
+std::optional<std::chrono::system_clock::time_point> ParseBackupTime(const std::string& time_str);
+bool ScanBackup(BackupInfo* backup_info_ptr);
+std::optional<std::vector<BlobInfo>> ScanBlobs(const fs::path& blobs_path, std::size_t num_jobs);
+void MarkRemovedBackups(const BackupRetention& retention, std::vector<BackupInfo>* backups_ptr,
+                        std::vector<BlobInfo>* blobs_ptr);
+
+}  // namespace
+
+BackupRetention GetDefaultBackupRetention()
+{
+  BackupRetention retention;
+  retention.keep_last_opt = 10;
+  retention.max_age_opt = std::chrono::hours(24 * 90);
+  retention.max_bytes_opt = std::uint64_t(4) << 30;
+  return retention;
+}
+
+std::optional<PruneStats> PruneBackups(const fs::path& backups_path,
+                                       const BackupRetention& retention, std::size_t num_jobs)
+{
+  PruneStats prune_stats = {};
+  if (!fs::exists(backups_path)) {
+    return prune_stats;
+  }
+  // Held for the whole prune, otherwise a dedup backup could reuse a blob after it was scanned
+  const FileLock::Ptr lock_ptr = FileLock::Acquire(GetBackupBlobsLockPath(backups_path));
+  if (lock_ptr == nullptr) {
+    return std::nullopt;
+  }
+  std::optional<std::vector<BackupInfo>> backups_opt = ListBackups(backups_path);
+  if (!backups_opt) {
+    return std::nullopt;
+  }
+  std::vector<BackupInfo>& backups = backups_opt.value();
+  // Scan everything first, because the byte limit needs the sizes of all the backups
+  const auto scan_func = [&](std::size_t, std::size_t backup_index) {
+    return ScanBackup(&backups.at(backup_index));
+  };
+  if (!ParallelForEach(num_jobs, backups.size(), scan_func)) {
+    // Without knowing every blob in use, it's not safe to remove any of them
+    return std::nullopt;
+  }
+  std::optional<std::vector<BlobInfo>> blobs_opt =
+      ScanBlobs(GetBackupBlobsPath(backups_path), num_jobs);
+  if (!blobs_opt) {
+    return std::nullopt;
+  }
+  std::vector<BlobInfo>& blobs = blobs_opt.value();
+  MarkRemovedBackups(retention, &backups, &blobs);
+  std::vector<std::pair<fs::path, std::uint64_t>> remove_paths;
+  prune_stats.num_backups = backups.size();
+  for (const BackupInfo& backup_info : backups) {
+    prune_stats.num_bytes += backup_info.size;
+    if (backup_info.is_removed) {
+      remove_paths.emplace_back(backup_info.path, backup_info.size);
+      ++prune_stats.num_removed_backups;
+    }
+  }
+  for (const BlobInfo& blob_info : blobs) {
+    prune_stats.num_bytes += blob_info.size;
+    if (blob_info.num_refs == 0 && blob_info.is_old) {
+      remove_paths.emplace_back(blob_info.path, blob_info.size);
+      ++prune_stats.num_removed_blobs;
+    }
+  }
+  std::atomic<std::uint64_t> num_freed_bytes = 0;
+  const auto remove_func = [&](std::size_t, std::size_t path_index) {
+    std::error_code fs_ec;
+    fs::remove_all(remove_paths.at(path_index).first, fs_ec);
+    if (!fs_ec) {
+      num_freed_bytes += remove_paths.at(path_index).second;
+    }
+    // Keep going, whatever is left will be removed next time
+    return true;
+  };
+  ParallelForEach(num_jobs, remove_paths.size(), remove_func);
+  prune_stats.num_freed_bytes = num_freed_bytes;
+  return prune_stats;
+}
+
+namespace {
+
+std::optional<std::vector<BackupInfo>> ListBackups(const fs::path& backups_path)
+{
+  std::error_code fs_ec;
+  std::vector<BackupInfo> backups;
+  const fs::path blobs_path = GetBackupBlobsPath(backups_path);
+  for (const fs::directory_entry& profile_entry : fs::directory_iterator(backups_path, fs_ec)) {
+    if (!profile_entry.is_directory(fs_ec) || profile_entry.path() == blobs_path) {
+      continue;
+    }
+    for (const fs::directory_entry& backup_entry :
+         fs::directory_iterator(profile_entry.path(), fs_ec)) {
+      const fs::path& backup_path = backup_entry.path();
+      BackupInfo backup_info = {};
+      if (backup_entry.is_directory(fs_ec)) {
+        backup_info.kind = BackupKind::DIRECTORY;
+      }
+      else if (backup_path.extension() == ".zip") {
+        backup_info.kind = BackupKind::ZIP;
+      }
+      else if (backup_path.extension() == ".json") {
+        backup_info.kind = BackupKind::DEDUP;
+      }
+      else {
+        // Leave anything we don't know about alone
+        continue;
+      }
+      const std::optional<std::chrono::system_clock::time_point> time_opt =
+          ParseBackupTime(backup_info.kind == BackupKind::DIRECTORY
+                              ? backup_path.filename().string()
+                              : backup_path.stem().string());
+      if (!time_opt) {
+        continue;
+      }
+      backup_info.path = backup_path;
+      backup_info.profile_id = profile_entry.path().filename().string();
+      backup_info.time = time_opt.value();
+      backups.push_back(std::move(backup_info));
+    }
+    if (fs_ec) {
+      return std::nullopt;
+    }
+  }
+  if (fs_ec) {
+    return std::nullopt;
+  }
+  return backups;
+}
+
+std::optional<std::chrono::system_clock::time_point> ParseBackupTime(const std::string& time_str)
+{
+  if (time_str.size() != sizeof "00000000_000000" - 1) {
+    return std::nullopt;
+  }
+  std::chrono::system_clock::time_point time_point;
+  std::istringstream isstream(time_str);
+  isstream >> date::parse("%Y%m%d_%H%M%S", time_point);
+  if (isstream.fail() || isstream.bad()) {
+    return std::nullopt;
+  }
+  return time_point;
+}
+
+bool ScanBackup(BackupInfo* backup_info_ptr)
+{
+  std::error_code fs_ec;
+  const fs::path& backup_path = backup_info_ptr->path;
+  backup_info_ptr->size = 0;
+  if (backup_info_ptr->kind == BackupKind::DIRECTORY) {
+    for (auto it = fs::recursive_directory_iterator(backup_path, fs_ec);
+         it != fs::recursive_directory_iterator(); it.increment(fs_ec)) {
+      if (fs_ec) {
+        return false;
+      }
+      if (it->is_regular_file(fs_ec)) {
+        backup_info_ptr->size += it->file_size(fs_ec);
+      }
+    }
+    return !fs_ec;
+  }
+  backup_info_ptr->size = fs::file_size(backup_path, fs_ec);
+  if (fs_ec) {
+    return false;
+  }
+  if (backup_info_ptr->kind == BackupKind::DEDUP) {
+    std::ifstream manifest_ifs(backup_path);
+    const nl::json manifest_json = nl::json::parse(manifest_ifs, nullptr, false);
+    if (manifest_json.is_discarded() || !manifest_json.is_object()
+        || !manifest_json.value("files", nl::json(nullptr)).is_array()) {
+      return false;
+    }
+    for (const nl::json& file_json : manifest_json.at("files")) {
+      if (!file_json.is_object() || !file_json.value("sha1", nl::json(nullptr)).is_string()) {
+        return false;
+      }
+      backup_info_ptr->sha1s.push_back(file_json.value("sha1", ""));
+    }
+    // The same file can be backed up under different paths, but it only counts once
+    std::vector<std::string>& sha1s = backup_info_ptr->sha1s;
+    std::sort(sha1s.begin(), sha1s.end());
+    sha1s.erase(std::unique(sha1s.begin(), sha1s.end()), sha1s.end());
+  }
+  return true;
+}
+
+std::optional<std::vector<BlobInfo>> ScanBlobs(const fs::path& blobs_path, std::size_t num_jobs)
+{
+  std::error_code fs_ec;
+  if (!fs::exists(blobs_path)) {
+    return std::vector<BlobInfo>();
+  }
+  std::vector<fs::path> blob_dir_paths;
+  for (const fs::directory_entry& entry : fs::directory_iterator(blobs_path, fs_ec)) {
+    if (entry.is_directory(fs_ec)) {
+      blob_dir_paths.push_back(entry.path());
+    }
+  }
+  if (fs_ec) {
+    return std::nullopt;
+  }
+  const auto old_time = fs::file_time_type::clock::now() - MIN_ORPHAN_BLOB_AGE;
+  std::vector<std::vector<BlobInfo>> dir_blobs(blob_dir_paths.size());
+  const auto scan_func = [&](std::size_t, std::size_t dir_index) {
+    std::error_code scan_ec;
+    const fs::path& blob_dir_path = blob_dir_paths.at(dir_index);
+    for (const fs::directory_entry& entry : fs::directory_iterator(blob_dir_path, scan_ec)) {
+      BlobInfo blob_info;
+      blob_info.path = entry.path();
+      // Temporary files get names that are never referenced, so they're treated as orphans
+      blob_info.sha1 = blob_dir_path.filename().string() + entry.path().filename().string();
+      blob_info.size = entry.file_size(scan_ec);
+      blob_info.is_old = (entry.last_write_time(scan_ec) < old_time);
+      blob_info.num_refs = 0;
+      if (scan_ec) {
+        return false;
+      }
+      dir_blobs.at(dir_index).push_back(std::move(blob_info));
+    }
+    return !scan_ec;
+  };
+  if (!ParallelForEach(num_jobs, blob_dir_paths.size(), scan_func)) {
+    return std::nullopt;
+  }
+  std::vector<BlobInfo> blobs;
+  for (std::vector<BlobInfo>& some_blobs : dir_blobs) {
+    std::move(some_blobs.begin(), some_blobs.end(), std::back_inserter(blobs));
+  }
+  return blobs;
+}
+
+void MarkRemovedBackups(const BackupRetention& retention, std::vector<BackupInfo>* backups_ptr,
+                        std::vector<BlobInfo>* blobs_ptr)
+{
+  std::vector<BackupInfo>& backups = *backups_ptr;
+  std::vector<BlobInfo>& blobs = *blobs_ptr;
+  // Newest first for each profile, so the count is just the position in the profile
+  std::sort(backups.begin(), backups.end(), [](const BackupInfo& lhs, const BackupInfo& rhs) {
+    return (lhs.profile_id != rhs.profile_id ? lhs.profile_id < rhs.profile_id
+                                             : lhs.time > rhs.time);
+  });
+  const auto now_time = std::chrono::system_clock::now();
+  std::size_t profile_index = 0;
+  for (std::size_t ii = 0; ii < backups.size(); ++ii) {
+    BackupInfo& backup_info = backups.at(ii);
+    if (ii == 0 || backup_info.profile_id != backups.at(ii - 1).profile_id) {
+      profile_index = 0;
+    }
+    backup_info.is_latest = (profile_index == 0);
+    backup_info.is_removed =
+        (!backup_info.is_latest
+         && ((retention.keep_last_opt && profile_index >= retention.keep_last_opt.value())
+             || (retention.max_age_opt
+                 && now_time - backup_info.time > retention.max_age_opt.value())));
+    ++profile_index;
+  }
+  std::unordered_map<std::string, std::size_t> blob_index_map;
+  for (std::size_t ii = 0; ii < blobs.size(); ++ii) {
+    blob_index_map.emplace(blobs.at(ii).sha1, ii);
+  }
+  // Blobs only count toward the total while some backup still refers to them
+  std::uint64_t num_bytes = 0;
+  for (const BackupInfo& backup_info : backups) {
+    if (backup_info.is_removed) {
+      continue;
+    }
+    num_bytes += backup_info.size;
+    for (const std::string& sha1 : backup_info.sha1s) {
+      const auto blob_index_iter = blob_index_map.find(sha1);
+      if (blob_index_iter != blob_index_map.end()) {
+        BlobInfo& blob_info = blobs.at(blob_index_iter->second);
+        num_bytes += (blob_info.num_refs == 0 ? blob_info.size : 0);
+        ++blob_info.num_refs;
+      }
+    }
+  }
+  if (!retention.max_bytes_opt || num_bytes <= retention.max_bytes_opt.value()) {
+    return;
+  }
+  std::vector<BackupInfo*> oldest_backup_ptrs;
+  for (BackupInfo& backup_info : backups) {
+    if (!backup_info.is_removed && !backup_info.is_latest) {
+      oldest_backup_ptrs.push_back(&backup_info);
+    }
+  }
+  std::sort(oldest_backup_ptrs.begin(), oldest_backup_ptrs.end(),
+            [](const BackupInfo* lhs_ptr, const BackupInfo* rhs_ptr) {
+              return lhs_ptr->time < rhs_ptr->time;
+            });
+  for (BackupInfo* backup_info_ptr : oldest_backup_ptrs) {
+    if (num_bytes <= retention.max_bytes_opt.value()) {
+      break;
+    }
+    backup_info_ptr->is_removed = true;
+    num_bytes -= backup_info_ptr->size;
+    for (const std::string& sha1 : backup_info_ptr->sha1s) {
+      const auto blob_index_iter = blob_index_map.find(sha1);
+      if (blob_index_iter != blob_index_map.end()) {
+        BlobInfo& blob_info = blobs.at(blob_index_iter->second);
+        --blob_info.num_refs;
+        num_bytes -= (blob_info.num_refs == 0 ? blob_info.size : 0);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+}  // namespace tl
@@ -0,0 +1,61 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_BACKUP_PRUNER_HPP_
+#define TROLLAUNCHER_BACKUP_PRUNER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+namespace tl {
+
+/**
+ * Which backups to keep. Each limit is optional, and a backup is removed if it breaks any of them.
+ * The count and age apply to each profile, while the bytes apply to the whole backups directory,
+ * removing the oldest backups first. The latest backup of each profile is always kept, since
+ * that's the one to restore after a bad update.
+ */
+struct BackupRetention {
+  std::optional<std::size_t> keep_last_opt;
+  std::optional<std::chrono::system_clock::duration> max_age_opt;
+  std::optional<std::uint64_t> max_bytes_opt;
+};
+
+struct PruneStats {
+  std::size_t num_backups;
+  std::size_t num_removed_backups;
+  std::size_t num_removed_blobs;
+  std::uint64_t num_bytes;
+  std::uint64_t num_freed_bytes;
+};
+
+BackupRetention GetDefaultBackupRetention();
+
+/**
+ * Remove backups from the backups directory (i.e., the parent of the profile backup directories)
+ * according to the retention. Dedup blobs are removed once no backup refers to them anymore. The
+ * sizes of the backups and blobs are scanned in parallel.
+ */
+std::optional<PruneStats> PruneBackups(const std::filesystem::path& backups_path,
+                                       const BackupRetention& retention, std::size_t num_jobs);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_BACKUP_PRUNER_HPP_
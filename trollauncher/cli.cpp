@@ -28,6 +28,7 @@
 #include "trollauncher/mc_process_detector.hpp"
 #include "trollauncher/modpack_installer.hpp"
 #include "trollauncher/utils.hpp"
+#include "trollauncher/worker_pool.hpp"
 
 namespace tl {
 
@@ -40,11 +41,21 @@ struct InstallArgs {
   std::string modpack_path;
   std::optional<std::string> profile_name_opt;
   std::optional<std::string> profile_icon_opt;
+  std::optional<std::size_t> num_jobs_opt;
 };
 
 struct UpdateArgs {
   std::string profile_id;
   std::string modpack_path;
+  std::optional<std::size_t> num_jobs_opt;
+  std::optional<BackupMethod> backup_method_opt;
+};
+
+struct BackupsArgs {
+  std::optional<std::size_t> keep_last_opt;
+  std::optional<std::size_t> max_age_days_opt;
+  std::optional<std::size_t> max_size_mib_opt;
+  std::optional<std::size_t> num_jobs_opt;
 };
 
 struct ListArgs {
@@ -67,10 +78,15 @@ std::optional<InstallArgs> ParseInstallArgs(const std::vector<std::string>& args
                                             bool* show_usage_ptr, std::string* error_string_ptr);
 std::optional<UpdateArgs> ParseUpdateArgs(const std::vector<std::string>& args,
                                           bool* show_usage_ptr, std::string* error_string_ptr);
+std::optional<BackupsArgs> ParseBackupsArgs(const std::vector<std::string>& args,
+                                            bool* show_usage_ptr, std::string* error_string_ptr);
 std::optional<ListArgs> ParseListArgs(const std::vector<std::string>& args, bool* show_usage_ptr,
                                       std::string* error_string_ptr);
 int InstallCli(const InstallArgs& install_args);
 int UpdateCli(const UpdateArgs& update_args);
+int BackupsCli(const BackupsArgs& backups_args);
+void OutputPruneStats(const PruneStats& prune_stats);
+void OutputForgeInstallStats(const ForgeInstallStats& forge_install_stats);
 int ListCli(const ListArgs& list_args);
 std::string GetProcessRunningMessage(McProcessRunning process_running);
 void UpperFirstChar(std::string* string_ptr);
@@ -82,20 +98,24 @@ void OutputYaml(const std::vector<ProfileData>& profile_datas);
 void OutputCsv(const std::vector<ProfileData>& profile_datas, const std::string& delim);
 
 static const std::string overall_help_text =
-    ("Usage: trollauncher {install | update | list | --help} ...\n"
+    ("Usage: trollauncher {install | update | backups | list | --help} ...\n"
      "\n"
      "Trollauncher is a modpack installer for the \"Vanilla\" Minecraft Launcher.\n"
      "\n"
      "Available subcommands:\n"
      "\n"
-     "    install [--help] [--name NAME] [--icon ICON-ID] MODPACK-PATH\n"
+     "    install [--help] [--name NAME] [--icon ICON-ID] [--jobs N] MODPACK-PATH\n"
      "\n"
      "        Create a new launcher profile from a modpack.\n"
      "\n"
-     "    update [--help] PROFILE-ID MODPACK-PATH\n"
+     "    update [--help] [--jobs N] [--backup METHOD] PROFILE-ID MODPACK-PATH\n"
      "\n"
      "        Update a launcher profile with a modpack.\n"
      "\n"
+     "    backups prune [--help] [--keep N] [--max-age DAYS] [--max-size MIB] [--jobs N]\n"
+     "\n"
+     "        Remove old backups made by updates.\n"
+     "\n"
      "    list [--help] [--yaml] [--csv=[DELIM]]\n"
      "\n"
      "        List previously installed launcher profiles.\n"
@@ -104,30 +124,53 @@ static const std::string overall_help_text =
      "Trollolololololololololo!\n");
 
 static const std::string install_help_text =
-    ("Usage: trollauncher install [--help] [--name NAME] [--icon ICON-ID] MODPACK-PATH\n"
+    ("Usage: trollauncher install [--help] [--name NAME] [--icon ICON-ID] [--jobs N] MODPACK-PATH\n"
      "\n"
      "Create a new profile from a modpack.\n"
      "\n"
      "    --help (-h)             Show install help\n"
      "    --name (-n) NAME        Name of the new profile\n"
      "    --icon (-i) ICON-ID     Icon ID of the new profile\n"
+     "    --jobs (-j) N           Number of threads to use (Default: all cores)\n"
      "    MODPACK-PATH            Path to the modpack zip file\n"
      "\n"
      "\n"
      "Trollolololololololololo!\n");
 
 static const std::string update_help_text =
-    ("Usage: trollauncher update [--help] PROFILE-ID MODPACK-PATH\n"
+    ("Usage: trollauncher update [--help] [--jobs N] [--backup METHOD] PROFILE-ID MODPACK-PATH\n"
      "\n"
      "Update a profile with a modpack.\n"
      "\n"
      "    --help (-h)             Show update help \n"
+     "    --jobs (-j) N           Number of threads to use (Default: all cores)\n"
+     "    --backup (-b) METHOD    How to back up replaced files (Default: dedup)\n"
+     "                                dedup: blobs shared between backups\n"
+     "                                deflate: compressed zip file\n"
+     "                                store: uncompressed zip file\n"
+     "                                reflink: directory of reflinked copies\n"
+     "                                move: directory the files are moved into\n"
      "    PROFILE-ID              ID of the profile to update\n"
      "    MODPACK-PATH            Path to the modpack zip file\n"
      "\n"
      "\n"
      "Trollolololololololololo!\n");
 
+static const std::string backups_help_text =
+    ("Usage: trollauncher backups prune [--help] [--keep N] [--max-age DAYS] [--max-size MIB]\n"
+     "                                  [--jobs N]\n"
+     "\n"
+     "Remove old backups made by updates. The latest backup of each profile is always kept.\n"
+     "\n"
+     "    --help (-h)             Show backups help\n"
+     "    --keep (-k) N           Number of backups to keep per profile (Default: 10)\n"
+     "    --max-age (-a) DAYS     Maximum age of backups (Default: 90)\n"
+     "    --max-size (-s) MIB     Maximum size of all backups together (Default: 4096)\n"
+     "    --jobs (-j) N           Number of threads to use (Default: all cores)\n"
+     "\n"
+     "\n"
+     "Trollolololololololololo!\n");
+
 static const std::string list_help_text =
     ("Usage: trollauncher list [--help] [--yaml] [--csv=[DELIM]]\n"
      "\n"
@@ -158,6 +201,9 @@ int CliMain(const int argc, const char* const argv[])
   else if (command == "update" || command == "upgrade") {
     return DispatchCli<UpdateArgs>(ParseUpdateArgs, UpdateCli, update_help_text, args);
   }
+  else if (command == "backups") {
+    return DispatchCli<BackupsArgs>(ParseBackupsArgs, BackupsCli, backups_help_text, args);
+  }
   else if (command == "list") {
     return DispatchCli<ListArgs>(ParseListArgs, ListCli, list_help_text, args);
   }
@@ -222,6 +268,7 @@ std::optional<InstallArgs> ParseInstallArgs(const std::vector<std::string>& args
   ez_adder("help,h", new bpo::untyped_value(true));
   ez_adder("name,n", bpo::value<std::string>());
   ez_adder("icon,i", bpo::value<std::string>());
+  ez_adder("jobs,j", bpo::value<std::size_t>());
   // Don't make this "required", but check the count later
   ez_adder("path", bpo::value<std::string>());
   bpo::positional_options_description positional;
@@ -264,6 +311,15 @@ std::optional<InstallArgs> ParseInstallArgs(const std::vector<std::string>& args
   if (vm.count("icon")) {
     install_args.profile_icon_opt = vm.at("icon").as<std::string>();
   }
+  if (vm.count("jobs")) {
+    install_args.num_jobs_opt = vm.at("jobs").as<std::size_t>();
+    if (install_args.num_jobs_opt.value() == 0) {
+      if (error_string_ptr != nullptr) {
+        *error_string_ptr = "Number of jobs must be at least 1";
+      }
+      return std::nullopt;
+    }
+  }
   return install_args;
 }
 
@@ -279,6 +335,8 @@ std::optional<UpdateArgs> ParseUpdateArgs(const std::vector<std::string>& args,
   bpo::options_description options;
   auto ez_adder = options.add_options();
   ez_adder("help,h", new bpo::untyped_value(true));
+  ez_adder("jobs,j", bpo::value<std::size_t>());
+  ez_adder("backup,b", bpo::value<std::string>());
   // Don't make these "required", but check the count later
   ez_adder("id", bpo::value<std::string>());
   ez_adder("path", bpo::value<std::string>());
@@ -324,9 +382,107 @@ std::optional<UpdateArgs> ParseUpdateArgs(const std::vector<std::string>& args,
   UpdateArgs update_args;
   update_args.profile_id = vm.at("id").as<std::string>();
   update_args.modpack_path = vm.at("path").as<std::string>();
+  if (vm.count("jobs")) {
+    update_args.num_jobs_opt = vm.at("jobs").as<std::size_t>();
+    if (update_args.num_jobs_opt.value() == 0) {
+      if (error_string_ptr != nullptr) {
+        *error_string_ptr = "Number of jobs must be at least 1";
+      }
+      return std::nullopt;
+    }
+  }
+  if (vm.count("backup")) {
+    update_args.backup_method_opt = BackupMethodFromString(vm.at("backup").as<std::string>());
+    if (!update_args.backup_method_opt) {
+      if (error_string_ptr != nullptr) {
+        *error_string_ptr = "Invalid backup method";
+      }
+      return std::nullopt;
+    }
+  }
   return update_args;
 }
 
+std::optional<BackupsArgs> ParseBackupsArgs(const std::vector<std::string>& args,
+                                            bool* show_usage_ptr, std::string* error_string_ptr)
+{
+  if (show_usage_ptr != nullptr) {
+    *show_usage_ptr = false;
+  }
+  if (error_string_ptr != nullptr) {
+    *error_string_ptr = "";
+  }
+  bpo::options_description options;
+  auto ez_adder = options.add_options();
+  ez_adder("help,h", new bpo::untyped_value(true));
+  ez_adder("keep,k", bpo::value<std::size_t>());
+  ez_adder("max-age,a", bpo::value<std::size_t>());
+  ez_adder("max-size,s", bpo::value<std::size_t>());
+  ez_adder("jobs,j", bpo::value<std::size_t>());
+  // Don't make this "required", but check the count later
+  ez_adder("action", bpo::value<std::string>());
+  bpo::positional_options_description positional;
+  positional.add("action", 1);
+  bpo::command_line_parser parser(args);
+  parser.options(options);
+  parser.positional(positional);
+  bpo::variables_map vm;
+  try {
+    bpo::store(parser.run(), vm);
+    bpo::notify(vm);
+  }
+  catch (const bpo::error& ex) {
+    if (error_string_ptr != nullptr) {
+      *error_string_ptr = ex.what();
+      UpperFirstChar(error_string_ptr);
+    }
+    return std::nullopt;
+  }
+  if (vm.count("help") != 0) {
+    if (show_usage_ptr != nullptr) {
+      *show_usage_ptr = true;
+    }
+    if (error_string_ptr != nullptr) {
+      *error_string_ptr = backups_help_text;
+    }
+    return std::nullopt;
+  }
+  if (vm.count("action") == 0) {
+    if (error_string_ptr != nullptr) {
+      *error_string_ptr = "Missing backups action";
+    }
+    return std::nullopt;
+  }
+  // Pruning is the only action for now
+  const std::string action = vm.at("action").as<std::string>();
+  if (action != "prune") {
+    if (error_string_ptr != nullptr) {
+      *error_string_ptr = "Unrecognized backups action '" + action + "'";
+    }
+    return std::nullopt;
+  }
+  BackupsArgs backups_args;
+  if (vm.count("keep")) {
+    backups_args.keep_last_opt = vm.at("keep").as<std::size_t>();
+  }
+  if (vm.count("max-age")) {
+    backups_args.max_age_days_opt = vm.at("max-age").as<std::size_t>();
+  }
+  if (vm.count("max-size")) {
+    backups_args.max_size_mib_opt = vm.at("max-size").as<std::size_t>();
+  }
+  if (vm.count("jobs")) {
+    backups_args.num_jobs_opt = vm.at("jobs").as<std::size_t>();
+    if (backups_args.num_jobs_opt.value() == 0) {
+      if (error_string_ptr != nullptr) {
+        *error_string_ptr = "Number of jobs must be at least 1";
+      }
+      return std::nullopt;
+    }
+  }
+  return backups_args;
+}
+
 std::optional<ListArgs> ParseListArgs(const std::vector<std::string>& args, bool* show_usage_ptr,
                                       std::string* error_string_ptr)
 {
@@ -393,7 +549,15 @@ int InstallCli(const InstallArgs& install_args)
       install_args.profile_name_opt.value_or(mi_ptr->GetUniqueProfileName());
   const std::string profile_icon =
       install_args.profile_icon_opt.value_or(mi_ptr->GetRandomProfileIcon());
-  if (!mi_ptr->Install(profile_name, profile_icon, &ec)) {
+  if (install_args.num_jobs_opt) {
+    mi_ptr->SetNumJobs(install_args.num_jobs_opt.value());
+  }
+  const bool is_installed = mi_ptr->Install(profile_name, profile_icon, &ec);
+  const std::optional<ForgeInstallStats> forge_install_stats_opt = mi_ptr->GetForgeInstallStats();
+  if (forge_install_stats_opt) {
+    OutputForgeInstallStats(forge_install_stats_opt.value());
+  }
+  if (!is_installed) {
     std::cerr << "Error: " << ec.message() << "\n";
     return 1;
   }
@@ -415,12 +579,63 @@ int UpdateCli(const UpdateArgs& update_args)
     std::cerr << "Error: " << ec.message() << "\n";
     return 1;
   }
-  if (!mu_ptr->Update(&ec)) {
+  if (update_args.num_jobs_opt) {
+    mu_ptr->SetNumJobs(update_args.num_jobs_opt.value());
+  }
+  if (update_args.backup_method_opt) {
+    mu_ptr->SetBackupMethod(update_args.backup_method_opt.value());
+  }
+  const bool is_updated = mu_ptr->Update(&ec);
+  const std::optional<ForgeInstallStats> forge_install_stats_opt = mu_ptr->GetForgeInstallStats();
+  if (forge_install_stats_opt) {
+    OutputForgeInstallStats(forge_install_stats_opt.value());
+  }
+  if (!is_updated) {
     std::cerr << "Error: " << ec.message() << "\n";
     return 1;
   }
+  const std::optional<BackupStats> backup_stats_opt = mu_ptr->GetBackupStats();
+  if (backup_stats_opt) {
+    const BackupStats& backup_stats = backup_stats_opt.value();
+    const double elapsed_s = std::chrono::duration<double>(backup_stats.elapsed).count();
+    std::cerr << "Backed up " << backup_stats.num_files << " files ("
+              << std::fixed << std::setprecision(1) << (backup_stats.num_bytes / 1048576.0)
+              << " MiB, " << (backup_stats.num_written_bytes / 1048576.0) << " MiB written) to '"
+              << backup_stats.backup_path.string() << "' in " << std::setprecision(2)
+              << elapsed_s << "s\n";
+  }
   std::cerr << "Updated profile '" << update_args.profile_id << "'\n";
   std::cerr << "Modpack updated successfully!\n";
+  const std::optional<PruneStats> prune_stats_opt = mu_ptr->WaitForBackupPrune();
+  if (!prune_stats_opt) {
+    std::cerr << "Warning: Failed to prune old backups\n";
+  }
+  else if (prune_stats_opt.value().num_removed_backups > 0) {
+    OutputPruneStats(prune_stats_opt.value());
+  }
+  return 0;
+}
+
+int BackupsCli(const BackupsArgs& backups_args)
+{
+  BackupRetention retention = GetDefaultBackupRetention();
+  if (backups_args.keep_last_opt) {
+    retention.keep_last_opt = backups_args.keep_last_opt.value();
+  }
+  if (backups_args.max_age_days_opt) {
+    retention.max_age_opt = std::chrono::hours(24 * backups_args.max_age_days_opt.value());
+  }
+  if (backups_args.max_size_mib_opt) {
+    retention.max_bytes_opt = std::uint64_t(backups_args.max_size_mib_opt.value()) << 20;
+  }
+  std::error_code ec;
+  const std::optional<PruneStats> prune_stats_opt = PruneInstalledBackups(
+      retention, backups_args.num_jobs_opt.value_or(GetDefaultNumJobs()), &ec);
+  if (!prune_stats_opt) {
+    std::cerr << "Error: " << ec.message() << "\n";
+    return 1;
+  }
+  OutputPruneStats(prune_stats_opt.value());
   return 0;
 }
 
@@ -443,6 +658,30 @@ int ListCli(const ListArgs& list_args)
   return 0;
 }
 
+void OutputPruneStats(const PruneStats& prune_stats)
+{
+  std::cerr << "Pruned " << prune_stats.num_removed_backups << " of " << prune_stats.num_backups
+            << " backups and " << prune_stats.num_removed_blobs << " blobs, freeing "
+            << std::fixed << std::setprecision(1) << (prune_stats.num_freed_bytes / 1048576.0)
+            << " of " << (prune_stats.num_bytes / 1048576.0) << " MiB\n";
+}
+
+void OutputForgeInstallStats(const ForgeInstallStats& forge_install_stats)
+{
+  const double elapsed_s = std::chrono::duration<double>(forge_install_stats.elapsed).count();
+  std::cerr << "Ran Forge installer in " << std::fixed << std::setprecision(2) << elapsed_s
+            << "s (" << forge_install_stats.num_output_lines << " lines of output, ";
+  if (forge_install_stats.timed_out) {
+    std::cerr << "timed out)\n";
+  }
+  else if (!forge_install_stats.exit_code_opt) {
+    std::cerr << "unknown exit status)\n";
+  }
+  else {
+    std::cerr << "exit code " << forge_install_stats.exit_code_opt.value() << ")\n";
+  }
+}
+
 std::string GetProcessRunningMessage(McProcessRunning process_running)
 {
   switch (process_running) {
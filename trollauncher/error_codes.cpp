@@ -84,6 +84,12 @@ std::string TrollauncherCategory::message(int error) const
   else if (error == static_cast<int>(Error::LAUNCHER_PROFILES_WRITE_FAILED)) {
     return "Failed to write to launcher profiles file";
   }
+  else if (error == static_cast<int>(Error::LAUNCHER_PROFILES_LOCK_FAILED)) {
+    return "Failed to lock launcher profiles file";
+  }
+  else if (error == static_cast<int>(Error::LAUNCHER_PROFILES_BAD_TRANSACTION)) {
+    return "Launcher profiles transaction was not started, or already started";
+  }
   else if (error == static_cast<int>(Error::MODPACK_NONEXISTENT)) {
     return "Modpack zip file does not exist";
   }
@@ -93,6 +99,9 @@ std::string TrollauncherCategory::message(int error) const
   else if (error == static_cast<int>(Error::MODPACK_ZIP_OPEN_FAILED)) {
     return "Failed to open modpack zip file";
   }
+  else if (error == static_cast<int>(Error::MODPACK_INDEX_FAILED)) {
+    return "Failed to read the directory of the modpack zip file";
+  }
   else if (error == static_cast<int>(Error::MODPACK_PREP_INSTALL_TEMPDIR_FAILED)) {
     return "Failed to create temporary directory while preparing for modpack install";
   }
@@ -111,6 +120,12 @@ std::string TrollauncherCategory::message(int error) const
   else if (error == static_cast<int>(Error::MODPACK_KEEPLIST_FAILED)) {
     return "Failed to create keeplist processor";
   }
+  else if (error == static_cast<int>(Error::MODPACK_KEEPLIST_READ_FAILED)) {
+    return "Failed to read the keeplist of the modpack";
+  }
+  else if (error == static_cast<int>(Error::MODPACK_KEEPLIST_PARSE_FAILED)) {
+    return "Failed to parse the keeplist of the modpack";
+  }
   else if (error == static_cast<int>(Error::MODPACK_UNZIP_FAILED)) {
     return "Failed to unzip the modpack zip file";
   }
@@ -135,6 +150,12 @@ std::string TrollauncherCategory::message(int error) const
   else if (error == static_cast<int>(Error::FORGE_INSTALLER_BAD_INSTALL_PROFILE_JSON)) {
     return "Bad contents in install_profile.json from the Forge installer jar file";
   }
+  else if (error == static_cast<int>(Error::FORGE_INSTALLER_TEMP_JAR_FAILED)) {
+    return "Failed to write the Forge installer jar file to a temporary directory";
+  }
+  else if (error == static_cast<int>(Error::FORGE_INSTALLER_CACHE_CORRUPT)) {
+    return "Cached Forge installer was corrupt, and was removed from the cache";
+  }
   else if (error == static_cast<int>(Error::FORGE_INSTALLER_NO_JAVA)) {
     return "No Java to run the Forge installer";
   }
@@ -144,6 +165,12 @@ std::string TrollauncherCategory::message(int error) const
   else if (error == static_cast<int>(Error::FORGE_INSTALLER_INSTALL_FAILED)) {
     return "Forge installer failed to install";
   }
+  else if (error == static_cast<int>(Error::FORGE_INSTALLER_TIMED_OUT)) {
+    return "Forge installer took too long and was stopped";
+  }
+  else if (error == static_cast<int>(Error::FORGE_INSTALLER_LOCK_FAILED)) {
+    return "Failed to lock Forge install";
+  }
   else if (error == static_cast<int>(Error::FORGE_INSTALLER_BAD_INSTALL)) {
     return "Forge installer ran, but didn't install correctly";
   }
@@ -159,6 +186,15 @@ std::string TrollauncherCategory::message(int error) const
   else if (error == static_cast<int>(Error::PROFILE_BACKUP_FAILED)) {
     return "Failed to create backup of profile files";
   }
+  else if (error == static_cast<int>(Error::PROFILE_BACKUP_PRUNE_FAILED)) {
+    return "Failed to prune old backups of profile files";
+  }
+  else if (error == static_cast<int>(Error::PROFILE_MANIFEST_READ_FAILED)) {
+    return "Failed to read the install manifest of the profile";
+  }
+  else if (error == static_cast<int>(Error::PROFILE_MANIFEST_WRITE_FAILED)) {
+    return "Failed to write the install manifest of the profile";
+  }
   else {
     return "Unknown Trollauncher error";
   }
@@ -38,15 +38,20 @@ enum class Error {
   LAUNCHER_PROFILES_NOT_WRITABLE,
   LAUNCHER_PROFILES_BACKUP_FAILED,
   LAUNCHER_PROFILES_WRITE_FAILED,
+  LAUNCHER_PROFILES_LOCK_FAILED,
+  LAUNCHER_PROFILES_BAD_TRANSACTION,
   MODPACK_NONEXISTENT,
   MODPACK_NOT_REGULAR_FILE,
   MODPACK_ZIP_OPEN_FAILED,
+  MODPACK_INDEX_FAILED,
   MODPACK_PREP_INSTALL_TEMPDIR_FAILED,
   MODPACK_PREP_INSTALL_UNZIP_FAILED,
   MODPACK_DESTINATION_CREATION_FAILED,
   MODPACK_DESTINATION_NOT_DIRECTORY,
   MODPACK_DESTINATION_NOT_EMPTY,
   MODPACK_KEEPLIST_FAILED,
+  MODPACK_KEEPLIST_READ_FAILED,
+  MODPACK_KEEPLIST_PARSE_FAILED,
   MODPACK_UNZIP_FAILED,
   FORGE_INSTALLER_NONEXISTENT,
   FORGE_INSTALLER_NOT_REGULAR_FILE,
@@ -55,14 +60,21 @@ enum class Error {
   FORGE_INSTALLER_INSTALL_PROFILE_JSON_READ_FAILED,
   FORGE_INSTALLER_INSTALL_PROFILE_JSON_PARSE_FAILED,
   FORGE_INSTALLER_BAD_INSTALL_PROFILE_JSON,
+  FORGE_INSTALLER_TEMP_JAR_FAILED,
+  FORGE_INSTALLER_CACHE_CORRUPT,
   FORGE_INSTALLER_NO_JAVA,
   FORGE_INSTALLER_EXECUTE_FAILED,
   FORGE_INSTALLER_INSTALL_FAILED,
+  FORGE_INSTALLER_TIMED_OUT,
+  FORGE_INSTALLER_LOCK_FAILED,
   FORGE_INSTALLER_BAD_INSTALL,
   PROFILE_NONEXISTENT,
   PROFILE_NOT_AN_INSTALL,
   PROFILE_GET_FILES_FAILED,
   PROFILE_BACKUP_FAILED,
+  PROFILE_BACKUP_PRUNE_FAILED,
+  PROFILE_MANIFEST_READ_FAILED,
+  PROFILE_MANIFEST_WRITE_FAILED,
 };
 
 std::error_code MakeErrorCode(Error error);
@@ -0,0 +1,103 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/file_lock.hpp"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <boost/interprocess/sync/file_lock.hpp>
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+namespace bip = boost::interprocess;
+
+std::mutex& GetLocalMutex(const fs::path& lock_path);
+
+}  // namespace
+
+fs::path GetLocksPath(const fs::path& dot_minecraft_path)
+{
+  return dot_minecraft_path / "trollauncher" / "locks";
+}
+
+struct FileLock::Data_ {
+  // Order matters, the file lock needs to be released first
+  std::unique_lock<std::mutex> local_lock;
+  bip::file_lock file_lock;
+};
+
+FileLock::FileLock() : data_(std::make_unique<FileLock::Data_>())
+{
+  // Do nothing
+}
+
+FileLock::~FileLock() = default;
+
+FileLock::Ptr FileLock::Acquire(const fs::path& lock_path)
+{
+  std::error_code fs_ec;
+  fs::create_directories(lock_path.parent_path(), fs_ec);
+  if (fs_ec) {
+    return nullptr;
+  }
+  auto lock_ptr = Ptr(new FileLock());
+  // On POSIX, closing any file descriptor for the file drops the lock for the whole process, so
+  // the local lock has to come first, even before touching the file
+  lock_ptr->data_->local_lock = std::unique_lock<std::mutex>(GetLocalMutex(lock_path));
+  {
+    std::ofstream lock_ofs(lock_path, std::ios_base::app);
+    if (!lock_ofs.good()) {
+      return nullptr;
+    }
+  }
+  // Boost only reports errors with exceptions, so keep them from getting out
+  try {
+    bip::file_lock file_lock(lock_path.string().c_str());
+    file_lock.lock();
+    lock_ptr->data_->file_lock.swap(file_lock);
+  }
+  catch (const bip::interprocess_exception&) {
+    return nullptr;
+  }
+  return lock_ptr;
+}
+
+namespace {
+
+std::mutex& GetLocalMutex(const fs::path& lock_path)
+{
+  // Mutexes are never removed, but there's only ever a handful of lock files
+  static std::mutex mutexes_mutex;
+  static std::map<std::string, std::unique_ptr<std::mutex>> mutexes;
+  std::lock_guard<std::mutex> mutexes_lock(mutexes_mutex);
+  std::unique_ptr<std::mutex>& mutex_ptr = mutexes[lock_path.lexically_normal().string()];
+  if (mutex_ptr == nullptr) {
+    mutex_ptr = std::make_unique<std::mutex>();
+  }
+  return *mutex_ptr;
+}
+
+}  // namespace
+
+}  // namespace tl
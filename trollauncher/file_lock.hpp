@@ -0,0 +1,54 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_FILE_LOCK_HPP_
+#define TROLLAUNCHER_FILE_LOCK_HPP_
+
+#include <filesystem>
+#include <memory>
+
+namespace tl {
+
+std::filesystem::path GetLocksPath(const std::filesystem::path& dot_minecraft_path);
+
+/**
+ * An exclusive lock on a file, shared with other processes, so multiple trollaunchers can work on
+ * the same .minecraft without stepping on each other. It's also exclusive between threads of the
+ * same process, which OS file locks usually aren't. The lock is held until this is destroyed.
+ *
+ * Lock files are created as needed and left behind, since removing them would race.
+ */
+class FileLock final {
+ public:
+  using Ptr = std::shared_ptr<FileLock>;
+
+  ~FileLock();
+
+  // Blocks until the lock is acquired
+  static Ptr Acquire(const std::filesystem::path& lock_path);
+
+ private:
+  FileLock();
+
+  struct Data_;
+  std::unique_ptr<Data_> data_;
+};
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_FILE_LOCK_HPP_
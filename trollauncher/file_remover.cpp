@@ -0,0 +1,177 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/file_remover.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+
+#ifndef ITS_A_UNIX_SYSTEM
+#ifndef _WIN32
+#define ITS_A_UNIX_SYSTEM true
+#else
+#define ITS_A_UNIX_SYSTEM false
+#endif
+#endif
+
+#if ITS_A_UNIX_SYSTEM
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+struct RemoveDir {
+  std::string rel_path;
+  int dir_fd;
+};
+
+std::size_t GetPathDepth(const std::string& rel_path);
+
+}  // namespace
+
+struct FileRemover::Data_ {
+  fs::path root_path;
+  std::vector<fs::path> paths;
+  std::vector<std::string> file_names;
+  std::vector<std::size_t> dir_indices;
+  std::vector<RemoveDir> remove_dirs;
+};
+
+FileRemover::FileRemover() : data_(std::make_unique<FileRemover::Data_>())
+{
+  // Do nothing
+}
+
+FileRemover::Ptr FileRemover::Create(const fs::path& root_path, const std::vector<fs::path>& paths)
+{
+  auto fr_ptr = Ptr(new FileRemover());
+  fr_ptr->data_->root_path = root_path;
+  fr_ptr->data_->paths = paths;
+  fr_ptr->data_->file_names.reserve(paths.size());
+  fr_ptr->data_->dir_indices.reserve(paths.size());
+  std::vector<RemoveDir>& remove_dirs = fr_ptr->data_->remove_dirs;
+  std::map<std::string, std::size_t> dir_index_map;
+  for (std::size_t ii = 0; ii < paths.size(); ++ii) {
+    const std::string rel_dir_path = paths.at(ii).parent_path().generic_string();
+    const auto [dir_index_iter, is_new] = dir_index_map.emplace(rel_dir_path, remove_dirs.size());
+    if (is_new) {
+      remove_dirs.push_back(RemoveDir{rel_dir_path, -1});
+    }
+    fr_ptr->data_->file_names.push_back(paths.at(ii).filename().string());
+    fr_ptr->data_->dir_indices.push_back(dir_index_iter->second);
+  }
+#if ITS_A_UNIX_SYSTEM
+  const int root_fd = open(root_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd >= 0) {
+    for (RemoveDir& remove_dir : remove_dirs) {
+      remove_dir.dir_fd =
+          (remove_dir.rel_path.empty() ? dup(root_fd)
+                                       : openat(root_fd, remove_dir.rel_path.c_str(),
+                                                O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    }
+    close(root_fd);
+  }
+#endif
+  return fr_ptr;
+}
+
+FileRemover::~FileRemover()
+{
+#if ITS_A_UNIX_SYSTEM
+  for (const RemoveDir& remove_dir : data_->remove_dirs) {
+    if (remove_dir.dir_fd >= 0) {
+      close(remove_dir.dir_fd);
+    }
+  }
+#endif
+}
+
+const std::vector<fs::path>& FileRemover::GetPaths() const
+{
+  return data_->paths;
+}
+
+bool FileRemover::Remove(std::size_t path_index)
+{
+#if ITS_A_UNIX_SYSTEM
+  const RemoveDir& remove_dir = data_->remove_dirs.at(data_->dir_indices.at(path_index));
+  if (remove_dir.dir_fd >= 0) {
+    return unlinkat(remove_dir.dir_fd, data_->file_names.at(path_index).c_str(), 0) == 0;
+  }
+#endif
+  std::error_code fs_ec;
+  return fs::remove(data_->root_path / data_->paths.at(path_index), fs_ec);
+}
+
+void FileRemover::RemoveEmptyDirectories()
+{
+  RemoveEmptyParentDirectories(data_->root_path, data_->paths);
+}
+
+void RemoveEmptyParentDirectories(const fs::path& root_path, const std::vector<fs::path>& paths)
+{
+  // Every ancestor is a candidate, since removing a directory can leave its parent empty
+  std::set<std::string> rel_dir_paths;
+  for (const fs::path& path : paths) {
+    for (fs::path dir_path = path.parent_path(); !dir_path.empty();
+         dir_path = dir_path.parent_path()) {
+      if (!rel_dir_paths.insert(dir_path.generic_string()).second) {
+        break;
+      }
+    }
+  }
+  std::vector<std::string> sorted_dir_paths(rel_dir_paths.begin(), rel_dir_paths.end());
+  std::stable_sort(sorted_dir_paths.begin(), sorted_dir_paths.end(),
+                   [](const std::string& lhs, const std::string& rhs) {
+                     return GetPathDepth(lhs) > GetPathDepth(rhs);
+                   });
+#if ITS_A_UNIX_SYSTEM
+  const int root_fd = open(root_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0) {
+    return;
+  }
+  for (const std::string& rel_dir_path : sorted_dir_paths) {
+    // This just fails for directories that aren't empty, which is exactly what we want
+    unlinkat(root_fd, rel_dir_path.c_str(), AT_REMOVEDIR);
+  }
+  close(root_fd);
+#else
+  for (const std::string& rel_dir_path : sorted_dir_paths) {
+    std::error_code fs_ec;
+    fs::remove(root_path / rel_dir_path, fs_ec);
+  }
+#endif
+}
+
+namespace {
+
+std::size_t GetPathDepth(const std::string& rel_path)
+{
+  return std::count(rel_path.begin(), rel_path.end(), '/');
+}
+
+}  // namespace
+
+}  // namespace tl
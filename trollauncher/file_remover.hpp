@@ -0,0 +1,65 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_FILE_REMOVER_HPP_
+#define TROLLAUNCHER_FILE_REMOVER_HPP_
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace tl {
+
+/**
+ * Removes files with paths relative to the root directory. Every directory is opened once up front,
+ * so removing a file is just an unlinkat, without walking the whole path again. Removing files is
+ * safe from any thread, so files can be removed as soon as they're ready (e.g., backed up).
+ */
+class FileRemover final {
+ public:
+  using Ptr = std::shared_ptr<FileRemover>;
+
+  static Ptr Create(const std::filesystem::path& root_path,
+                    const std::vector<std::filesystem::path>& paths);
+  ~FileRemover();
+
+  const std::vector<std::filesystem::path>& GetPaths() const;
+  // This is safe to call from any thread
+  bool Remove(std::size_t path_index);
+  // Remove directories left empty, from the bottom up
+  void RemoveEmptyDirectories();
+
+ private:
+  FileRemover();
+
+  struct Data_;
+  std::unique_ptr<Data_> data_;
+};
+
+/**
+ * Remove the parent directories of the paths that are empty, from the bottom up, but never the
+ * root directory itself. This is for cleaning up after files were removed (or moved) some other
+ * way.
+ */
+void RemoveEmptyParentDirectories(const std::filesystem::path& root_path,
+                                  const std::vector<std::filesystem::path>& paths);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_FILE_REMOVER_HPP_
@@ -18,10 +18,19 @@
 
 #include "trollauncher/forge_installer.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
 
-#include <libzippp.h>
 #include <nlohmann/json.hpp>
 
 // Work around for Boost on MSYS2
@@ -34,7 +43,11 @@
 #include <boost/process.hpp>
 
 #include "trollauncher/error_codes.hpp"
+#include "trollauncher/hashing.hpp"
 #include "trollauncher/java_detector.hpp"
+#include "trollauncher/utils.hpp"
+#include "trollauncher/worker_pool.hpp"
+#include "trollauncher/zip_utils.hpp"
 
 namespace tl {
 
@@ -43,21 +56,101 @@ namespace {
 namespace bp = boost::process;
 namespace fs = std::filesystem;
 namespace nl = nlohmann;
-namespace zpp = libzippp;
+
+constexpr int FORGE_CACHE_VERSION = 2;
+const std::string FORGE_CACHE_TEMP_INFIX = ".tmp-";
+// Anything this old in the cache that's still a temp file was left by a crash
+constexpr auto STALE_CACHE_TEMP_AGE = std::chrono::hours(24);
+// Even a slow connection should manage the libraries in this time
+constexpr auto DEFAULT_INSTALL_TIMEOUT = std::chrono::minutes(15);
+const std::string FORGE_JVM_ARGS_VAR = "TROLLAUNCHER_FORGE_JVM_ARGS";
+const std::string HEADLESS_JVM_ARG_PREFIX = "-Djava.awt.headless";
+const std::string SIMPLE_INSTALLER_CLASS_PATH =
+    "net/minecraftforge/installer/SimpleInstaller.class";
+
+struct LibraryCheck {
+  fs::path path;
+  std::optional<std::uint64_t> size_opt;
+  std::string sha1;
+};
+
+/**
+ * Things the installer prints along the way, in order. Some are printed once per library or
+ * processor, so those creep forward a percent at a time, up to the max.
+ */
+struct ForgeMilestone {
+  std::string text;
+  std::size_t percent;
+  std::size_t max_percent;
+};
+
+static const std::vector<ForgeMilestone> forge_milestones = {
+    {"Extracting json", 5, 5},
+    {"Considering minecraft client jar", 10, 10},
+    {"Downloading libraries", 20, 20},
+    {"Considering library", 20, 55},
+    {"Building Processors", 60, 60},
+    {"Task: ", 60, 90},
+    {"Injecting profile", 95, 95},
+    {"installed successfully", 100, 100},
+    {"Successfully installed", 100, 100},
+};
+
+std::string GetCacheKey(std::uint32_t crc, std::uint64_t size);
+bool SupportsHeadlessInstall(std::string_view installer_data,
+                             const std::vector<ZipCentralEntry>& central_entries);
+bool RunInstaller(const fs::path& java_path, const std::vector<std::string>& java_args,
+                  std::chrono::seconds timeout, const ForgeProgressFunc& progress_func,
+                  ForgeInstallStats* install_stats_ptr);
+std::size_t GetMilestonePercent(const std::string& line, std::size_t percent);
+bool WriteFile(const fs::path& path, const std::string& data);
+bool WriteFileAtomically(const fs::path& path, const std::string& data);
+bool LinkOrCopyFile(const fs::path& src_path, const fs::path& dest_path);
+void RemoveStaleCacheTemps(const fs::path& cache_path);
+void RemoveTempDir(const fs::path& temp_path);
 
 }  // namespace
 
+ForgeInstallOptions GetDefaultForgeInstallOptions()
+{
+  ForgeInstallOptions install_options;
+  install_options.jvm_args = {"-Xshare:auto", "-XX:TieredStopAtLevel=1",
+                              HEADLESS_JVM_ARG_PREFIX + "=true"};
+  install_options.timeout = DEFAULT_INSTALL_TIMEOUT;
+  const std::optional<std::string> jvm_args_str_opt = GetEnvironmentVar(FORGE_JVM_ARGS_VAR);
+  if (jvm_args_str_opt) {
+    install_options.jvm_args.clear();
+    std::istringstream jvm_args_iss(jvm_args_str_opt.value());
+    std::string jvm_arg;
+    while (jvm_args_iss >> jvm_arg) {
+      install_options.jvm_args.push_back(jvm_arg);
+    }
+  }
+  return install_options;
+}
+
+fs::path GetForgeCachePath(const fs::path& dot_minecraft_path)
+{
+  return dot_minecraft_path / "trollauncher" / "cache" / "forge";
+}
+
 struct ForgeInstaller::Data_ {
-  fs::path installer_path;
+  std::string installer_data;
+  std::optional<fs::path> cached_installer_path_opt;
+  std::uint32_t cached_installer_crc;
   fs::path dot_minecraft_path;
   std::string forge_version;
   std::string minecraft_version;
-  std::unique_ptr<zpp::ZipArchive> zip_ptr;
+  bool supports_headless;
+  ForgeInstallOptions install_options;
+  std::optional<ForgeInstallStats> install_stats_opt;
 };
 
 ForgeInstaller::ForgeInstaller() : data_(std::make_unique<ForgeInstaller::Data_>())
 {
-  // Do nothing
+  data_->cached_installer_crc = 0;
+  data_->supports_headless = false;
+  data_->install_options = GetDefaultForgeInstallOptions();
 }
 
 ForgeInstaller::Ptr ForgeInstaller::Create(const fs::path& installer_path,
@@ -72,23 +165,43 @@ ForgeInstaller::Ptr ForgeInstaller::Create(const fs::path& installer_path,
     SetError(ec, Error::FORGE_INSTALLER_NOT_REGULAR_FILE);
     return nullptr;
   }
-  auto zip_ptr = std::make_unique<zpp::ZipArchive>(installer_path.string());
-  if (!zip_ptr->open(zpp::ZipArchive::READ_ONLY)) {
+  std::ifstream installer_ifs(installer_path, std::ios_base::binary);
+  std::stringstream installer_ss;
+  installer_ss << installer_ifs.rdbuf();
+  if (!installer_ifs.good() || !installer_ss.good()) {
+    SetError(ec, Error::FORGE_INSTALLER_JAR_OPEN_FAILED);
+    return nullptr;
+  }
+  return CreateFromData(installer_ss.str(), dot_minecraft_path, ec);
+}
+
+ForgeInstaller::Ptr ForgeInstaller::CreateFromData(std::string installer_data,
+                                                   const fs::path& dot_minecraft_path,
+                                                   std::error_code* ec)
+{
+  // Only the central directory and the one entry are looked at, nothing touches the disk
+  const std::optional<std::vector<ZipCentralEntry>> central_entries_opt =
+      ReadBufferZipCentralDirectory(installer_data);
+  if (!central_entries_opt) {
     SetError(ec, Error::FORGE_INSTALLER_JAR_OPEN_FAILED);
     return nullptr;
   }
-  zpp::ZipEntry install_prof_entry = zip_ptr->getEntry("install_profile.json", true);
-  if (install_prof_entry.isNull()) {
+  const auto install_prof_entry_iter = std::find_if(
+      central_entries_opt.value().begin(), central_entries_opt.value().end(),
+      [](const ZipCentralEntry& central_entry) {
+        return central_entry.name == "install_profile.json";
+      });
+  if (install_prof_entry_iter == central_entries_opt.value().end()) {
     SetError(ec, Error::FORGE_INSTALLER_NO_INSTALL_PROFILE_JSON);
     return nullptr;
   }
-  std::stringstream install_prof_ss;
-  const int zip_error_code = zip_ptr->readEntry(install_prof_entry, install_prof_ss);
-  if (zip_error_code != LIBZIPPP_OK) {
+  const std::optional<std::string> install_prof_str_opt =
+      ReadBufferZipEntry(installer_data, *install_prof_entry_iter);
+  if (!install_prof_str_opt) {
     SetError(ec, Error::FORGE_INSTALLER_INSTALL_PROFILE_JSON_READ_FAILED);
     return nullptr;
   }
-  const nl::json install_prof_json = nl::json::parse(install_prof_ss.str(), nullptr, false);
+  const nl::json install_prof_json = nl::json::parse(install_prof_str_opt.value(), nullptr, false);
   if (install_prof_json.is_discarded()) {
     SetError(ec, Error::FORGE_INSTALLER_INSTALL_PROFILE_JSON_PARSE_FAILED);
     return nullptr;
@@ -105,12 +218,58 @@ ForgeInstaller::Ptr ForgeInstaller::Create(const fs::path& installer_path,
     SetError(ec, Error::FORGE_INSTALLER_BAD_INSTALL_PROFILE_JSON);
     return nullptr;
   }
+  const bool supports_headless =
+      SupportsHeadlessInstall(installer_data, central_entries_opt.value());
+  auto fi_ptr = Ptr(new ForgeInstaller());
+  fi_ptr->data_->installer_data = std::move(installer_data);
+  fi_ptr->data_->dot_minecraft_path = dot_minecraft_path;
+  fi_ptr->data_->forge_version = forge_version;
+  fi_ptr->data_->minecraft_version = minecraft_version;
+  fi_ptr->data_->supports_headless = supports_headless;
+  return fi_ptr;
+}
+
+ForgeInstaller::Ptr ForgeInstaller::CreateFromCache(const fs::path& cache_path, std::uint32_t crc,
+                                                    std::uint64_t size,
+                                                    const fs::path& dot_minecraft_path)
+{
+  const std::string cache_key = GetCacheKey(crc, size);
+  const fs::path cached_installer_path = cache_path / (cache_key + ".jar");
+  // The info is written after the jar, so if it exists the jar should be complete
+  std::ifstream info_ifs(cache_path / (cache_key + ".json"));
+  if (!info_ifs.good()) {
+    return nullptr;
+  }
+  // Anything that looks off is just a miss, and the entry gets written again
+  const nl::json info_json = nl::json::parse(info_ifs, nullptr, false);
+  if (info_json.is_discarded() || !info_json.is_object()) {
+    return nullptr;
+  }
+  const nl::json version_json = info_json.value("version", nl::json(nullptr));
+  const nl::json forge_version_json = info_json.value("forge_version", nl::json(nullptr));
+  const nl::json minecraft_version_json = info_json.value("minecraft_version", nl::json(nullptr));
+  const nl::json headless_json = info_json.value("headless", nl::json(nullptr));
+  if (!version_json.is_number_integer() || version_json.get<std::int64_t>() != FORGE_CACHE_VERSION
+      || !forge_version_json.is_string() || !minecraft_version_json.is_string()
+      || !headless_json.is_boolean()) {
+    return nullptr;
+  }
+  const std::string forge_version = forge_version_json.get<std::string>();
+  const std::string minecraft_version = minecraft_version_json.get<std::string>();
+  if (forge_version.empty() || minecraft_version.empty()) {
+    return nullptr;
+  }
+  std::error_code fs_ec;
+  if (fs::file_size(cached_installer_path, fs_ec) != size || fs_ec) {
+    return nullptr;
+  }
   auto fi_ptr = Ptr(new ForgeInstaller());
-  fi_ptr->data_->installer_path = installer_path;
+  fi_ptr->data_->cached_installer_path_opt = cached_installer_path;
+  fi_ptr->data_->cached_installer_crc = crc;
   fi_ptr->data_->dot_minecraft_path = dot_minecraft_path;
   fi_ptr->data_->forge_version = forge_version;
   fi_ptr->data_->minecraft_version = minecraft_version;
-  fi_ptr->data_->zip_ptr = std::move(zip_ptr);
+  fi_ptr->data_->supports_headless = headless_json.get<bool>();
   return fi_ptr;
 }
 
@@ -134,25 +293,157 @@ bool ForgeInstaller::IsInstalled() const
   return fs::exists(installed_version_path);
 }
 
-bool ForgeInstaller::Install(std::error_code* ec)
+std::optional<ForgeVerifyStats> ForgeInstaller::VerifyInstall(std::size_t num_jobs) const
+{
+  const auto start_time = std::chrono::steady_clock::now();
+  const fs::path installed_version_path = data_->dot_minecraft_path / "versions"
+                                          / data_->forge_version / (data_->forge_version + ".json");
+  std::ifstream version_ifs(installed_version_path);
+  if (!version_ifs.good()) {
+    return std::nullopt;
+  }
+  const nl::json version_json = nl::json::parse(version_ifs, nullptr, false);
+  if (version_json.is_discarded() || !version_json.is_object()) {
+    return std::nullopt;
+  }
+  const nl::json libraries_json = version_json.value("libraries", nl::json::array());
+  if (!libraries_json.is_array()) {
+    return std::nullopt;
+  }
+  // E.g., "downloads": {"artifact": {"path": "...", "sha1": "...", "size": 123, "url": "..."}}
+  const fs::path libraries_path = data_->dot_minecraft_path / "libraries";
+  std::vector<LibraryCheck> library_checks;
+  for (const nl::json& library_json : libraries_json) {
+    if (!library_json.is_object()) {
+      continue;
+    }
+    const nl::json downloads_json = library_json.value("downloads", nl::json::object());
+    const nl::json artifact_json =
+        (downloads_json.is_object() ? downloads_json.value("artifact", nl::json(nullptr))
+                                    : nl::json(nullptr));
+    if (!artifact_json.is_object() || !artifact_json.value("path", nl::json(nullptr)).is_string()) {
+      continue;
+    }
+    const std::string path_str = artifact_json.value("path", "");
+    if (path_str.empty()) {
+      continue;
+    }
+    LibraryCheck library_check;
+    library_check.path = libraries_path / path_str;
+    const nl::json size_json = artifact_json.value("size", nl::json(nullptr));
+    if (size_json.is_number_unsigned()) {
+      library_check.size_opt = size_json.get<std::uint64_t>();
+    }
+    const nl::json sha1_json = artifact_json.value("sha1", nl::json(nullptr));
+    if (sha1_json.is_string()) {
+      library_check.sha1 = sha1_json.get<std::string>();
+      std::transform(library_check.sha1.begin(), library_check.sha1.end(),
+                     library_check.sha1.begin(),
+                     [](unsigned char cc) { return static_cast<char>(std::tolower(cc)); });
+    }
+    library_checks.push_back(std::move(library_check));
+  }
+  // Biggest first, so one big jar doesn't end up last on a single thread
+  std::sort(library_checks.begin(), library_checks.end(),
+            [](const LibraryCheck& aa, const LibraryCheck& bb) {
+              return aa.size_opt.value_or(0) > bb.size_opt.value_or(0);
+            });
+  std::vector<char> is_bads(library_checks.size(), false);
+  std::atomic<std::uint64_t> num_bytes(0);
+  ParallelForEach(num_jobs, library_checks.size(), [&](std::size_t, std::size_t check_index) {
+    const LibraryCheck& library_check = library_checks.at(check_index);
+    std::error_code fs_ec;
+    const std::uint64_t size = fs::file_size(library_check.path, fs_ec);
+    if (fs_ec || (library_check.size_opt && library_check.size_opt.value() != size)) {
+      is_bads.at(check_index) = true;
+      return true;
+    }
+    num_bytes += size;
+    if (!library_check.sha1.empty()) {
+      const std::optional<std::string> sha1_opt = GetFileSha1(library_check.path);
+      is_bads.at(check_index) = (sha1_opt.value_or("") != library_check.sha1);
+    }
+    return true;
+  });
+  ForgeVerifyStats verify_stats;
+  verify_stats.num_libraries = libraries_json.size();
+  verify_stats.num_checked_libraries = library_checks.size();
+  for (std::size_t ii = 0; ii < library_checks.size(); ++ii) {
+    if (is_bads.at(ii)) {
+      verify_stats.bad_library_paths.push_back(library_checks.at(ii).path);
+    }
+  }
+  verify_stats.num_bytes = num_bytes;
+  verify_stats.elapsed = std::chrono::steady_clock::now() - start_time;
+  return verify_stats;
+}
+
+void ForgeInstaller::SetInstallOptions(const ForgeInstallOptions& install_options)
+{
+  data_->install_options = install_options;
+}
+
+bool ForgeInstaller::Install(std::error_code* ec, const ForgeProgressFunc& progress_func)
 {
   const std::optional<fs::path> java_path_opt = JavaDetector::GetAnyJava();
   if (!java_path_opt) {
     SetError(ec, Error::FORGE_INSTALLER_NO_JAVA);
     return false;
   }
-  std::error_code java_ec;
-  const int return_code = bp::system(                       //
-      bp::exe = java_path_opt.value().string(),             //
-      bp::args = {"-jar", data_->installer_path.string()},  //
-      (bp::std_out & bp::std_err) > bp::null,               //
-      bp::error = java_ec                                   //
-  );
-  if (java_ec) {
+  // The installer leaves a log next to the jar, so it always runs from its own temp directory
+  const std::optional<fs::path> temp_path_opt = CreateTempDir();
+  if (!temp_path_opt) {
+    SetError(ec, Error::FORGE_INSTALLER_TEMP_JAR_FAILED);
+    return false;
+  }
+  const fs::path installer_path = temp_path_opt.value() / "installer.jar";
+  const bool installer_ok =
+      (data_->cached_installer_path_opt
+           ? LinkOrCopyFile(data_->cached_installer_path_opt.value(), installer_path)
+           : WriteFile(installer_path, data_->installer_data));
+  if (!installer_ok) {
+    RemoveTempDir(temp_path_opt.value());
+    SetError(ec, Error::FORGE_INSTALLER_TEMP_JAR_FAILED);
+    return false;
+  }
+  // The cache only checked the size, so make sure the jar that's about to run is the right one
+  if (data_->cached_installer_path_opt
+      && GetFileCrc32(installer_path) != std::optional(data_->cached_installer_crc)) {
+    RemoveTempDir(temp_path_opt.value());
+    // Info first, since that's what makes the entry count as complete
+    std::error_code fs_ec;
+    fs::remove(fs::path(data_->cached_installer_path_opt.value()).replace_extension(".json"),
+               fs_ec);
+    fs::remove(data_->cached_installer_path_opt.value(), fs_ec);
+    SetError(ec, Error::FORGE_INSTALLER_CACHE_CORRUPT);
+    return false;
+  }
+  // Newer installers can install straight into the right .minecraft without a GUI, but older
+  // ones only have the GUI, which won't even open if the JVM is headless
+  std::vector<std::string> java_args;
+  for (const std::string& jvm_arg : data_->install_options.jvm_args) {
+    if (data_->supports_headless || jvm_arg.rfind(HEADLESS_JVM_ARG_PREFIX, 0) != 0) {
+      java_args.push_back(jvm_arg);
+    }
+  }
+  java_args.insert(java_args.end(), {"-jar", installer_path.string()});
+  if (data_->supports_headless) {
+    java_args.insert(java_args.end(), {"--installClient", data_->dot_minecraft_path.string()});
+  }
+  ForgeInstallStats install_stats;
+  const bool is_run = RunInstaller(java_path_opt.value(), java_args,
+                                   data_->install_options.timeout, progress_func, &install_stats);
+  RemoveTempDir(temp_path_opt.value());
+  if (!is_run) {
     SetError(ec, Error::FORGE_INSTALLER_EXECUTE_FAILED);
     return false;
   }
-  if (return_code != 0) {
+  data_->install_stats_opt = install_stats;
+  if (install_stats.timed_out) {
+    SetError(ec, Error::FORGE_INSTALLER_TIMED_OUT);
+    return false;
+  }
+  if (install_stats.exit_code_opt.value_or(-1) != 0) {
     SetError(ec, Error::FORGE_INSTALLER_INSTALL_FAILED);
     return false;
   }
@@ -164,4 +455,205 @@ bool ForgeInstaller::Install(std::error_code* ec)
   return true;
 }
 
+std::optional<ForgeInstallStats> ForgeInstaller::GetInstallStats() const
+{
+  return data_->install_stats_opt;
+}
+
+bool ForgeInstaller::AddToCache(const fs::path& cache_path)
+{
+  if (data_->cached_installer_path_opt) {
+    return true;
+  }
+  std::error_code fs_ec;
+  fs::create_directories(cache_path, fs_ec);
+  if (fs_ec) {
+    return false;
+  }
+  RemoveStaleCacheTemps(cache_path);
+  const std::uint32_t crc =
+      Crc32Update(0, data_->installer_data.data(), data_->installer_data.size());
+  const std::string cache_key = GetCacheKey(crc, data_->installer_data.size());
+  const fs::path cached_installer_path = cache_path / (cache_key + ".jar");
+  const nl::json info_json = {
+      {"version", FORGE_CACHE_VERSION},
+      {"forge_version", data_->forge_version},
+      {"minecraft_version", data_->minecraft_version},
+      {"headless", data_->supports_headless},
+  };
+  if (!WriteFileAtomically(cached_installer_path, data_->installer_data)
+      || !WriteFileAtomically(cache_path / (cache_key + ".json"), info_json.dump(2))) {
+    return false;
+  }
+  // No need to hold on to the jar anymore
+  data_->cached_installer_path_opt = cached_installer_path;
+  data_->installer_data = std::string();
+  return true;
+}
+
+namespace {
+
+std::string GetCacheKey(std::uint32_t crc, std::uint64_t size)
+{
+  // Same style as the pack hash, E.g., "1a2b3c4d-5308012"
+  char cache_key_buf[32];
+  std::snprintf(cache_key_buf, sizeof(cache_key_buf), "%08x-%llu", static_cast<unsigned int>(crc),
+                static_cast<unsigned long long>(size));
+  return cache_key_buf;
+}
+
+bool SupportsHeadlessInstall(std::string_view installer_data,
+                             const std::vector<ZipCentralEntry>& central_entries)
+{
+  // The "--installClient" option showed up in later installers, and the option name is right
+  // there in the class file, so there's no need to guess from the Forge version
+  const auto class_entry_iter =
+      std::find_if(central_entries.begin(), central_entries.end(),
+                   [](const ZipCentralEntry& central_entry) {
+                     return central_entry.name == SIMPLE_INSTALLER_CLASS_PATH;
+                   });
+  if (class_entry_iter == central_entries.end()) {
+    return false;
+  }
+  const std::optional<std::string> class_data_opt =
+      ReadBufferZipEntry(installer_data, *class_entry_iter);
+  return class_data_opt && class_data_opt.value().find("installClient") != std::string::npos;
+}
+
+bool RunInstaller(const fs::path& java_path, const std::vector<std::string>& java_args,
+                  std::chrono::seconds timeout, const ForgeProgressFunc& progress_func,
+                  ForgeInstallStats* install_stats_ptr)
+{
+  const auto start_time = std::chrono::steady_clock::now();
+  // The installer gets its own group, so a timeout also kills anything it started
+  bp::ipstream output_ips;
+  bp::group installer_group;
+  std::error_code java_ec;
+  bp::child installer_child(                     //
+      bp::exe = java_path.string(),              //
+      bp::args = java_args,                      //
+      (bp::std_out & bp::std_err) > output_ips,  //
+      installer_group,                           //
+      bp::error = java_ec                        //
+  );
+  if (java_ec) {
+    return false;
+  }
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  bool is_done = false;
+  std::atomic<bool> timed_out(false);
+  std::thread watchdog_thread([&]() {
+    std::unique_lock<std::mutex> done_lock(done_mutex);
+    if (!done_cv.wait_for(done_lock, timeout, [&is_done]() { return is_done; })) {
+      timed_out = true;
+      std::error_code kill_ec;
+      installer_group.terminate(kill_ec);
+    }
+  });
+  // The output ends when the installer exits, or gets killed
+  std::size_t percent = 0;
+  std::size_t num_output_lines = 0;
+  std::string line;
+  while (std::getline(output_ips, line)) {
+    ++num_output_lines;
+    const std::size_t new_percent = GetMilestonePercent(line, percent);
+    if (new_percent != percent && progress_func) {
+      progress_func(new_percent);
+    }
+    percent = new_percent;
+  }
+  std::error_code wait_ec;
+  installer_child.wait(wait_ec);
+  {
+    std::lock_guard<std::mutex> done_lock(done_mutex);
+    is_done = true;
+  }
+  done_cv.notify_all();
+  watchdog_thread.join();
+  install_stats_ptr->elapsed = std::chrono::steady_clock::now() - start_time;
+  install_stats_ptr->exit_code_opt = std::nullopt;
+  install_stats_ptr->timed_out = timed_out;
+  install_stats_ptr->num_output_lines = num_output_lines;
+  if (!wait_ec && !timed_out) {
+    install_stats_ptr->exit_code_opt = installer_child.exit_code();
+  }
+  return true;
+}
+
+std::size_t GetMilestonePercent(const std::string& line, std::size_t percent)
+{
+  for (const ForgeMilestone& milestone : forge_milestones) {
+    if (line.find(milestone.text) != std::string::npos) {
+      const std::size_t new_percent =
+          std::clamp(percent + 1, milestone.percent, milestone.max_percent);
+      return std::max(percent, new_percent);
+    }
+  }
+  return percent;
+}
+
+bool WriteFile(const fs::path& path, const std::string& data)
+{
+  std::ofstream ofs(path, std::ios_base::binary);
+  ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+  ofs.close();
+  return ofs.good();
+}
+
+bool WriteFileAtomically(const fs::path& path, const std::string& data)
+{
+  // Other launchers might be filling the cache at the same time, but they'd write the same thing
+  std::error_code fs_ec;
+  const fs::path temp_path = path.string() + FORGE_CACHE_TEMP_INFIX + GetRandomId();
+  if (!WriteFile(temp_path, data)) {
+    fs::remove(temp_path, fs_ec);
+    return false;
+  }
+  fs::rename(temp_path, path, fs_ec);
+  if (fs_ec) {
+    fs::remove(temp_path, fs_ec);
+    return false;
+  }
+  return true;
+}
+
+bool LinkOrCopyFile(const fs::path& src_path, const fs::path& dest_path)
+{
+  std::error_code fs_ec;
+  fs::create_hard_link(src_path, dest_path, fs_ec);
+  if (!fs_ec) {
+    return true;
+  }
+  fs::copy_file(src_path, dest_path, fs_ec);
+  return !fs_ec;
+}
+
+void RemoveStaleCacheTemps(const fs::path& cache_path)
+{
+  std::error_code fs_ec;
+  const auto stale_time = fs::file_time_type::clock::now() - STALE_CACHE_TEMP_AGE;
+  for (fs::directory_iterator cache_iter(cache_path, fs_ec), end_iter;
+       !fs_ec && cache_iter != end_iter; cache_iter.increment(fs_ec)) {
+    const fs::path& temp_path = cache_iter->path();
+    if (temp_path.filename().string().find(FORGE_CACHE_TEMP_INFIX) == std::string::npos) {
+      continue;
+    }
+    std::error_code temp_ec;
+    const fs::file_time_type write_time = fs::last_write_time(temp_path, temp_ec);
+    if (!temp_ec && write_time < stale_time) {
+      fs::remove(temp_path, temp_ec);
+    }
+  }
+}
+
+void RemoveTempDir(const fs::path& temp_path)
+{
+  // Leaving junk in the temp directory isn't worth failing over
+  std::error_code fs_ec;
+  fs::remove_all(temp_path, fs_ec);
+}
+
+}  // namespace
+
 }  // namespace tl
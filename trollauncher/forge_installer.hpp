@@ -19,13 +19,50 @@
 #ifndef TROLLAUNCHER_FORGE_INSTALLER_HPP_
 #define TROLLAUNCHER_FORGE_INSTALLER_HPP_
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <string>
 #include <system_error>
+#include <vector>
 
 namespace tl {
 
+using ForgeProgressFunc = std::function<void(std::size_t)>;
+
+/**
+ * The default JVM arguments are tuned for a short-lived process, since the installer is mostly
+ * I/O and never runs long enough to benefit from the optimizing JIT. They can be overridden with
+ * the "TROLLAUNCHER_FORGE_JVM_ARGS" environment variable (split on whitespace).
+ *
+ * The installer is killed, along with anything it started, if it runs longer than the timeout.
+ */
+struct ForgeInstallOptions {
+  std::vector<std::string> jvm_args;
+  std::chrono::seconds timeout;
+};
+
+struct ForgeInstallStats {
+  std::chrono::steady_clock::duration elapsed;
+  std::optional<int> exit_code_opt;
+  bool timed_out;
+  std::size_t num_output_lines;
+};
+
+struct ForgeVerifyStats {
+  std::size_t num_libraries;
+  std::size_t num_checked_libraries;
+  std::vector<std::filesystem::path> bad_library_paths;
+  std::uint64_t num_bytes;
+  std::chrono::steady_clock::duration elapsed;
+};
+
+ForgeInstallOptions GetDefaultForgeInstallOptions();
+std::filesystem::path GetForgeCachePath(const std::filesystem::path& dot_minecraft_path);
+
 class ForgeInstaller final {
  public:
   using Ptr = std::shared_ptr<ForgeInstaller>;
@@ -33,12 +70,34 @@ class ForgeInstaller final {
   static Ptr Create(const std::filesystem::path& installer_path,
                     const std::filesystem::path& dot_minecraft_path, std::error_code* ec);
 
+  // The jar is kept in memory, and only written to disk if it actually needs to be run
+  static Ptr CreateFromData(std::string installer_data,
+                            const std::filesystem::path& dot_minecraft_path, std::error_code* ec);
+
+  // Cached installers are keyed by the CRC and size of the jar, which the modpack index already
+  // knows, so a hit doesn't read anything out of the modpack. Returns null on a miss.
+  static Ptr CreateFromCache(const std::filesystem::path& cache_path, std::uint32_t crc,
+                             std::uint64_t size, const std::filesystem::path& dot_minecraft_path);
+
   std::string GetForgeVersion() const;
   std::string GetMinecraftVersion() const;
 
   bool IsInstalled() const;
+  // Checks every library the version JSON lists a download for, by size and SHA-1, in parallel.
+  // Libraries are bad if they're missing or don't match. Inherited versions aren't checked, since
+  // those are up to the launcher. Returns nothing if the version JSON itself is missing or broken.
+  std::optional<ForgeVerifyStats> VerifyInstall(std::size_t num_jobs) const;
+
+  void SetInstallOptions(const ForgeInstallOptions& install_options);
+
+  // The progress function is called from the thread running the install, based on what the
+  // installer prints. Older installers can only run with their GUI, so they don't report much.
+  bool Install(std::error_code* ec, const ForgeProgressFunc& progress_func = nullptr);
+  // Only set after an install actually ran the installer
+  std::optional<ForgeInstallStats> GetInstallStats() const;
 
-  bool Install(std::error_code* ec);
+  // Saves an installer created from data, after which it's run from the cache instead
+  bool AddToCache(const std::filesystem::path& cache_path);
 
  private:
   ForgeInstaller();
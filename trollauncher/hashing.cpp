@@ -0,0 +1,312 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/hashing.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// SHA-NI needs GCC (or Clang) style target attributes, so everything else gets the plain version
+#ifndef CAN_USE_SHA_NI
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CAN_USE_SHA_NI true
+#else
+#define CAN_USE_SHA_NI false
+#endif
+#endif
+
+#if CAN_USE_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include <zlib.h>
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr std::size_t FILE_BUFFER_SIZE = 1 << 16;
+
+std::uint32_t RotateLeft(std::uint32_t value, int bits);
+std::uint32_t LoadBe32(const unsigned char* bytes);
+#if CAN_USE_SHA_NI
+bool HasShaNi();
+void Sha1BlocksShaNi(std::uint32_t* state, const unsigned char* blocks, std::size_t num_blocks);
+#endif
+
+}  // namespace
+
+std::uint32_t Crc32Update(std::uint32_t crc, const void* data, std::size_t size)
+{
+  // Zlib is already around for the zips, and its CRC is plenty fast. It only takes 32-bit sizes.
+  const auto* bytes = static_cast<const Bytef*>(data);
+  while (size > 0) {
+    const uInt chunk_size = static_cast<uInt>(std::min<std::size_t>(size, 1 << 30));
+    crc = static_cast<std::uint32_t>(crc32(crc, bytes, chunk_size));
+    bytes += chunk_size;
+    size -= chunk_size;
+  }
+  return crc;
+}
+
+std::optional<std::uint32_t> GetFileCrc32(const fs::path& path)
+{
+  std::ifstream file_ifs(path, std::ios_base::binary);
+  if (!file_ifs.good()) {
+    return std::nullopt;
+  }
+  std::vector<char> buffer(FILE_BUFFER_SIZE);
+  std::uint32_t crc = 0;
+  while (file_ifs.good()) {
+    file_ifs.read(buffer.data(), buffer.size());
+    crc = Crc32Update(crc, buffer.data(), static_cast<std::size_t>(file_ifs.gcount()));
+  }
+  if (file_ifs.bad()) {
+    return std::nullopt;
+  }
+  return crc;
+}
+
+Sha1Hasher::Sha1Hasher()
+    : state_{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0},
+      buffer_{},
+      buffer_size_(0),
+      num_bytes_(0)
+{
+  // Do nothing
+}
+
+void Sha1Hasher::Update(const void* data, std::size_t size)
+{
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  num_bytes_ += size;
+  if (buffer_size_ > 0) {
+    const std::size_t num_copy = std::min(size, buffer_.size() - buffer_size_);
+    std::memcpy(buffer_.data() + buffer_size_, bytes, num_copy);
+    buffer_size_ += num_copy;
+    bytes += num_copy;
+    size -= num_copy;
+    if (buffer_size_ < buffer_.size()) {
+      return;
+    }
+    ProcessBlocks(buffer_.data(), 1);
+    buffer_size_ = 0;
+  }
+  // Whole blocks can be processed straight from the input
+  const std::size_t num_blocks = size / buffer_.size();
+  ProcessBlocks(bytes, num_blocks);
+  bytes += num_blocks * buffer_.size();
+  size -= num_blocks * buffer_.size();
+  std::memcpy(buffer_.data(), bytes, size);
+  buffer_size_ = size;
+}
+
+std::string Sha1Hasher::FinishHex()
+{
+  // Pad with a 1 bit, then zeros up to the last 8 bytes of a block, which hold the bit length
+  const std::uint64_t num_bits = num_bytes_ * 8;
+  unsigned char padding[72] = {0x80};
+  const std::size_t num_zero_pad = (buffer_size_ < 56 ? 56 - buffer_size_ : 120 - buffer_size_);
+  for (int ii = 0; ii < 8; ++ii) {
+    padding[num_zero_pad + ii] = static_cast<unsigned char>(num_bits >> (56 - 8 * ii));
+  }
+  Update(padding, num_zero_pad + 8);
+  static const char hex_digits[] = "0123456789abcdef";
+  std::string hex_str;
+  hex_str.reserve(2 * sizeof state_);
+  for (const std::uint32_t word : state_) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      hex_str.push_back(hex_digits[(word >> shift) & 0xf]);
+    }
+  }
+  return hex_str;
+}
+
+void Sha1Hasher::ProcessBlocks(const unsigned char* blocks, std::size_t num_blocks)
+{
+#if CAN_USE_SHA_NI
+  if (HasShaNi()) {
+    Sha1BlocksShaNi(state_.data(), blocks, num_blocks);
+    return;
+  }
+#endif
+  std::uint32_t words[80];
+  for (std::size_t bb = 0; bb < num_blocks; ++bb, blocks += 64) {
+    for (int ii = 0; ii < 16; ++ii) {
+      words[ii] = LoadBe32(blocks + 4 * ii);
+    }
+    for (int ii = 16; ii < 80; ++ii) {
+      words[ii] = RotateLeft(words[ii - 3] ^ words[ii - 8] ^ words[ii - 14] ^ words[ii - 16], 1);
+    }
+    std::uint32_t a = state_[0];
+    std::uint32_t b = state_[1];
+    std::uint32_t c = state_[2];
+    std::uint32_t d = state_[3];
+    std::uint32_t e = state_[4];
+    for (int ii = 0; ii < 80; ++ii) {
+      std::uint32_t f;
+      std::uint32_t k;
+      if (ii < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      }
+      else if (ii < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      }
+      else if (ii < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      }
+      else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      const std::uint32_t temp = RotateLeft(a, 5) + f + e + k + words[ii];
+      e = d;
+      d = c;
+      c = RotateLeft(b, 30);
+      b = a;
+      a = temp;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+  }
+}
+
+std::optional<std::string> GetFileSha1(const fs::path& path)
+{
+  std::ifstream file_ifs(path, std::ios_base::binary);
+  if (!file_ifs.good()) {
+    return std::nullopt;
+  }
+  std::vector<char> buffer(FILE_BUFFER_SIZE);
+  Sha1Hasher hasher;
+  while (file_ifs.good()) {
+    file_ifs.read(buffer.data(), buffer.size());
+    hasher.Update(buffer.data(), static_cast<std::size_t>(file_ifs.gcount()));
+  }
+  if (file_ifs.bad()) {
+    return std::nullopt;
+  }
+  return hasher.FinishHex();
+}
+
+namespace {
+
+std::uint32_t RotateLeft(std::uint32_t value, int bits)
+{
+  return (value << bits) | (value >> (32 - bits));
+}
+
+std::uint32_t LoadBe32(const unsigned char* bytes)
+{
+  return ((std::uint32_t(bytes[0]) << 24) | (std::uint32_t(bytes[1]) << 16)
+          | (std::uint32_t(bytes[2]) << 8) | std::uint32_t(bytes[3]));
+}
+
+#if CAN_USE_SHA_NI
+
+bool HasShaNi()
+{
+  static const bool has_sha_ni = []() {
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || (ecx & bit_SSSE3) == 0
+        || (ecx & bit_SSE4_1) == 0) {
+      return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    return (ebx & bit_SHA) != 0;
+  }();
+  return has_sha_ni;
+}
+
+__attribute__((target("sha,sse4.1"))) __m128i Sha1Rounds4(__m128i abcd, __m128i e, int func)
+{
+  // The round function has to be an immediate
+  switch (func) {
+  case 0:
+    return _mm_sha1rnds4_epu32(abcd, e, 0);
+  case 1:
+    return _mm_sha1rnds4_epu32(abcd, e, 1);
+  case 2:
+    return _mm_sha1rnds4_epu32(abcd, e, 2);
+  default:
+    return _mm_sha1rnds4_epu32(abcd, e, 3);
+  }
+}
+
+__attribute__((target("sha,sse4.1"))) void Sha1BlocksShaNi(std::uint32_t* state,
+                                                           const unsigned char* blocks,
+                                                           std::size_t num_blocks)
+{
+  // Based on the well known Intel sample. Each step does 4 of the 80 rounds, while the message
+  // schedule for later steps is worked out in a rolling window of 4 vectors.
+  const __m128i byte_swap_mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1b);
+  __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+  for (std::size_t bb = 0; bb < num_blocks; ++bb, blocks += 64) {
+    const __m128i abcd_save = abcd;
+    const __m128i e0_save = e0;
+    __m128i msgs[4];
+    for (int ii = 0; ii < 4; ++ii) {
+      msgs[ii] = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * ii)), byte_swap_mask);
+    }
+    __m128i prev_abcd = abcd;
+#pragma GCC unroll 20
+    for (int step = 0; step < 20; ++step) {
+      const __m128i e = (step == 0 ? _mm_add_epi32(e0, msgs[0])
+                                   : _mm_sha1nexte_epu32(prev_abcd, msgs[step % 4]));
+      prev_abcd = abcd;
+      if (step >= 3 && step <= 18) {
+        msgs[(step + 1) % 4] = _mm_sha1msg2_epu32(msgs[(step + 1) % 4], msgs[step % 4]);
+      }
+      abcd = Sha1Rounds4(abcd, e, step / 5);
+      if (step >= 1 && step <= 16) {
+        msgs[(step + 3) % 4] = _mm_sha1msg1_epu32(msgs[(step + 3) % 4], msgs[step % 4]);
+      }
+      if (step >= 2 && step <= 17) {
+        msgs[(step + 2) % 4] = _mm_xor_si128(msgs[(step + 2) % 4], msgs[step % 4]);
+      }
+    }
+    e0 = _mm_sha1nexte_epu32(prev_abcd, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = static_cast<std::uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+#endif
+
+}  // namespace
+
+}  // namespace tl
@@ -0,0 +1,59 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_HASHING_HPP_
+#define TROLLAUNCHER_HASHING_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace tl {
+
+// This is the same CRC-32 used by zip files, so file CRCs can be compared with zip entry CRCs
+
+std::uint32_t Crc32Update(std::uint32_t crc, const void* data, std::size_t size);
+std::optional<std::uint32_t> GetFileCrc32(const std::filesystem::path& path);
+
+// SHA-1, for when a CRC isn't good enough to tell files apart (e.g., content-addressed backups)
+
+class Sha1Hasher {
+ public:
+  Sha1Hasher();
+
+  void Update(const void* data, std::size_t size);
+  // Returns the digest as 40 lowercase hex digits. The hasher can't be updated afterwards.
+  std::string FinishHex();
+
+ private:
+  void ProcessBlocks(const unsigned char* blocks, std::size_t num_blocks);
+
+  std::array<std::uint32_t, 5> state_;
+  std::array<unsigned char, 64> buffer_;
+  std::size_t buffer_size_;
+  std::uint64_t num_bytes_;
+};
+
+std::optional<std::string> GetFileSha1(const std::filesystem::path& path);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_HASHING_HPP_
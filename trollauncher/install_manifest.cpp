@@ -0,0 +1,233 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/install_manifest.hpp"
+
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+#include "trollauncher/error_codes.hpp"
+
+#ifndef ITS_A_UNIX_SYSTEM
+#ifndef _WIN32
+#define ITS_A_UNIX_SYSTEM true
+#else
+#define ITS_A_UNIX_SYSTEM false
+#endif
+#endif
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+namespace nl = nlohmann;
+
+static constexpr int MANIFEST_VERSION = 1;
+
+}  // namespace
+
+struct InstallManifest::Data_ {
+  std::string pack_hash;
+  std::vector<ManifestFile> files;
+  std::unordered_map<std::string, std::size_t> file_path_map;
+};
+
+InstallManifest::InstallManifest() : data_(std::make_unique<InstallManifest::Data_>())
+{
+  // Do nothing
+}
+
+InstallManifest::Ptr InstallManifest::Create(const std::string& pack_hash)
+{
+  auto im_ptr = Ptr(new InstallManifest());
+  im_ptr->data_->pack_hash = pack_hash;
+  return im_ptr;
+}
+
+InstallManifest::Ptr InstallManifest::Load(const fs::path& profile_path, std::error_code* ec)
+{
+  std::ifstream manifest_ifs(GetManifestPath(profile_path));
+  if (!manifest_ifs.good()) {
+    SetError(ec, Error::PROFILE_MANIFEST_READ_FAILED);
+    return nullptr;
+  }
+  // Check every type before reading, since a wrong one would throw, and a broken manifest should
+  // just mean falling back to walking the whole profile
+  const nl::json manifest_json = nl::json::parse(manifest_ifs, nullptr, false);
+  if (manifest_json.is_discarded() || !manifest_json.is_object()) {
+    SetError(ec, Error::PROFILE_MANIFEST_READ_FAILED);
+    return nullptr;
+  }
+  const nl::json version_json = manifest_json.value("version", nl::json(nullptr));
+  const nl::json pack_hash_json = manifest_json.value("packHash", nl::json(nullptr));
+  const nl::json files_json = manifest_json.value("files", nl::json(nullptr));
+  if (!version_json.is_number_unsigned()
+      || version_json.get<std::uint64_t>() != static_cast<std::uint64_t>(MANIFEST_VERSION)
+      || !pack_hash_json.is_string() || !files_json.is_array()) {
+    SetError(ec, Error::PROFILE_MANIFEST_READ_FAILED);
+    return nullptr;
+  }
+  auto im_ptr = Create(pack_hash_json.get<std::string>());
+  im_ptr->data_->files.reserve(files_json.size());
+  for (const nl::json& file_json : files_json) {
+    if (!file_json.is_object()) {
+      SetError(ec, Error::PROFILE_MANIFEST_READ_FAILED);
+      return nullptr;
+    }
+    const nl::json path_json = file_json.value("path", nl::json(nullptr));
+    const nl::json size_json = file_json.value("size", nl::json(nullptr));
+    const nl::json crc_json = file_json.value("crc32", nl::json(nullptr));
+    const nl::json mtime_json = file_json.value("mtime", nl::json(nullptr));
+    // Negative sizes and CRCs would otherwise wrap around, so they have to be unsigned
+    if (!path_json.is_string() || !size_json.is_number_unsigned()
+        || !crc_json.is_number_unsigned()
+        || crc_json.get<std::uint64_t>() > std::numeric_limits<std::uint32_t>::max()
+        || !mtime_json.is_number_integer()
+        || (mtime_json.is_number_unsigned()
+            && mtime_json.get<std::uint64_t>()
+                   > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))) {
+      SetError(ec, Error::PROFILE_MANIFEST_READ_FAILED);
+      return nullptr;
+    }
+    ManifestFile file;
+    file.path = path_json.get<std::string>();
+    file.size = size_json.get<std::uint64_t>();
+    file.crc = static_cast<std::uint32_t>(crc_json.get<std::uint64_t>());
+    file.mtime = mtime_json.get<std::int64_t>();
+    im_ptr->data_->file_path_map[file.path] = im_ptr->data_->files.size();
+    im_ptr->data_->files.push_back(std::move(file));
+  }
+  return im_ptr;
+}
+
+fs::path InstallManifest::GetManifestPath(const fs::path& profile_path)
+{
+  return profile_path / "trollauncher" / "manifest.json";
+}
+
+std::optional<std::int64_t> InstallManifest::GetFileMtime(const fs::path& path)
+{
+  std::error_code fs_ec;
+  const fs::file_time_type mtime = fs::last_write_time(path, fs_ec);
+  if (fs_ec) {
+    return std::nullopt;
+  }
+  return static_cast<std::int64_t>(mtime.time_since_epoch().count());
+}
+
+const std::string& InstallManifest::GetPackHash() const
+{
+  return data_->pack_hash;
+}
+
+const std::vector<ManifestFile>& InstallManifest::GetFiles() const
+{
+  return data_->files;
+}
+
+const ManifestFile* InstallManifest::FindFile(std::string_view path) const
+{
+  const auto file_iter = data_->file_path_map.find(std::string(path));
+  if (file_iter == data_->file_path_map.end()) {
+    return nullptr;
+  }
+  return &data_->files.at(std::get<1>(*file_iter));
+}
+
+std::optional<std::uint32_t> InstallManifest::GetKnownCrc(std::string_view path, std::uint64_t size,
+                                                          std::int64_t mtime) const
+{
+  const ManifestFile* file_ptr = FindFile(path);
+  if (file_ptr == nullptr || file_ptr->size != size || file_ptr->mtime != mtime) {
+    return std::nullopt;
+  }
+  return file_ptr->crc;
+}
+
+void InstallManifest::AddEntries(const fs::path& profile_path,
+                                 const std::vector<const ModpackEntry*>& entry_ptrs)
+{
+  for (const ModpackEntry* entry_ptr : entry_ptrs) {
+    const std::optional<std::int64_t> mtime_opt = GetFileMtime(profile_path / entry_ptr->path);
+    if (!mtime_opt) {
+      // Anything that didn't make it to the disk isn't part of the install
+      continue;
+    }
+    const ManifestFile file{entry_ptr->path, entry_ptr->size, entry_ptr->crc, mtime_opt.value()};
+    const auto file_iter = data_->file_path_map.find(file.path);
+    if (file_iter != data_->file_path_map.end()) {
+      data_->files.at(std::get<1>(*file_iter)) = file;
+    }
+    else {
+      data_->file_path_map.emplace(file.path, data_->files.size());
+      data_->files.push_back(file);
+    }
+  }
+}
+
+bool InstallManifest::Save(const fs::path& profile_path, std::error_code* ec) const
+{
+  nl::json files_json = nl::json::array();
+  for (const ManifestFile& file : data_->files) {
+    files_json.push_back({
+        {"path", file.path},
+        {"size", file.size},
+        {"crc32", file.crc},
+        {"mtime", file.mtime},
+    });
+  }
+  const nl::json manifest_json = {
+      {"version", MANIFEST_VERSION},
+      {"packHash", data_->pack_hash},
+      {"files", std::move(files_json)},
+  };
+  // Write a new file and move it into place, so a failed write never leaves a partial manifest
+  std::error_code fs_ec;
+  const fs::path manifest_path = GetManifestPath(profile_path);
+  const fs::path new_manifest_path = manifest_path.parent_path() / "new_manifest.json";
+  fs::create_directories(manifest_path.parent_path(), fs_ec);
+  std::ofstream new_manifest_file(new_manifest_path);
+  if (!new_manifest_file.good()) {
+    SetError(ec, Error::PROFILE_MANIFEST_WRITE_FAILED);
+    return false;
+  }
+  new_manifest_file << manifest_json.dump(-1, ' ', false, nl::json::error_handler_t::replace);
+  new_manifest_file.close();
+  if (!new_manifest_file.good()) {
+    fs::remove(new_manifest_path, fs_ec);
+    SetError(ec, Error::PROFILE_MANIFEST_WRITE_FAILED);
+    return false;
+  }
+  if (!ITS_A_UNIX_SYSTEM) {
+    // Apparently overwrite doesn't work on Windoze!
+    fs::remove(manifest_path, fs_ec);
+  }
+  fs::rename(new_manifest_path, manifest_path, fs_ec);
+  if (fs_ec) {
+    fs::remove(new_manifest_path, fs_ec);
+    SetError(ec, Error::PROFILE_MANIFEST_WRITE_FAILED);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace tl
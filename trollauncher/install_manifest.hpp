@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_INSTALL_MANIFEST_HPP_
+#define TROLLAUNCHER_INSTALL_MANIFEST_HPP_
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "trollauncher/modpack_index.hpp"
+
+namespace tl {
+
+/**
+ * A file written by Trollauncher. The path is relative to the profile directory and uses forward
+ * slashes. The mtime is whatever the filesystem reported right after the file was written, so if
+ * the size and mtime still match, the file can be assumed to still have the same CRC.
+ */
+struct ManifestFile {
+  std::string path;
+  std::uint64_t size;
+  std::uint32_t crc;
+  std::int64_t mtime;
+};
+
+/**
+ * A record of every file installed into a profile from a modpack, saved in the "trollauncher"
+ * directory of the profile. This lets updates tell the files of the modpack apart from files added
+ * by the user, without walking and hashing the whole profile.
+ */
+class InstallManifest final {
+ public:
+  using Ptr = std::shared_ptr<InstallManifest>;
+
+  static Ptr Create(const std::string& pack_hash);
+  static Ptr Load(const std::filesystem::path& profile_path, std::error_code* ec);
+  static std::filesystem::path GetManifestPath(const std::filesystem::path& profile_path);
+  static std::optional<std::int64_t> GetFileMtime(const std::filesystem::path& path);
+
+  const std::string& GetPackHash() const;
+  const std::vector<ManifestFile>& GetFiles() const;
+  const ManifestFile* FindFile(std::string_view path) const;
+  std::optional<std::uint32_t> GetKnownCrc(std::string_view path, std::uint64_t size,
+                                           std::int64_t mtime) const;
+  void AddEntries(const std::filesystem::path& profile_path,
+                  const std::vector<const ModpackEntry*>& entry_ptrs);
+  bool Save(const std::filesystem::path& profile_path, std::error_code* ec) const;
+
+ private:
+  InstallManifest();
+
+  struct Data_;
+  std::unique_ptr<Data_> data_;
+};
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_INSTALL_MANIFEST_HPP_
@@ -18,7 +18,14 @@
 
 #include "trollauncher/keeplist_processor.hpp"
 
+#include <cctype>
+#include <fstream>
 #include <regex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "trollauncher/error_codes.hpp"
 
 namespace tl {
 
@@ -29,39 +36,98 @@ namespace fs = std::filesystem;
 // TODO With Structurize it might be good to allow updating with new schematics, but make sure not
 // to delete or overwrite user schematics? The trouble is, how would you know?
 
-static const std::vector<std::regex> default_keep_regexes = {
+static const std::vector<std::string> default_keep_patterns = {
     // Minecraft data
-    std::regex("^crash-reports/"),
-    std::regex("^logs/"),
-    std::regex("^resourcepacks/"),
-    std::regex("^saves/"),
-    std::regex("^screenshots/"),
-    std::regex("^hotbar.nbt"),
-    std::regex("^options.txt"),
-    std::regex("^servers.dat"),
-    std::regex("^usercache.json"),
-    std::regex("^usernamecache.json"),
+    "^crash-reports/",
+    "^logs/",
+    "^resourcepacks/",
+    "^saves/",
+    "^screenshots/",
+    "^hotbar\\.nbt",
+    "^options\\.txt",
+    "^servers\\.dat",
+    "^usercache\\.json",
+    "^usernamecache\\.json",
     // Optifine
-    std::regex("^shaderpacks/"),
-    std::regex("^optionsof.txt"),
-    std::regex("^optionsshaders.txt"),
+    "^shaderpacks/",
+    "^optionsof\\.txt",
+    "^optionsshaders\\.txt",
     // Reauth data
-    std::regex("^reauth.toml"),
+    "^reauth\\.toml",
     // Xaero map data
-    std::regex("^XaeroWaypoints/"),
-    std::regex("^XaeroWorldMap/"),
+    "^XaeroWaypoints/",
+    "^XaeroWorldMap/",
     // Structurize
-    std::regex("^structurize/"),
+    "^structurize/",
     // Anything Git related
-    std::regex("^.git/"),
-    std::regex("^.gitignore"),
-    std::regex("^.gitmodules"),
+    "^\\.git/",
+    "^\\.gitignore",
+    "^\\.gitmodules",
+};
+
+/**
+ * Matches paths against a set of literal prefixes, one character at a time. Almost every keeplist
+ * pattern is just "^" and a literal, so this handles nearly everything without touching std::regex.
+ */
+class PrefixTrie {
+ public:
+  PrefixTrie();
+
+  void Insert(std::string_view prefix);
+  bool MatchesPrefixOf(std::string_view path) const;
+
+ private:
+  struct Node {
+    std::vector<std::pair<char, std::size_t>> children;
+    bool is_end;
+  };
+
+  std::vector<Node> nodes_;
+};
+
+/**
+ * A glob from a custom keeplist. A "*" matches anything but a slash, a "**" matches anything at
+ * all, and "**" followed by a slash matches any number of whole directories. A glob matches a path
+ * if it matches all of it, or all of some leading directories of it, so "data/gen_*" keeps
+ * everything inside "data/gen_1/" too.
+ */
+class KeepGlob {
+ public:
+  static std::optional<KeepGlob> Compile(std::string_view glob);
+
+  bool MatchesPrefixOf(std::string_view path) const;
+
+ private:
+  enum class TokenType { LITERAL, ANY_CHAR, CHAR_CLASS, STAR, GLOBSTAR, GLOBSTAR_DIRS };
+
+  struct Token {
+    TokenType type;
+    char ch;
+    std::vector<std::pair<char, char>> ranges;
+    bool is_negated;
+  };
+
+  bool MatchesFrom(std::size_t token_index, std::string_view path, std::size_t pos) const;
+
+  std::vector<Token> tokens_;
+};
+
+struct KeepRegex {
+  std::regex regex;
+  bool matches_subtree;
 };
 
+std::optional<std::string> GetLiteralPrefix(const std::string& keep_pattern);
+bool MatchesSubtree(const std::string& keep_pattern);
+bool IsGlobRule(std::string_view keep_rule);
+std::string UnescapeRule(std::string_view keep_rule);
+
 }  // namespace
 
 struct KeeplistProcessor::Data_ {
-  std::vector<std::regex> keep_regexes;
+  PrefixTrie keep_trie;
+  std::vector<KeepGlob> keep_globs;
+  std::vector<KeepRegex> keep_regexes;
 };
 
 KeeplistProcessor::KeeplistProcessor() : data_(std::make_unique<KeeplistProcessor::Data_>())
@@ -69,39 +135,376 @@ KeeplistProcessor::KeeplistProcessor() : data_(std::make_unique<KeeplistProcesso
   // Do nothing
 }
 
-KeeplistProcessor::Ptr KeeplistProcessor::Create(const fs::path&, std::error_code*)
+KeeplistProcessor::Ptr KeeplistProcessor::Create(const fs::path& keeplist_path, std::error_code* ec)
 {
-  // TODO Someday we should be able to load a custom keeplist
-  throw std::runtime_error("Not implemented");
+  std::ifstream keeplist_ifs(keeplist_path);
+  if (!keeplist_ifs.good()) {
+    SetError(ec, Error::MODPACK_KEEPLIST_READ_FAILED);
+    return nullptr;
+  }
+  return CreateFromStream(&keeplist_ifs, ec);
+}
+
+KeeplistProcessor::Ptr KeeplistProcessor::CreateFromString(const std::string& keeplist_str,
+                                                           std::error_code* ec)
+{
+  std::istringstream keeplist_iss(keeplist_str);
+  return CreateFromStream(&keeplist_iss, ec);
+}
+
+KeeplistProcessor::Ptr KeeplistProcessor::CreateFromStream(std::istream* keeplist_is_ptr,
+                                                           std::error_code* ec)
+{
+  // Custom rules are in addition to the default ones, which are always a good idea
+  auto klp_ptr = CreateDefault();
+  std::string line;
+  while (std::getline(*keeplist_is_ptr, line)) {
+    std::string_view keep_rule = line;
+    while (!keep_rule.empty() && std::isspace(static_cast<unsigned char>(keep_rule.front()))) {
+      keep_rule.remove_prefix(1);
+    }
+    while (!keep_rule.empty() && std::isspace(static_cast<unsigned char>(keep_rule.back()))) {
+      keep_rule.remove_suffix(1);
+    }
+    if (keep_rule.empty() || keep_rule.front() == '#') {
+      continue;
+    }
+    // Paths are always relative to the profile, so a leading slash doesn't mean anything
+    while (!keep_rule.empty() && keep_rule.front() == '/') {
+      keep_rule.remove_prefix(1);
+    }
+    if (keep_rule.empty()) {
+      SetError(ec, Error::MODPACK_KEEPLIST_PARSE_FAILED);
+      return nullptr;
+    }
+    if (!IsGlobRule(keep_rule)) {
+      klp_ptr->data_->keep_trie.Insert(UnescapeRule(keep_rule));
+      continue;
+    }
+    std::optional<KeepGlob> keep_glob_opt = KeepGlob::Compile(keep_rule);
+    if (!keep_glob_opt) {
+      SetError(ec, Error::MODPACK_KEEPLIST_PARSE_FAILED);
+      return nullptr;
+    }
+    klp_ptr->data_->keep_globs.push_back(std::move(keep_glob_opt.value()));
+  }
+  if (keeplist_is_ptr->bad()) {
+    SetError(ec, Error::MODPACK_KEEPLIST_READ_FAILED);
+    return nullptr;
+  }
+  return klp_ptr;
 }
 
 KeeplistProcessor::Ptr KeeplistProcessor::CreateDefault()
 {
   auto klp_ptr = Ptr(new KeeplistProcessor());
-  klp_ptr->data_->keep_regexes = default_keep_regexes;
+  for (const std::string& keep_pattern : default_keep_patterns) {
+    // Only patterns that aren't plain prefixes need an actual regex
+    const std::optional<std::string> literal_prefix_opt = GetLiteralPrefix(keep_pattern);
+    if (literal_prefix_opt) {
+      klp_ptr->data_->keep_trie.Insert(literal_prefix_opt.value());
+    }
+    else {
+      klp_ptr->data_->keep_regexes.push_back(
+          KeepRegex{std::regex(keep_pattern), MatchesSubtree(keep_pattern)});
+    }
+  }
   return klp_ptr;
 }
 
-bool KeeplistProcessor::IsOverwritePath(const fs::path& path) const
+bool KeeplistProcessor::IsOverwritePath(std::string_view path) const
 {
-  for (const std::regex& keep_regex : data_->keep_regexes) {
-    if (std::regex_search(path.generic_string(), keep_regex)) {
+  if (data_->keep_trie.MatchesPrefixOf(path)) {
+    return false;
+  }
+  for (const KeepGlob& keep_glob : data_->keep_globs) {
+    if (keep_glob.MatchesPrefixOf(path)) {
+      return false;
+    }
+  }
+  for (const KeepRegex& keep_regex : data_->keep_regexes) {
+    if (std::regex_search(path.begin(), path.end(), keep_regex.regex)) {
       return false;
     }
   }
   return true;
 }
 
+bool KeeplistProcessor::IsKeptDirectory(std::string_view dir_path) const
+{
+  if (data_->keep_trie.MatchesPrefixOf(dir_path)) {
+    return true;
+  }
+  for (const KeepGlob& keep_glob : data_->keep_globs) {
+    if (keep_glob.MatchesPrefixOf(dir_path)) {
+      return true;
+    }
+  }
+  for (const KeepRegex& keep_regex : data_->keep_regexes) {
+    if (keep_regex.matches_subtree
+        && std::regex_search(dir_path.begin(), dir_path.end(), keep_regex.regex)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 std::vector<fs::path> KeeplistProcessor::FilterOverwritePaths(
     const std::vector<fs::path>& paths) const
 {
   std::vector<fs::path> filtered_paths;
   for (const fs::path& path : paths) {
-    if (IsOverwritePath(path)) {
+    if (IsOverwritePath(path.generic_string())) {
       filtered_paths.push_back(path);
     }
   }
   return filtered_paths;
 }
 
+namespace {
+
+PrefixTrie::PrefixTrie() : nodes_(1, Node{{}, false})
+{
+  // Do nothing
+}
+
+void PrefixTrie::Insert(std::string_view prefix)
+{
+  std::size_t node_index = 0;
+  for (const char ch : prefix) {
+    std::size_t next_node_index = 0;
+    for (const auto& [child_ch, child_index] : nodes_.at(node_index).children) {
+      if (child_ch == ch) {
+        next_node_index = child_index;
+        break;
+      }
+    }
+    if (next_node_index == 0) {
+      next_node_index = nodes_.size();
+      nodes_.at(node_index).children.emplace_back(ch, next_node_index);
+      nodes_.push_back(Node{{}, false});
+    }
+    node_index = next_node_index;
+  }
+  nodes_.at(node_index).is_end = true;
+}
+
+bool PrefixTrie::MatchesPrefixOf(std::string_view path) const
+{
+  const Node* node_ptr = &nodes_.front();
+  for (const char ch : path) {
+    if (node_ptr->is_end) {
+      return true;
+    }
+    const Node* next_node_ptr = nullptr;
+    for (const auto& [child_ch, child_index] : node_ptr->children) {
+      if (child_ch == ch) {
+        next_node_ptr = &nodes_[child_index];
+        break;
+      }
+    }
+    if (next_node_ptr == nullptr) {
+      return false;
+    }
+    node_ptr = next_node_ptr;
+  }
+  return node_ptr->is_end;
+}
+
+std::optional<KeepGlob> KeepGlob::Compile(std::string_view glob)
+{
+  KeepGlob keep_glob;
+  for (std::size_t ii = 0; ii < glob.size(); ++ii) {
+    const char ch = glob.at(ii);
+    if (ch == '\\') {
+      if (ii + 1 == glob.size()) {
+        return std::nullopt;
+      }
+      keep_glob.tokens_.push_back(Token{TokenType::LITERAL, glob.at(++ii), {}, false});
+    }
+    else if (ch == '?') {
+      keep_glob.tokens_.push_back(Token{TokenType::ANY_CHAR, '\0', {}, false});
+    }
+    else if (ch == '*') {
+      if (ii + 1 < glob.size() && glob.at(ii + 1) == '*') {
+        ++ii;
+        if (ii + 1 < glob.size() && glob.at(ii + 1) == '/') {
+          ++ii;
+          keep_glob.tokens_.push_back(Token{TokenType::GLOBSTAR_DIRS, '\0', {}, false});
+        }
+        else {
+          keep_glob.tokens_.push_back(Token{TokenType::GLOBSTAR, '\0', {}, false});
+        }
+      }
+      else {
+        keep_glob.tokens_.push_back(Token{TokenType::STAR, '\0', {}, false});
+      }
+    }
+    else if (ch == '[') {
+      Token token{TokenType::CHAR_CLASS, '\0', {}, false};
+      std::size_t jj = ii + 1;
+      if (jj < glob.size() && (glob.at(jj) == '!' || glob.at(jj) == '^')) {
+        token.is_negated = true;
+        ++jj;
+      }
+      // Like in a shell, a "]" right at the start is just a character in the class
+      for (bool is_first = true; jj < glob.size() && (is_first || glob.at(jj) != ']');
+           is_first = false) {
+        const char first_ch = glob.at(jj);
+        if (jj + 2 < glob.size() && glob.at(jj + 1) == '-' && glob.at(jj + 2) != ']') {
+          token.ranges.emplace_back(first_ch, glob.at(jj + 2));
+          jj += 3;
+        }
+        else {
+          token.ranges.emplace_back(first_ch, first_ch);
+          jj += 1;
+        }
+      }
+      if (jj >= glob.size()) {
+        return std::nullopt;
+      }
+      keep_glob.tokens_.push_back(std::move(token));
+      ii = jj;
+    }
+    else {
+      keep_glob.tokens_.push_back(Token{TokenType::LITERAL, ch, {}, false});
+    }
+  }
+  return keep_glob;
+}
+
+bool KeepGlob::MatchesPrefixOf(std::string_view path) const
+{
+  return MatchesFrom(0, path, 0);
+}
+
+bool KeepGlob::MatchesFrom(std::size_t token_index, std::string_view path, std::size_t pos) const
+{
+  for (; token_index < tokens_.size(); ++token_index) {
+    const Token& token = tokens_.at(token_index);
+    switch (token.type) {
+    case TokenType::LITERAL:
+      if (pos == path.size() || path.at(pos) != token.ch) {
+        return false;
+      }
+      ++pos;
+      break;
+    case TokenType::ANY_CHAR:
+      if (pos == path.size() || path.at(pos) == '/') {
+        return false;
+      }
+      ++pos;
+      break;
+    case TokenType::CHAR_CLASS: {
+      if (pos == path.size() || path.at(pos) == '/') {
+        return false;
+      }
+      const char ch = path.at(pos);
+      bool in_class = false;
+      for (const auto& [first_ch, last_ch] : token.ranges) {
+        in_class = in_class || (first_ch <= ch && ch <= last_ch);
+      }
+      if (in_class == token.is_negated) {
+        return false;
+      }
+      ++pos;
+      break;
+    }
+    case TokenType::STAR:
+      for (std::size_t end_pos = pos; end_pos <= path.size(); ++end_pos) {
+        if (MatchesFrom(token_index + 1, path, end_pos)) {
+          return true;
+        }
+        if (end_pos < path.size() && path.at(end_pos) == '/') {
+          break;
+        }
+      }
+      return false;
+    case TokenType::GLOBSTAR:
+      for (std::size_t end_pos = pos; end_pos <= path.size(); ++end_pos) {
+        if (MatchesFrom(token_index + 1, path, end_pos)) {
+          return true;
+        }
+      }
+      return false;
+    case TokenType::GLOBSTAR_DIRS:
+      for (std::size_t end_pos = pos; end_pos <= path.size(); ++end_pos) {
+        const bool is_dir_end = (end_pos == pos || path.at(end_pos - 1) == '/');
+        if (is_dir_end && MatchesFrom(token_index + 1, path, end_pos)) {
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+  // Either the whole path matched, or some whole leading directories did
+  return (pos == path.size() || path.at(pos) == '/' || (pos != 0 && path.at(pos - 1) == '/'));
+}
+
+std::optional<std::string> GetLiteralPrefix(const std::string& keep_pattern)
+{
+  // The pattern must be anchored, and everything after that must be literal or escaped
+  static const std::string special_chars = "^$\\.*+?()[]{}|";
+  if (keep_pattern.empty() || keep_pattern.front() != '^') {
+    return std::nullopt;
+  }
+  std::string literal_prefix;
+  for (std::size_t ii = 1; ii < keep_pattern.size(); ++ii) {
+    const char ch = keep_pattern.at(ii);
+    if (ch == '\\') {
+      if (ii + 1 == keep_pattern.size()
+          || std::isalnum(static_cast<unsigned char>(keep_pattern.at(ii + 1)))) {
+        // Things like "\d" and "\b" aren't literals
+        return std::nullopt;
+      }
+      literal_prefix.push_back(keep_pattern.at(++ii));
+    }
+    else if (special_chars.find(ch) != std::string::npos) {
+      return std::nullopt;
+    }
+    else {
+      literal_prefix.push_back(ch);
+    }
+  }
+  return literal_prefix;
+}
+
+bool MatchesSubtree(const std::string& keep_pattern)
+{
+  // If a pattern matches a directory, it also matches everything inside it, unless the pattern
+  // cares about where the path ends. Anything that could do that is treated conservatively.
+  return (keep_pattern.find('$') == std::string::npos
+          && keep_pattern.find("(?") == std::string::npos
+          && keep_pattern.find("\\b") == std::string::npos
+          && keep_pattern.find("\\B") == std::string::npos);
+}
+
+bool IsGlobRule(std::string_view keep_rule)
+{
+  for (std::size_t ii = 0; ii < keep_rule.size(); ++ii) {
+    const char ch = keep_rule.at(ii);
+    if (ch == '\\') {
+      ++ii;
+    }
+    else if (ch == '*' || ch == '?' || ch == '[') {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string UnescapeRule(std::string_view keep_rule)
+{
+  std::string unescaped_rule;
+  for (std::size_t ii = 0; ii < keep_rule.size(); ++ii) {
+    if (keep_rule.at(ii) == '\\' && ii + 1 < keep_rule.size()) {
+      ++ii;
+    }
+    unescaped_rule.push_back(keep_rule.at(ii));
+  }
+  return unescaped_rule;
+}
+
+}  // namespace
+
 }  // namespace tl
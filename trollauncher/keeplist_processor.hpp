@@ -20,30 +20,42 @@
 #define TROLLAUNCHER_KEEPLIST_PROCESSOR_HPP_
 
 #include <filesystem>
+#include <iosfwd>
 #include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <system_error>
+#include <vector>
 
 namespace tl {
 
 /**
- * Paths given to the keeplist processor should be relative to the project root directory.
- * Otherwise, the keeplist my not be able to match paths.
+ * Paths given to the keeplist processor should be relative to the project root directory, and use
+ * forward slashes. Otherwise, the keeplist my not be able to match paths.
  *
  * For example, these would be acceptable:
  *
  *     config/my-mod.toml
  *     mods/my-mod-1.14.4-0.jar
  *     trollauncher/installer.jar
+ *
+ * A directory is kept if everything that could possibly be inside it is kept, in which case there
+ * is no need to look inside it at all. Directory paths should end with a slash, like "saves/".
+ *
+ * A custom keeplist has one prefix or glob per line, and is used in addition to the default
+ * keeplist. See the README for the details of the format.
  */
 class KeeplistProcessor final {
  public:
   using Ptr = std::shared_ptr<KeeplistProcessor>;
 
   static Ptr Create(const std::filesystem::path& keeplist_path, std::error_code* ec);
+  static Ptr CreateFromString(const std::string& keeplist_str, std::error_code* ec);
   static Ptr CreateDefault();
 
-  bool IsOverwritePath(const std::filesystem::path& path) const;
+  bool IsOverwritePath(std::string_view path) const;
+  bool IsKeptDirectory(std::string_view dir_path) const;
 
   std::vector<std::filesystem::path> FilterOverwritePaths(
       const std::vector<std::filesystem::path>& paths) const;
@@ -51,6 +63,8 @@ class KeeplistProcessor final {
  private:
   KeeplistProcessor();
 
+  static Ptr CreateFromStream(std::istream* keeplist_is_ptr, std::error_code* ec);
+
   struct Data_;
   std::unique_ptr<Data_> data_;
 };
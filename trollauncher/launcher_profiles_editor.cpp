@@ -18,14 +18,20 @@
 
 #include "trollauncher/launcher_profiles_editor.hpp"
 
+#include <cerrno>
 #include <chrono>
+#include <cstdint>
 #include <ctime>
 #include <fstream>
+#include <set>
+#include <string>
 #include <thread>
+#include <unordered_map>
 
 #include <nlohmann/json.hpp>
 
 #include "trollauncher/error_codes.hpp"
+#include "trollauncher/file_lock.hpp"
 #include "trollauncher/utils.hpp"
 
 #ifndef ITS_A_UNIX_SYSTEM
@@ -36,6 +42,12 @@
 #endif
 #endif
 
+#if ITS_A_UNIX_SYSTEM
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace tl {
 
 namespace {
@@ -43,8 +55,90 @@ namespace {
 namespace fs = std::filesystem;
 namespace nl = nlohmann;
 
+// Includes the newest one, "backup_launcher_profiles.json", then older ones get a ".1", ".2", etc.
+static const int NUM_LAUNCHER_PROFILES_BACKUPS = 3;
+
+// Enough to tell if the file changed since it was last read. The inode catches files that were
+// replaced by a rename, even if the time and size happen to match.
+struct FileStamp {
+  fs::file_time_type write_time;
+  std::uintmax_t size;
+  std::uint64_t device;
+  std::uint64_t inode;
+
+  bool operator==(const FileStamp& other) const;
+};
+
+// Newest first, then profiles that were never used, with the ID breaking ties
+struct LastUsedGreater {
+  bool operator()(const ProfileData* aa_ptr, const ProfileData* bb_ptr) const;
+};
+
+// All the profiles by ID, plus indexes that are kept up to date as profiles are put in, so lookups
+// don't have to scan, and listing doesn't have to sort
+class ProfileStore final {
+ public:
+  using LastUsedSet = std::set<const ProfileData*, LastUsedGreater>;
+
+  void Clear();
+  void Put(ProfileData profile_data);
+
+  const ProfileData* Find(const std::string& id) const;
+  bool HasName(const std::string& name) const;
+  const LastUsedSet& GetByLastUsed() const;
+
+ private:
+  void Unindex(const ProfileData& profile_data);
+  void Index(const ProfileData& profile_data);
+
+  // Elements of an unordered map never move, so the indexes can point right at them
+  std::unordered_map<std::string, ProfileData> profile_data_map_;
+  std::unordered_multimap<std::string, std::string> name_ids_;
+  LastUsedSet last_used_set_;
+};
+
+// Picks just the profile fields out of the file, without building the whole document. The launcher
+// keeps all sorts of stuff in there (accounts, settings, etc.) that we never look at.
+class ProfilesSaxHandler final {
+ public:
+  explicit ProfilesSaxHandler(ProfileStore* profile_store_ptr);
+
+  bool null();
+  bool boolean(bool val);
+  bool number_integer(nl::json::number_integer_t val);
+  bool number_unsigned(nl::json::number_unsigned_t val);
+  bool number_float(nl::json::number_float_t val, const std::string& val_str);
+  bool string(std::string& val);
+  // Only in newer versions of the library, but never in a JSON file anyway
+  template <typename BinaryType>
+  bool binary(BinaryType& val);
+  bool start_object(std::size_t num_elements);
+  bool key(std::string& val);
+  bool end_object();
+  bool start_array(std::size_t num_elements);
+  bool end_array();
+  bool parse_error(std::size_t position, const std::string& last_token,
+                   const nl::detail::exception& ex);
+
+ private:
+  ProfileStore* profile_store_ptr_;
+  // Root object is 1, "profiles" is 2, and each profile is 3
+  std::size_t depth_;
+  bool is_in_profiles_;
+  std::string key_;
+  std::optional<ProfileData> profile_data_opt_;
+};
+
+std::optional<FileStamp> GetFileStamp(const fs::path& path);
+ProfileData ReadProfileData(const std::string& profile_id, const nl::json& profile_json);
+void SetProfileField(ProfileData* profile_data_ptr, const std::string& key, std::string val);
 bool IsFileWritable(const fs::path& path);
 fs::path AddFilenamePrefix(const fs::path& path, const std::string& prefix);
+fs::path GetBackupPath(const fs::path& launcher_profiles_path, int backup_index);
+bool IsFileContent(const fs::path& path, const std::string& content);
+bool WriteFileSynced(const fs::path& path, const std::string& content);
+void SyncDir(const fs::path& dir_path);
+bool RotateBackups(const fs::path& launcher_profiles_path);
 bool WriteLauncherProfilesJson(const fs::path& launcher_profiles_path,
                                const nl::json& new_launcher_profiles_json, std::error_code* ec);
 
@@ -52,8 +146,17 @@ bool WriteLauncherProfilesJson(const fs::path& launcher_profiles_path,
 
 struct LauncherProfilesEditor::Data_ {
   fs::path launcher_profiles_path;
+  // The whole document is only read when there's an edit to make, otherwise it's just the map
   nl::json launcher_profiles_json;
-  std::map<std::string, ProfileData> profile_data_map;
+  bool has_json;
+  ProfileStore profile_store;
+  // Stamp of the file the JSON came from, empty if there's nothing good cached
+  std::optional<FileStamp> file_stamp_opt;
+  // Only set during a transaction
+  FileLock::Ptr transaction_lock_ptr;
+  bool is_staged;
+  // Everything staged so far in the transaction, kept so it can be redone
+  std::vector<StageFunc> stage_funcs;
 };
 
 LauncherProfilesEditor::LauncherProfilesEditor()
@@ -68,6 +171,8 @@ LauncherProfilesEditor::Ptr LauncherProfilesEditor::Create(const fs::path& launc
   auto lpe_ptr = Ptr(new LauncherProfilesEditor());
   lpe_ptr->data_->launcher_profiles_path = launcher_profiles_path;
   lpe_ptr->data_->launcher_profiles_json = nl::json::object();
+  lpe_ptr->data_->has_json = false;
+  lpe_ptr->data_->is_staged = false;
   if (!lpe_ptr->Refresh(ec)) {
     return nullptr;
   }
@@ -76,109 +181,38 @@ LauncherProfilesEditor::Ptr LauncherProfilesEditor::Create(const fs::path& launc
 
 bool LauncherProfilesEditor::Refresh(std::error_code* ec)
 {
-  data_->launcher_profiles_json = nl::json::object();
-  data_->profile_data_map.clear();
-  if (!fs::exists(data_->launcher_profiles_path)) {
-    SetError(ec, Error::LAUNCHER_PROFILES_NONEXISTENT);
-    return false;
-  }
-  std::ifstream launcher_profiles_ifs(data_->launcher_profiles_path);
-  nl::json new_launcher_profiles_json = nl::json::parse(launcher_profiles_ifs, nullptr, false);
-  launcher_profiles_ifs.close();
-  if (new_launcher_profiles_json.is_discarded()) {
-    SetError(ec, Error::LAUNCHER_PROFILES_PARSE_FAILED);
-    return false;
-  }
-  data_->launcher_profiles_json = new_launcher_profiles_json;
-  const nl::json profiles_json = new_launcher_profiles_json.value("profiles", nl::json::object());
-  for (const auto& [profile_id, profile_json] : profiles_json.items()) {
-    const nl::json name_json = profile_json.value("name", nl::json(nullptr));
-    const nl::json type_json = profile_json.value("type", nl::json(nullptr));
-    const nl::json icon_json = profile_json.value("icon", nl::json(nullptr));
-    const nl::json version_json = profile_json.value("lastVersionId", nl::json(nullptr));
-    const nl::json game_path_json = profile_json.value("gameDir", nl::json(nullptr));
-    const nl::json java_path_json = profile_json.value("javaDir", nl::json(nullptr));
-    const nl::json created_time_json = profile_json.value("created", nl::json(nullptr));
-    const nl::json last_used_time_json = profile_json.value("lastUsed", nl::json(nullptr));
-    ProfileData profile_data;
-    profile_data.id = profile_id;
-    if (name_json.is_string()) {
-      profile_data.name_opt = name_json.get<std::string>();
-    }
-    if (type_json.is_string()) {
-      profile_data.type_opt = type_json.get<std::string>();
-    }
-    if (icon_json.is_string()) {
-      profile_data.icon_opt = icon_json.get<std::string>();
-    }
-    if (version_json.is_string()) {
-      profile_data.version_opt = version_json.get<std::string>();
-    }
-    if (game_path_json.is_string()) {
-      profile_data.game_path_opt = game_path_json.get<std::string>();
-    }
-    if (java_path_json.is_string()) {
-      profile_data.java_path_opt = java_path_json.get<std::string>();
-    }
-    if (created_time_json.is_string()) {
-      const std::string created_time_str = created_time_json.get<std::string>();
-      profile_data.created_time_opt = TimeFromString(created_time_json);
-    }
-    if (last_used_time_json.is_string()) {
-      const std::string last_used_time_str = last_used_time_json.get<std::string>();
-      profile_data.last_used_time_opt = TimeFromString(last_used_time_json);
-    }
-    data_->profile_data_map.emplace(profile_id, profile_data);
-  }
-  return true;
+  return Load(false, ec);
 }
 
 std::optional<ProfileData> LauncherProfilesEditor::GetProfile(const std::string& id) const
 {
-  const auto profile_data_iter = data_->profile_data_map.find(id);
-  if (profile_data_iter == data_->profile_data_map.end()) {
+  const ProfileData* profile_data_ptr = data_->profile_store.Find(id);
+  if (profile_data_ptr == nullptr) {
     return std::nullopt;
   }
-  return std::get<1>(*profile_data_iter);
+  return *profile_data_ptr;
 }
 
 std::vector<ProfileData> LauncherProfilesEditor::GetProfiles() const
 {
+  // Already in order, most recently used first
+  const ProfileStore::LastUsedSet& last_used_set = data_->profile_store.GetByLastUsed();
   std::vector<ProfileData> profile_datas;
-  for (const auto& [_, profile_data] : data_->profile_data_map) {
-    profile_datas.push_back(profile_data);
+  profile_datas.reserve(last_used_set.size());
+  for (const ProfileData* profile_data_ptr : last_used_set) {
+    profile_datas.push_back(*profile_data_ptr);
   }
-  // Negate the comparison to reverse the order of the list as we sort
-  const auto last_used_comp = [](const ProfileData& aa, const ProfileData& bb) {
-    if (aa.last_used_time_opt.has_value() && bb.last_used_time_opt.has_value()) {
-      return aa.last_used_time_opt.value() >= bb.last_used_time_opt.value();
-    }
-    else if (!aa.last_used_time_opt.has_value() && bb.last_used_time_opt.has_value()) {
-      return false;
-    }
-    else if (aa.last_used_time_opt.has_value() && !bb.last_used_time_opt.has_value()) {
-      return true;
-    }
-    return aa.id >= bb.id;
-  };
-  std::sort(profile_datas.begin(), profile_datas.end(), last_used_comp);
   return profile_datas;
 }
 
 bool LauncherProfilesEditor::HasProfileWithId(const std::string& id) const
 {
-  const auto profile_data_iter = data_->profile_data_map.find(id);
-  return profile_data_iter != data_->profile_data_map.end();
+  return data_->profile_store.Find(id) != nullptr;
 }
 
 bool LauncherProfilesEditor::HasProfileWithName(const std::string& name) const
 {
-  for (const auto& [_, profile_data] : data_->profile_data_map) {
-    if (profile_data.name_opt.value_or("") == name) {
-      return true;
-    }
-  }
-  return false;
+  return data_->profile_store.HasName(name);
 }
 
 std::string LauncherProfilesEditor::GetNewUniqueId() const
@@ -201,123 +235,542 @@ std::string LauncherProfilesEditor::GetNewUniqueName() const
   return name;
 }
 
-bool LauncherProfilesEditor::PatchForgeProfile(std::error_code* ec)
+bool LauncherProfilesEditor::BeginTransaction(std::error_code* ec)
 {
-  if (!Refresh(ec)) {
+  if (IsInTransaction()) {
+    SetError(ec, Error::LAUNCHER_PROFILES_BAD_TRANSACTION);
     return false;
   }
-  nl::json forge_profile =
-      data_->launcher_profiles_json["profiles"].value("forge", nl::json(nullptr));
-  if (!forge_profile.is_object()) {
-    SetError(ec, Error::LAUNCHER_PROFILES_NO_FORGE_PROFILE);
+  // Held until the commit, so other processes can't sneak in between reading and writing
+  FileLock::Ptr lock_ptr = LockLauncherProfiles(data_->launcher_profiles_path, ec);
+  if (lock_ptr == nullptr) {
     return false;
   }
-  // Add a "lastUsed" time because Forge is lazy and doesn't do this!
-  const auto now_time = std::chrono::system_clock::now() - std::chrono::seconds(1);
-  forge_profile["lastUsed"] = StringFromTime(now_time);
-  nl::json new_launcher_profiles_json = data_->launcher_profiles_json;
-  new_launcher_profiles_json["profiles"]["forge"] = forge_profile;
-  if (!WriteLauncherProfilesJson(data_->launcher_profiles_path, new_launcher_profiles_json, ec)) {
+  if (!Load(true, ec)) {
     return false;
   }
+  data_->transaction_lock_ptr = std::move(lock_ptr);
+  data_->is_staged = false;
+  data_->stage_funcs.clear();
   return true;
 }
 
-bool LauncherProfilesEditor::WriteProfile(const ProfileData& profile_data, std::error_code* ec)
+bool LauncherProfilesEditor::CommitTransaction(std::error_code* ec)
 {
-  if (!Refresh(ec)) {
+  if (!IsInTransaction()) {
+    SetError(ec, Error::LAUNCHER_PROFILES_BAD_TRANSACTION);
     return false;
   }
-  if (!profile_data.name_opt || !profile_data.name_opt || !profile_data.icon_opt
-      || !profile_data.version_opt || !profile_data.game_path_opt) {
-    SetError(ec, Error::LAUNCHER_PROFILES_INVALID_PROFILE);
-    return false;
+  // Nothing staged, nothing to write
+  if (!data_->is_staged) {
+    data_->transaction_lock_ptr = nullptr;
+    return true;
   }
-  if (HasProfileWithId(profile_data.id)) {
-    SetError(ec, Error::LAUNCHER_PROFILES_ID_USED);
+  if (!Restage(ec)) {
     return false;
   }
-  if (HasProfileWithName(profile_data.name_opt.value())) {
-    SetError(ec, Error::LAUNCHER_PROFILES_NAME_USED);
-    return false;
+  const bool is_written = WriteLauncherProfilesJson(data_->launcher_profiles_path,
+                                                    data_->launcher_profiles_json, ec);
+  data_->is_staged = false;
+  if (is_written) {
+    // What was just written is the new cache, no need to read it back
+    data_->file_stamp_opt = GetFileStamp(data_->launcher_profiles_path);
+  }
+  else {
+    // Go back to whatever actually made it to disk
+    data_->file_stamp_opt = std::nullopt;
+    Refresh(nullptr);
+  }
+  data_->transaction_lock_ptr = nullptr;
+  data_->stage_funcs.clear();
+  return is_written;
+}
+
+void LauncherProfilesEditor::AbortTransaction()
+{
+  if (!IsInTransaction()) {
+    return;
+  }
+  if (data_->is_staged) {
+    data_->is_staged = false;
+    data_->file_stamp_opt = std::nullopt;
+    Refresh(nullptr);
+  }
+  data_->transaction_lock_ptr = nullptr;
+  data_->stage_funcs.clear();
+}
+
+bool LauncherProfilesEditor::IsInTransaction() const
+{
+  return data_->transaction_lock_ptr != nullptr;
+}
+
+bool LauncherProfilesEditor::PatchForgeProfile(std::error_code* ec)
+{
+  return Edit(
+      [this](std::error_code* ec) {
+        nl::json forge_profile =
+            data_->launcher_profiles_json["profiles"].value("forge", nl::json(nullptr));
+        if (!forge_profile.is_object()) {
+          SetError(ec, Error::LAUNCHER_PROFILES_NO_FORGE_PROFILE);
+          return false;
+        }
+        // Add a "lastUsed" time because Forge is lazy and doesn't do this!
+        const auto now_time = std::chrono::system_clock::now() - std::chrono::seconds(1);
+        forge_profile["lastUsed"] = StringFromTime(now_time);
+        data_->profile_store.Put(ReadProfileData("forge", forge_profile));
+        data_->launcher_profiles_json["profiles"]["forge"] = std::move(forge_profile);
+        return true;
+      },
+      ec);
+}
+
+bool LauncherProfilesEditor::WriteProfile(const ProfileData& profile_data, std::error_code* ec)
+{
+  return Edit(
+      [this, profile_data](std::error_code* ec) {
+        if (!profile_data.name_opt || !profile_data.name_opt || !profile_data.icon_opt
+            || !profile_data.version_opt || !profile_data.game_path_opt) {
+          SetError(ec, Error::LAUNCHER_PROFILES_INVALID_PROFILE);
+          return false;
+        }
+        if (HasProfileWithId(profile_data.id)) {
+          SetError(ec, Error::LAUNCHER_PROFILES_ID_USED);
+          return false;
+        }
+        if (HasProfileWithName(profile_data.name_opt.value())) {
+          SetError(ec, Error::LAUNCHER_PROFILES_NAME_USED);
+          return false;
+        }
+        // Formatting example (as of format 21):
+        // "mjrianz5n6o0ntue4gvzfu9zi7i8lg4y": {
+        //   "created": "2019-12-12T03:11:18.000Z",
+        //   "gameDir" : "/home/tim/.minecraft/trollauncher/Adakite 58",
+        //   "icon": "TNT",
+        //   "javaDir" : "/usr/lib/jvm/java-8-openjdk-amd64/bin/java",
+        //   "lastUsed": "2019-12-12T03:11:18.000Z",
+        //   "lastVersionId": "1.14.4-forge-28.1.106",
+        //   "name": "Adakite 58",
+        //   "type": "custom"
+        // },
+        const auto now_time = std::chrono::system_clock::now();
+        nl::json profile_json = nl::json::object();
+        profile_json["name"] = profile_data.name_opt.value();
+        profile_json["type"] = profile_data.type_opt.value_or("custom");
+        profile_json["icon"] = profile_data.icon_opt.value();
+        profile_json["lastVersionId"] = profile_data.version_opt.value();
+        profile_json["gameDir"] = profile_data.game_path_opt.value().string();
+        profile_json["created"] = StringFromTime(profile_data.created_time_opt.value_or(now_time));
+        profile_json["lastUsed"] =
+            StringFromTime(profile_data.last_used_time_opt.value_or(now_time));
+        if (profile_data.java_path_opt) {
+          profile_json["javaDir"] = profile_data.java_path_opt.value().string();
+        }
+        data_->profile_store.Put(ReadProfileData(profile_data.id, profile_json));
+        data_->launcher_profiles_json["profiles"][profile_data.id] = std::move(profile_json);
+        return true;
+      },
+      ec);
+}
+
+bool LauncherProfilesEditor::UpdateProfile(const ProfileData& profile_data, std::error_code* ec)
+{
+  return Edit(
+      [this, profile_data](std::error_code* ec) {
+        // Use the original JSON here instead of using "GetProfile", so the new JSON
+        // better preserves whatever it had going on before the updates
+        nl::json profile_json =
+            data_->launcher_profiles_json["profiles"].value(profile_data.id, nl::json(nullptr));
+        if (!profile_json.is_object()) {
+          SetError(ec, Error::LAUNCHER_PROFILES_NO_PROFILE);
+          return false;
+        }
+        const auto now_time = std::chrono::system_clock::now();
+        if (profile_data.name_opt) {
+          profile_json["name"] = profile_data.name_opt.value();
+        }
+        if (profile_data.type_opt) {
+          profile_json["type"] = profile_data.type_opt.value();
+        }
+        if (profile_data.icon_opt) {
+          profile_json["icon"] = profile_data.icon_opt.value();
+        }
+        if (profile_data.version_opt) {
+          profile_json["lastVersionId"] = profile_data.version_opt.value();
+        }
+        if (profile_data.game_path_opt) {
+          profile_json["gameDir"] = profile_data.game_path_opt.value().string();
+        }
+        if (profile_data.java_path_opt) {
+          profile_json["javaDir"] = profile_data.java_path_opt.value().string();
+        }
+        if (profile_data.created_time_opt) {
+          profile_json["created"] = StringFromTime(profile_data.created_time_opt.value());
+        }
+        // Always update the last used time, falling back to the current time
+        profile_json["lastUsed"] =
+            StringFromTime(profile_data.last_used_time_opt.value_or(now_time));
+        data_->profile_store.Put(ReadProfileData(profile_data.id, profile_json));
+        data_->launcher_profiles_json["profiles"][profile_data.id] = std::move(profile_json);
+        return true;
+      },
+      ec);
+}
+
+bool LauncherProfilesEditor::Load(bool with_json, std::error_code* ec)
+{
+  if (data_->is_staged) {
+    // Don't throw away staged edits, they get written over whatever is there anyway
+    return true;
   }
-  // Formatting example (as of format 21):
-  // "mjrianz5n6o0ntue4gvzfu9zi7i8lg4y": {
-  //   "created": "2019-12-12T03:11:18.000Z",
-  //   "gameDir" : "/home/tim/.minecraft/trollauncher/Adakite 58",
-  //   "icon": "TNT",
-  //   "javaDir" : "/usr/lib/jvm/java-8-openjdk-amd64/bin/java",
-  //   "lastUsed": "2019-12-12T03:11:18.000Z",
-  //   "lastVersionId": "1.14.4-forge-28.1.106",
-  //   "name": "Adakite 58",
-  //   "type": "custom"
-  // },
-  const auto now_time = std::chrono::system_clock::now();
-  nl::json profile_json = nl::json::object();
-  profile_json["name"] = profile_data.name_opt.value();
-  profile_json["type"] = profile_data.type_opt.value_or("custom");
-  profile_json["icon"] = profile_data.icon_opt.value();
-  profile_json["lastVersionId"] = profile_data.version_opt.value();
-  profile_json["gameDir"] = profile_data.game_path_opt.value().string();
-  profile_json["created"] = StringFromTime(profile_data.created_time_opt.value_or(now_time));
-  profile_json["lastUsed"] = StringFromTime(profile_data.last_used_time_opt.value_or(now_time));
-  if (profile_data.java_path_opt) {
-    profile_json["javaDir"] = profile_data.java_path_opt.value().string();
-  }
-  nl::json new_launcher_profiles_json = data_->launcher_profiles_json;
-  new_launcher_profiles_json["profiles"][profile_data.id] = profile_json;
-  if (!WriteLauncherProfilesJson(data_->launcher_profiles_path, new_launcher_profiles_json, ec)) {
+  const std::optional<FileStamp> file_stamp_opt = GetFileStamp(data_->launcher_profiles_path);
+  if (data_->file_stamp_opt && file_stamp_opt
+      && data_->file_stamp_opt.value() == file_stamp_opt.value()
+      && (data_->has_json || !with_json)) {
+    // Nobody touched the file since it was last read or written, so skip the parse
+    return true;
+  }
+  data_->launcher_profiles_json = nl::json::object();
+  data_->has_json = false;
+  data_->profile_store.Clear();
+  data_->file_stamp_opt = std::nullopt;
+  if (!file_stamp_opt) {
+    SetError(ec, Error::LAUNCHER_PROFILES_NONEXISTENT);
     return false;
   }
+  std::ifstream launcher_profiles_ifs(data_->launcher_profiles_path);
+  if (with_json) {
+    nl::json new_launcher_profiles_json = nl::json::parse(launcher_profiles_ifs, nullptr, false);
+    if (new_launcher_profiles_json.is_discarded()) {
+      SetError(ec, Error::LAUNCHER_PROFILES_PARSE_FAILED);
+      return false;
+    }
+    data_->launcher_profiles_json = std::move(new_launcher_profiles_json);
+    data_->has_json = true;
+    const nl::json profiles_json =
+        data_->launcher_profiles_json.value("profiles", nl::json::object());
+    for (const auto& [profile_id, profile_json] : profiles_json.items()) {
+      if (profile_json.is_object()) {
+        data_->profile_store.Put(ReadProfileData(profile_id, profile_json));
+      }
+    }
+  }
+  else {
+    ProfilesSaxHandler sax_handler(&data_->profile_store);
+    if (!nl::json::sax_parse(launcher_profiles_ifs, &sax_handler)) {
+      data_->profile_store.Clear();
+      SetError(ec, Error::LAUNCHER_PROFILES_PARSE_FAILED);
+      return false;
+    }
+  }
+  // Stamped from before the read, so a write during the read just means another parse next time
+  data_->file_stamp_opt = file_stamp_opt;
   return true;
 }
 
-bool LauncherProfilesEditor::UpdateProfile(const ProfileData& profile_data, std::error_code* ec)
+bool LauncherProfilesEditor::Edit(const StageFunc& stage_func, std::error_code* ec)
 {
-  if (!Refresh(ec)) {
+  // The stage function only changes anything once it's sure it will succeed
+  if (IsInTransaction()) {
+    if (!Restage(ec) || !stage_func(ec)) {
+      return false;
+    }
+    data_->stage_funcs.push_back(stage_func);
+    data_->is_staged = true;
+    return true;
+  }
+  // Outside of a transaction, every edit gets its own
+  if (!BeginTransaction(ec)) {
     return false;
   }
-  // Use the original JSON here instead of using "GetProfile", so the new JSON
-  // better preserves whatever it had going on before the updates
-  nl::json profile_json =
-      data_->launcher_profiles_json["profiles"].value(profile_data.id, nl::json(nullptr));
-  if (!profile_json.is_object()) {
-    SetError(ec, Error::LAUNCHER_PROFILES_NO_PROFILE);
+  if (!stage_func(ec)) {
+    AbortTransaction();
     return false;
   }
-  const auto now_time = std::chrono::system_clock::now();
-  if (profile_data.name_opt) {
-    profile_json["name"] = profile_data.name_opt.value();
+  data_->stage_funcs.push_back(stage_func);
+  data_->is_staged = true;
+  return CommitTransaction(ec);
+}
+
+bool LauncherProfilesEditor::Restage(std::error_code* ec)
+{
+  // Only something that ignores the lock can have written the file since the transaction began
+  const std::optional<FileStamp> file_stamp_opt = GetFileStamp(data_->launcher_profiles_path);
+  if (data_->file_stamp_opt && file_stamp_opt
+      && data_->file_stamp_opt.value() == file_stamp_opt.value()) {
+    return true;
+  }
+  data_->is_staged = false;
+  data_->file_stamp_opt = std::nullopt;
+  bool is_restaged = Load(true, ec);
+  for (std::size_t ii = 0; is_restaged && ii < data_->stage_funcs.size(); ++ii) {
+    is_restaged = data_->stage_funcs[ii](ec);
+  }
+  if (!is_restaged) {
+    // Whatever got redone is still staged, and the abort throws it away
+    data_->is_staged = true;
+    AbortTransaction();
+    return false;
   }
-  if (profile_data.type_opt) {
-    profile_json["type"] = profile_data.type_opt.value();
+  data_->is_staged = !data_->stage_funcs.empty();
+  return true;
+}
+
+FileLock::Ptr LockLauncherProfiles(const fs::path& launcher_profiles_path, std::error_code* ec)
+{
+  const fs::path lock_path =
+      GetLocksPath(launcher_profiles_path.parent_path()) / "launcher_profiles.lock";
+  FileLock::Ptr lock_ptr = FileLock::Acquire(lock_path);
+  if (lock_ptr == nullptr) {
+    SetError(ec, Error::LAUNCHER_PROFILES_LOCK_FAILED);
   }
-  if (profile_data.icon_opt) {
-    profile_json["icon"] = profile_data.icon_opt.value();
+  return lock_ptr;
+}
+
+namespace {
+
+bool LastUsedGreater::operator()(const ProfileData* aa_ptr, const ProfileData* bb_ptr) const
+{
+  const auto& aa_time_opt = aa_ptr->last_used_time_opt;
+  const auto& bb_time_opt = bb_ptr->last_used_time_opt;
+  if (aa_time_opt.has_value() != bb_time_opt.has_value()) {
+    return aa_time_opt.has_value();
+  }
+  if (aa_time_opt && aa_time_opt.value() != bb_time_opt.value()) {
+    return aa_time_opt.value() > bb_time_opt.value();
+  }
+  return aa_ptr->id > bb_ptr->id;
+}
+
+void ProfileStore::Clear()
+{
+  last_used_set_.clear();
+  name_ids_.clear();
+  profile_data_map_.clear();
+}
+
+void ProfileStore::Put(ProfileData profile_data)
+{
+  const auto profile_data_iter = profile_data_map_.find(profile_data.id);
+  if (profile_data_iter == profile_data_map_.end()) {
+    const std::string profile_id = profile_data.id;
+    const auto [new_iter, _] = profile_data_map_.emplace(profile_id, std::move(profile_data));
+    Index(std::get<1>(*new_iter));
+    return;
+  }
+  // Unindex first, since the set needs the old values to find it
+  Unindex(std::get<1>(*profile_data_iter));
+  std::get<1>(*profile_data_iter) = std::move(profile_data);
+  Index(std::get<1>(*profile_data_iter));
+}
+
+const ProfileData* ProfileStore::Find(const std::string& id) const
+{
+  const auto profile_data_iter = profile_data_map_.find(id);
+  if (profile_data_iter == profile_data_map_.end()) {
+    return nullptr;
   }
-  if (profile_data.version_opt) {
-    profile_json["lastVersionId"] = profile_data.version_opt.value();
+  return &std::get<1>(*profile_data_iter);
+}
+
+bool ProfileStore::HasName(const std::string& name) const
+{
+  return name_ids_.count(name) != 0;
+}
+
+const ProfileStore::LastUsedSet& ProfileStore::GetByLastUsed() const
+{
+  return last_used_set_;
+}
+
+void ProfileStore::Unindex(const ProfileData& profile_data)
+{
+  last_used_set_.erase(&profile_data);
+  // Profiles without a name count as an empty name, like the launcher shows them
+  const auto [begin_iter, end_iter] = name_ids_.equal_range(profile_data.name_opt.value_or(""));
+  for (auto id_iter = begin_iter; id_iter != end_iter; ++id_iter) {
+    if (std::get<1>(*id_iter) == profile_data.id) {
+      name_ids_.erase(id_iter);
+      return;
+    }
+  }
+}
+
+void ProfileStore::Index(const ProfileData& profile_data)
+{
+  last_used_set_.insert(&profile_data);
+  name_ids_.emplace(profile_data.name_opt.value_or(""), profile_data.id);
+}
+
+ProfilesSaxHandler::ProfilesSaxHandler(ProfileStore* profile_store_ptr)
+    : profile_store_ptr_(profile_store_ptr), depth_(0), is_in_profiles_(false)
+{
+  // Do nothing
+}
+
+bool ProfilesSaxHandler::null()
+{
+  return true;
+}
+
+bool ProfilesSaxHandler::boolean(bool)
+{
+  return true;
+}
+
+bool ProfilesSaxHandler::number_integer(nl::json::number_integer_t)
+{
+  return true;
+}
+
+bool ProfilesSaxHandler::number_unsigned(nl::json::number_unsigned_t)
+{
+  return true;
+}
+
+bool ProfilesSaxHandler::number_float(nl::json::number_float_t, const std::string&)
+{
+  return true;
+}
+
+bool ProfilesSaxHandler::string(std::string& val)
+{
+  if (depth_ == 3 && profile_data_opt_) {
+    SetProfileField(&profile_data_opt_.value(), key_, std::move(val));
   }
-  if (profile_data.game_path_opt) {
-    profile_json["gameDir"] = profile_data.game_path_opt.value().string();
+  return true;
+}
+
+template <typename BinaryType>
+bool ProfilesSaxHandler::binary(BinaryType&)
+{
+  return true;
+}
+
+bool ProfilesSaxHandler::start_object(std::size_t)
+{
+  ++depth_;
+  if (depth_ == 2 && key_ == "profiles") {
+    is_in_profiles_ = true;
   }
-  if (profile_data.java_path_opt) {
-    profile_json["javaDir"] = profile_data.java_path_opt.value().string();
+  else if (depth_ == 3 && is_in_profiles_) {
+    profile_data_opt_ = ProfileData();
+    profile_data_opt_->id = key_;
   }
-  if (profile_data.created_time_opt) {
-    profile_json["created"] = StringFromTime(profile_data.created_time_opt.value());
+  return true;
+}
+
+bool ProfilesSaxHandler::key(std::string& val)
+{
+  key_ = std::move(val);
+  return true;
+}
+
+bool ProfilesSaxHandler::end_object()
+{
+  if (depth_ == 3 && profile_data_opt_) {
+    // Last one wins, same as the full parse
+    profile_store_ptr_->Put(std::move(profile_data_opt_.value()));
+    profile_data_opt_ = std::nullopt;
   }
-  // Always update the last used time, falling back to the current time
-  profile_json["lastUsed"] = StringFromTime(profile_data.last_used_time_opt.value_or(now_time));
-  nl::json new_launcher_profiles_json = data_->launcher_profiles_json;
-  new_launcher_profiles_json["profiles"][profile_data.id] = profile_json;
-  if (!WriteLauncherProfilesJson(data_->launcher_profiles_path, new_launcher_profiles_json, ec)) {
-    return false;
+  else if (depth_ == 2) {
+    is_in_profiles_ = false;
   }
+  --depth_;
   return true;
 }
 
-namespace {
+bool ProfilesSaxHandler::start_array(std::size_t)
+{
+  ++depth_;
+  return true;
+}
+
+bool ProfilesSaxHandler::end_array()
+{
+  --depth_;
+  return true;
+}
+
+bool ProfilesSaxHandler::parse_error(std::size_t, const std::string&,
+                                     const nl::detail::exception&)
+{
+  return false;
+}
+
+bool FileStamp::operator==(const FileStamp& other) const
+{
+  return write_time == other.write_time && size == other.size && device == other.device
+         && inode == other.inode;
+}
+
+std::optional<FileStamp> GetFileStamp(const fs::path& path)
+{
+  std::error_code fs_ec;
+  FileStamp file_stamp;
+  file_stamp.write_time = fs::last_write_time(path, fs_ec);
+  if (fs_ec) {
+    return std::nullopt;
+  }
+  file_stamp.size = fs::file_size(path, fs_ec);
+  if (fs_ec) {
+    return std::nullopt;
+  }
+  file_stamp.device = 0;
+  file_stamp.inode = 0;
+#if ITS_A_UNIX_SYSTEM
+  struct stat path_stat;
+  if (stat(path.c_str(), &path_stat) != 0) {
+    return std::nullopt;
+  }
+  file_stamp.device = path_stat.st_dev;
+  file_stamp.inode = path_stat.st_ino;
+#endif
+  return file_stamp;
+}
+
+ProfileData ReadProfileData(const std::string& profile_id, const nl::json& profile_json)
+{
+  ProfileData profile_data;
+  profile_data.id = profile_id;
+  if (!profile_json.is_object()) {
+    return profile_data;
+  }
+  for (const auto& [key, val_json] : profile_json.items()) {
+    if (val_json.is_string()) {
+      SetProfileField(&profile_data, key, val_json.get<std::string>());
+    }
+  }
+  return profile_data;
+}
+
+void SetProfileField(ProfileData* profile_data_ptr, const std::string& key, std::string val)
+{
+  if (key == "name") {
+    profile_data_ptr->name_opt = std::move(val);
+  }
+  else if (key == "type") {
+    profile_data_ptr->type_opt = std::move(val);
+  }
+  else if (key == "icon") {
+    profile_data_ptr->icon_opt = std::move(val);
+  }
+  else if (key == "lastVersionId") {
+    profile_data_ptr->version_opt = std::move(val);
+  }
+  else if (key == "gameDir") {
+    profile_data_ptr->game_path_opt = std::move(val);
+  }
+  else if (key == "javaDir") {
+    profile_data_ptr->java_path_opt = std::move(val);
+  }
+  else if (key == "created") {
+    profile_data_ptr->created_time_opt = TimeFromString(val);
+  }
+  else if (key == "lastUsed") {
+    profile_data_ptr->last_used_time_opt = TimeFromString(val);
+  }
+}
 
 bool IsFileWritable(const fs::path& path)
 {
@@ -334,6 +787,96 @@ fs::path AddFilenamePrefix(const fs::path& path, const std::string& prefix)
   return fs::path(path).replace_filename(new_filename);
 }
 
+fs::path GetBackupPath(const fs::path& launcher_profiles_path, int backup_index)
+{
+  fs::path backup_lp_path = AddFilenamePrefix(launcher_profiles_path, "backup_");
+  if (backup_index != 0) {
+    backup_lp_path += "." + std::to_string(backup_index);
+  }
+  return backup_lp_path;
+}
+
+bool IsFileContent(const fs::path& path, const std::string& content)
+{
+  // Usually the size is different, so there's no need to read anything
+  std::error_code fs_ec;
+  const std::uintmax_t file_size = fs::file_size(path, fs_ec);
+  if (fs_ec || file_size != content.size()) {
+    return false;
+  }
+  std::ifstream file(path, std::ios::binary);
+  std::string file_content(content.size(), '\0');
+  file.read(file_content.data(), static_cast<std::streamsize>(file_content.size()));
+  return file.good() && file_content == content;
+}
+
+bool WriteFileSynced(const fs::path& path, const std::string& content)
+{
+#if ITS_A_UNIX_SYSTEM
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  std::size_t num_written = 0;
+  while (num_written < content.size()) {
+    const ssize_t num_write =
+        ::write(fd, content.data() + num_written, content.size() - num_written);
+    if (num_write < 0 && errno == EINTR) {
+      continue;
+    }
+    if (num_write <= 0) {
+      break;
+    }
+    num_written += static_cast<std::size_t>(num_write);
+  }
+  // Make sure it's all on disk before it gets renamed over the original
+  const bool sync_ok = (num_written == content.size() && ::fsync(fd) == 0);
+  const bool close_ok = (::close(fd) == 0);
+  return sync_ok && close_ok;
+#else
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(content.data(), static_cast<std::streamsize>(content.size()));
+  file.flush();
+  return file.good();
+#endif
+}
+
+void SyncDir(const fs::path& dir_path)
+{
+#if ITS_A_UNIX_SYSTEM
+  // So the rename itself survives a crash, not just the contents
+  const int dir_fd = ::open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+#else
+  (void) dir_path;
+#endif
+}
+
+bool RotateBackups(const fs::path& launcher_profiles_path)
+{
+  // Shift the old backups down, dropping the oldest. Missing ones are fine.
+  std::error_code fs_ec;
+  fs::remove(GetBackupPath(launcher_profiles_path, NUM_LAUNCHER_PROFILES_BACKUPS - 1), fs_ec);
+  for (int ii = NUM_LAUNCHER_PROFILES_BACKUPS - 1; ii > 0; --ii) {
+    fs::rename(GetBackupPath(launcher_profiles_path, ii - 1),
+               GetBackupPath(launcher_profiles_path, ii), fs_ec);
+  }
+  // The original is about to be replaced by a rename, not written to, so the newest backup can
+  // just be a hard link to it
+  const fs::path backup_lp_path = GetBackupPath(launcher_profiles_path, 0);
+  fs::remove(backup_lp_path, fs_ec);
+  fs::create_hard_link(launcher_profiles_path, backup_lp_path, fs_ec);
+  if (fs_ec) {
+    fs_ec.clear();
+    fs::copy_file(launcher_profiles_path, backup_lp_path, fs::copy_options::overwrite_existing,
+                  fs_ec);
+  }
+  return !fs_ec;
+}
+
 bool WriteLauncherProfilesJson(const fs::path& launcher_profiles_path,
                                const nl::json& new_launcher_profiles_json, std::error_code* ec)
 {
@@ -343,36 +886,40 @@ bool WriteLauncherProfilesJson(const fs::path& launcher_profiles_path,
   }
   const std::string new_launcher_profiles_txt =
       new_launcher_profiles_json.dump(2, ' ', false, nl::json::error_handler_t::replace);
+  // Nothing actually changed, so don't write, and don't push a good backup out of the rotation
+  if (IsFileContent(launcher_profiles_path, new_launcher_profiles_txt)) {
+    return true;
+  }
   const fs::path orig_lp_path = launcher_profiles_path;
-  const fs::path backup_lp_path = AddFilenamePrefix(orig_lp_path, "backup_");
   const fs::path new_lp_path = AddFilenamePrefix(orig_lp_path, "new_");
   std::error_code fs_ec;
-  if (!ITS_A_UNIX_SYSTEM) {
-    // Apparently overwrite doesn't work on Windoze!
-    fs::remove(backup_lp_path, fs_ec);
+  if (!WriteFileSynced(new_lp_path, new_launcher_profiles_txt)) {
+    fs::remove(new_lp_path, fs_ec);
+    SetError(ec, Error::LAUNCHER_PROFILES_WRITE_FAILED);
+    return false;
   }
-  fs::copy_file(orig_lp_path, backup_lp_path, fs::copy_options::overwrite_existing, fs_ec);
-  if (fs_ec) {
+  if (!RotateBackups(orig_lp_path)) {
+    fs::remove(new_lp_path, fs_ec);
     SetError(ec, Error::LAUNCHER_PROFILES_BACKUP_FAILED);
     return false;
   }
-  std::ofstream new_launcher_profiles_file(new_lp_path);
-  if (!new_launcher_profiles_file.good()) {
-    SetError(ec, Error::LAUNCHER_PROFILES_WRITE_FAILED);
-    return false;
+  // Keep whatever permissions the launcher gave the original
+  const fs::file_status orig_lp_status = fs::status(orig_lp_path, fs_ec);
+  if (!fs_ec) {
+    fs::permissions(new_lp_path, orig_lp_status.permissions(), fs_ec);
   }
-  new_launcher_profiles_file << new_launcher_profiles_txt;
-  new_launcher_profiles_file.close();
   if (!ITS_A_UNIX_SYSTEM) {
-    // Apparently overwrite doesn't work on Windoze!
+    // Apparently overwrite doesn't work on Windoze! The backup is already there, at least.
     fs::remove(orig_lp_path, fs_ec);
   }
-  fs::copy_file(new_lp_path, orig_lp_path, fs::copy_options::overwrite_existing, fs_ec);
+  // Readers see either the old file or the new one, never anything in between
+  fs::rename(new_lp_path, orig_lp_path, fs_ec);
   if (fs_ec) {
+    fs::remove(new_lp_path, fs_ec);
     SetError(ec, Error::LAUNCHER_PROFILES_WRITE_FAILED);
     return false;
   }
-  fs::remove(new_lp_path, fs_ec);
+  SyncDir(orig_lp_path.parent_path());
   return true;
 }
 
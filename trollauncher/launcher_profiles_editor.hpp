@@ -20,10 +20,13 @@
 #define TROLLAUNCHER_LAUCHER_PROFILES_EDITOR_HPP_
 
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <system_error>
+#include <vector>
 
+#include "trollauncher/file_lock.hpp"
 #include "trollauncher/profile_data.hpp"
 
 namespace tl {
@@ -37,6 +40,7 @@ class LauncherProfilesEditor final {
   bool Refresh(std::error_code* ec);
 
   std::optional<ProfileData> GetProfile(const std::string& id) const;
+  // Sorted by last used time, most recent first
   std::vector<ProfileData> GetProfiles() const;
 
   bool HasProfileWithId(const std::string& id) const;
@@ -45,6 +49,16 @@ class LauncherProfilesEditor final {
   std::string GetNewUniqueId() const;
   std::string GetNewUniqueName() const;
 
+  // Edits made during a transaction are only staged, and the commit writes them all at once. The
+  // file stays locked for the whole transaction. Outside of one, every edit is written right away.
+  // If something that ignores the lock (e.g., the Forge installer) writes the file in the middle
+  // of a transaction, the staged edits are redone on top of what it wrote, and if they don't
+  // apply anymore, the whole transaction is aborted.
+  bool BeginTransaction(std::error_code* ec);
+  bool CommitTransaction(std::error_code* ec);
+  void AbortTransaction();
+  bool IsInTransaction() const;
+
   bool PatchForgeProfile(std::error_code* ec);
   bool WriteProfile(const ProfileData& profile_data, std::error_code* ec);
   bool UpdateProfile(const ProfileData& profile_data, std::error_code* ec);
@@ -52,10 +66,20 @@ class LauncherProfilesEditor final {
  private:
   LauncherProfilesEditor();
 
+  using StageFunc = std::function<bool(std::error_code*)>;
+
+  bool Load(bool with_json, std::error_code* ec);
+  bool Edit(const StageFunc& stage_func, std::error_code* ec);
+  bool Restage(std::error_code* ec);
+
   struct Data_;
   std::unique_ptr<Data_> data_;
 };
 
+// Anything else that writes the file (e.g., the Forge installer) should hold this while it does
+FileLock::Ptr LockLauncherProfiles(const std::filesystem::path& launcher_profiles_path,
+                                   std::error_code* ec);
+
 }  // namespace tl
 
 #endif  // TROLLAUNCHER_LAUCHER_PROFILES_EDITOR_HPP_
@@ -0,0 +1,176 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/modpack_index.hpp"
+
+#include <cstdio>
+#include <unordered_map>
+
+#include "trollauncher/error_codes.hpp"
+#include "trollauncher/hashing.hpp"
+#include "trollauncher/zip_utils.hpp"
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+bool IsDirectoryName(std::string_view name);
+std::optional<std::string> FindTopLevelDirectory(
+    const std::vector<ZipCentralEntry>& central_entries);
+std::string ComputePackHash(const std::vector<ZipCentralEntry>& central_entries);
+
+}  // namespace
+
+struct ModpackIndex::Data_ {
+  std::size_t num_zip_entries;
+  std::string pack_hash;
+  std::optional<std::string> tl_dir_opt;
+  std::vector<ModpackEntry> entries;
+  std::unordered_map<std::string_view, std::size_t> entry_path_map;
+};
+
+ModpackIndex::ModpackIndex() : data_(std::make_unique<ModpackIndex::Data_>())
+{
+  // Do nothing
+}
+
+ModpackIndex::Ptr ModpackIndex::Create(const fs::path& modpack_path, std::error_code* ec)
+{
+  const std::optional<std::vector<ZipCentralEntry>> central_entries_opt =
+      ReadZipCentralDirectory(modpack_path);
+  if (!central_entries_opt) {
+    SetError(ec, Error::MODPACK_INDEX_FAILED);
+    return nullptr;
+  }
+  const std::vector<ZipCentralEntry>& central_entries = central_entries_opt.value();
+  std::optional<std::string> tl_dir_opt = FindTopLevelDirectory(central_entries);
+  const std::size_t strip_length = (tl_dir_opt ? tl_dir_opt.value().size() + 1 : 0);
+  auto mpi_ptr = Ptr(new ModpackIndex());
+  std::vector<ModpackEntry>& entries = mpi_ptr->data_->entries;
+  entries.reserve(central_entries.size());
+  for (std::size_t ii = 0; ii < central_entries.size(); ++ii) {
+    const ZipCentralEntry& central_entry = central_entries.at(ii);
+    if (IsDirectoryName(central_entry.name)) {
+      continue;
+    }
+    ModpackEntry entry;
+    entry.path = central_entry.name.substr(strip_length);
+    entry.zip_index = ii;
+    entry.size = central_entry.uncompressed_size;
+    entry.compressed_size = central_entry.compressed_size;
+    entry.local_header_offset = central_entry.local_header_offset;
+    entry.crc = central_entry.crc;
+    entry.method = central_entry.method;
+    entry.is_stored = StoredEntryCopier::CanCopy(central_entry);
+    entries.push_back(std::move(entry));
+  }
+  // Only build the map once the entries are done moving around, since it refers into them
+  for (std::size_t ii = 0; ii < entries.size(); ++ii) {
+    mpi_ptr->data_->entry_path_map.emplace(entries.at(ii).path, ii);
+  }
+  mpi_ptr->data_->num_zip_entries = central_entries.size();
+  mpi_ptr->data_->pack_hash = ComputePackHash(central_entries);
+  mpi_ptr->data_->tl_dir_opt = std::move(tl_dir_opt);
+  return mpi_ptr;
+}
+
+std::size_t ModpackIndex::GetNumZipEntries() const
+{
+  return data_->num_zip_entries;
+}
+
+const std::string& ModpackIndex::GetPackHash() const
+{
+  return data_->pack_hash;
+}
+
+const std::optional<std::string>& ModpackIndex::GetTopLevelDirectory() const
+{
+  return data_->tl_dir_opt;
+}
+
+const std::vector<ModpackEntry>& ModpackIndex::GetEntries() const
+{
+  return data_->entries;
+}
+
+const ModpackEntry* ModpackIndex::FindEntry(std::string_view path) const
+{
+  const auto entry_iter = data_->entry_path_map.find(path);
+  if (entry_iter == data_->entry_path_map.end()) {
+    return nullptr;
+  }
+  return &data_->entries.at(std::get<1>(*entry_iter));
+}
+
+namespace {
+
+bool IsDirectoryName(std::string_view name)
+{
+  return !name.empty() && name.back() == '/';
+}
+
+std::optional<std::string> FindTopLevelDirectory(
+    const std::vector<ZipCentralEntry>& central_entries)
+{
+  if (central_entries.empty()) {
+    return std::nullopt;
+  }
+  const std::string& first_name = central_entries.front().name;
+  const std::size_t first_slash_pos = first_name.find('/');
+  if (first_slash_pos == std::string::npos || first_slash_pos == 0) {
+    return std::nullopt;
+  }
+  const std::string maybe_tl_dir = first_name.substr(0, first_slash_pos);
+  if (maybe_tl_dir == "mods" || maybe_tl_dir == "config" || maybe_tl_dir == "trollauncher") {
+    return std::nullopt;
+  }
+  for (const ZipCentralEntry& central_entry : central_entries) {
+    if (IsDirectoryName(central_entry.name)) {
+      continue;
+    }
+    const std::string& name = central_entry.name;
+    if (name.size() <= maybe_tl_dir.size()
+        || name.compare(0, maybe_tl_dir.size(), maybe_tl_dir) != 0
+        || name.at(maybe_tl_dir.size()) != '/') {
+      return std::nullopt;
+    }
+  }
+  return maybe_tl_dir;
+}
+
+std::string ComputePackHash(const std::vector<ZipCentralEntry>& central_entries)
+{
+  // The CRCs already cover the contents, so there's no need to read any file data
+  std::uint32_t crc = 0;
+  for (const ZipCentralEntry& central_entry : central_entries) {
+    const std::uint64_t numbers[] = {central_entry.uncompressed_size, central_entry.crc};
+    crc = Crc32Update(crc, central_entry.name.data(), central_entry.name.size() + 1);
+    crc = Crc32Update(crc, numbers, sizeof(numbers));
+  }
+  char pack_hash_buf[32];
+  std::snprintf(pack_hash_buf, sizeof(pack_hash_buf), "%08x-%zu", static_cast<unsigned int>(crc),
+                central_entries.size());
+  return pack_hash_buf;
+}
+
+}  // namespace
+
+}  // namespace tl
@@ -0,0 +1,75 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_MODPACK_INDEX_HPP_
+#define TROLLAUNCHER_MODPACK_INDEX_HPP_
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace tl {
+
+/**
+ * A file in the modpack. The path is relative to the modpack root (i.e., with any top-level
+ * directory already stripped) and uses forward slashes, so it can be given directly to the keeplist
+ * processor. The zip index is the index Libzip uses for the entry.
+ */
+struct ModpackEntry {
+  std::string path;
+  std::uint64_t zip_index;
+  std::uint64_t size;
+  std::uint64_t compressed_size;
+  std::uint64_t local_header_offset;
+  std::uint32_t crc;
+  std::uint16_t method;
+  bool is_stored;
+};
+
+/**
+ * An index of all the files in a modpack zip file, built in one pass over the central directory.
+ * Directory entries are not included. The pack hash identifies the contents of the modpack, and is
+ * made from the names, sizes, and CRCs of all the zip entries.
+ */
+class ModpackIndex final {
+ public:
+  using Ptr = std::shared_ptr<ModpackIndex>;
+
+  static Ptr Create(const std::filesystem::path& modpack_path, std::error_code* ec);
+
+  std::size_t GetNumZipEntries() const;
+  const std::string& GetPackHash() const;
+  const std::optional<std::string>& GetTopLevelDirectory() const;
+  const std::vector<ModpackEntry>& GetEntries() const;
+  const ModpackEntry* FindEntry(std::string_view path) const;
+
+ private:
+  ModpackIndex();
+
+  struct Data_;
+  std::unique_ptr<Data_> data_;
+};
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_MODPACK_INDEX_HPP_
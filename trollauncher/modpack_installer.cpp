@@ -18,18 +18,36 @@
 
 #include "trollauncher/modpack_installer.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
-#include <numeric>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <libzippp.h>
 #include <nlohmann/json.hpp>
 
+#include "trollauncher/backup_creator.hpp"
+#include "trollauncher/backup_pruner.hpp"
 #include "trollauncher/error_codes.hpp"
+#include "trollauncher/file_lock.hpp"
+#include "trollauncher/file_remover.hpp"
 #include "trollauncher/forge_installer.hpp"
+#include "trollauncher/install_manifest.hpp"
 #include "trollauncher/java_detector.hpp"
 #include "trollauncher/keeplist_processor.hpp"
 #include "trollauncher/launcher_profiles_editor.hpp"
+#include "trollauncher/modpack_index.hpp"
+#include "trollauncher/update_planner.hpp"
 #include "trollauncher/utils.hpp"
+#include "trollauncher/worker_pool.hpp"
+#include "trollauncher/zip_utils.hpp"
 
 #ifndef ITS_A_UNIX_SYSTEM
 #ifndef _WIN32
@@ -39,6 +57,13 @@
 #endif
 #endif
 
+#if ITS_A_UNIX_SYSTEM
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace tl {
 
 namespace {
@@ -47,6 +72,9 @@ namespace fs = std::filesystem;
 namespace nl = nlohmann;
 namespace zpp = libzippp;
 
+// Nothing should take this long, so anything older was left behind by a crash
+constexpr auto STALE_TEMP_DIR_AGE = std::chrono::hours(24);
+
 using PercentProgressFunc = std::function<void(std::size_t)>;
 
 class ModpackInstallerProgresser {
@@ -58,7 +86,9 @@ class ModpackInstallerProgresser {
 
   void PrepInstallProgress();
   void InstallForgeProgress();
-  void ExtractModpackProgress(std::size_t percent);
+  // Forge installs in the background while the modpack is extracted
+  void ExtractModpackProgress(std::size_t percent, std::optional<std::size_t> forge_percent_opt);
+  void FinishForgeProgress(std::size_t forge_percent);
   void WriteProfileProgress();
   void Done();
 
@@ -74,11 +104,9 @@ class ModpackUpdaterProgresser {
   // once at 0%. Calling the next function assumes 100% of the last stage.
 
   void PrepInstallProgress();
-  void InstallForgeProgress();
+  void InstallForgeProgress(std::size_t percent);
   void ProcessKeeplistProgress();
-  void BackupProgress(std::size_t percent);
-  void RemoveOutdatedProgress(std::size_t percent);
-  void ExtractModpackProgress(std::size_t percent);
+  void UpdateFilesProgress(std::size_t percent);
   void UpdateProfileProgress();
   void Done();
 
@@ -91,36 +119,79 @@ class PercentProgresser {
   PercentProgresser(const PercentProgressFunc& progress_func, std::size_t num_total);
   void Tick();
 
+  // Ticking quietly is safe from any thread, but only counts. The progress function is only called
+  // from "Report", so worker threads can tick while the calling thread reports.
+
+  void TickQuietly();
+  void Report();
+
  private:
   PercentProgressFunc progress_func_;
   std::size_t num_total_;
-  std::size_t num_ticked_;
+  std::atomic<std::size_t> num_ticked_;
+  std::mutex report_mutex_;
   std::size_t last_percent_;
 };
 
+// Lets threads wait for a path to be ready, or for everything to fail
+class PathGate {
+ public:
+  PathGate(std::size_t num_paths);
+  void Open(std::size_t path_index);
+  void Fail();
+  bool Wait(std::size_t path_index);
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_var_;
+  std::vector<bool> is_opens_;
+  bool is_failed_;
+};
+
+enum class ExtractAction { EXTRACT, SKIP, ABORT };
+using BeforeExtractFunc = std::function<ExtractAction(const ModpackEntry& entry)>;
+
 std::size_t PercentInterp(std::size_t percent, std::size_t low, std::size_t high);
 std::optional<fs::path> GetDefaultDotMinecraftPath();
 fs::path GetDefaultInstallPath(const fs::path& dot_minecraft_path, const std::string& name);
 bool ProfileLooksLikeAnInstall(const ProfileData& profile_data);
 bool ProfilePathLooksLikeAnInstall(const fs::path& profile_path);
-std::optional<std::vector<fs::path>> GetDirFilePaths(const fs::path& dir_path);
-std::optional<fs::path> GetTopLevelDirectory(zpp::ZipArchive* zip_ptr);
-fs::path StripPrefix(const fs::path& orig_path, const fs::path& prefix_path);
-bool ExtractOne(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
-                const std::optional<fs::path>& add_prefix_opt, const fs::path& entry_path);
-bool ExtractAll(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
-                const std::optional<fs::path>& strip_prefix_opt,
-                const PercentProgressFunc& progress_func);
-bool ExtractOverwrites(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
-                       const std::optional<fs::path>& strip_prefix_opt,
-                       const KeeplistProcessor::Ptr& klp_ptr,
-                       const PercentProgressFunc& progress_func);
-fs::path GetBackupZipPath(const fs::path& dot_minecraft_path, const std::string& id);
-bool CreateBackupZipFile(const fs::path& backup_path, const fs::path& profile_path,
-                         const std::vector<fs::path>& overwrite_paths,
-                         const PercentProgressFunc& progress_func);
-void RemoveOutdatedFiles(const fs::path& profile_path, const std::vector<fs::path>& overwrite_paths,
-                         const PercentProgressFunc& progress_func);
+std::optional<std::vector<fs::path>> GetDirFilePaths(const fs::path& dir_path,
+                                                     const KeeplistProcessor::Ptr& klp_ptr);
+std::vector<fs::path> GetManifestFilePaths(const fs::path& profile_path,
+                                           const InstallManifest::Ptr& im_ptr,
+                                           const ModpackIndex::Ptr& mpi_ptr,
+                                           const KeeplistProcessor::Ptr& klp_ptr);
+ModpackIndex::Ptr CreateModpackIndex(const fs::path& modpack_path,
+                                     const zpp::ZipArchive* zip_ptr, std::error_code* ec);
+bool ExtractEntry(const zpp::ZipArchive* zip_ptr, const zpp::ZipEntry& zip_entry,
+                  const fs::path& dest_path);
+std::optional<std::string> ReadOne(const zpp::ZipArchive* zip_ptr,
+                                   const ModpackIndex::Ptr& mpi_ptr, const std::string& entry_path);
+ForgeInstaller::Ptr PrepForgeInstaller(const zpp::ZipArchive* zip_ptr,
+                                       const ModpackIndex::Ptr& mpi_ptr,
+                                       const fs::path& dot_minecraft_path, std::error_code* ec);
+bool InstallForge(const ForgeInstaller::Ptr& fi_ptr, const LauncherProfilesEditor::Ptr& lpe_ptr,
+                  const fs::path& dot_minecraft_path, std::size_t num_jobs,
+                  const ForgeProgressFunc& progress_func, std::error_code* ec);
+bool WriteProfiles(const LauncherProfilesEditor::Ptr& lpe_ptr, bool is_forge_new,
+                   const std::function<bool()>& edit_func, std::error_code* ec);
+bool IsForgeVerified(const ForgeInstaller::Ptr& fi_ptr, std::size_t num_jobs);
+bool ExtractAll(const fs::path& modpack_path, const zpp::ZipArchive* zip_ptr,
+                const ModpackIndex::Ptr& mpi_ptr, const fs::path& extract_path,
+                std::size_t num_jobs, const PercentProgressFunc& progress_func);
+bool ExtractEntries(const fs::path& modpack_path, const zpp::ZipArchive* zip_ptr,
+                    const std::vector<const ModpackEntry*>& entry_ptrs,
+                    const fs::path& extract_path, std::size_t num_jobs,
+                    PercentProgresser* progresser_ptr, const BeforeExtractFunc& before_func);
+bool UpdateProfileFiles(const fs::path& modpack_path, const zpp::ZipArchive* zip_ptr,
+                        const UpdatePlan& update_plan, const fs::path& profile_path,
+                        BackupMethod backup_method, const fs::path& backups_path,
+                        std::size_t num_jobs, const PercentProgressFunc& progress_func,
+                        std::optional<BackupStats>* backup_stats_opt_ptr, std::error_code* ec);
+std::string ToLowerAscii(std::string str);
+void WriteInstallManifest(const fs::path& profile_path, const ModpackIndex::Ptr& mpi_ptr,
+                          const KeeplistProcessor::Ptr& klp_ptr);
 
 }  // namespace
 
@@ -152,13 +223,33 @@ std::vector<ProfileData> GetInstalledProfiles(const fs::path& dot_minecraft_path
   return installed_profiles;
 }
 
+std::optional<PruneStats> PruneInstalledBackups(const BackupRetention& retention,
+                                                std::size_t num_jobs, std::error_code* ec)
+{
+  std::optional<fs::path> dot_minecraft_path_opt = GetDefaultDotMinecraftPath();
+  if (!dot_minecraft_path_opt) {
+    SetError(ec, Error::DOT_MINECRAFT_NO_DEFAULT);
+    return std::nullopt;
+  }
+  const std::optional<PruneStats> prune_stats_opt =
+      PruneBackups(GetBackupsPath(dot_minecraft_path_opt.value()), retention, num_jobs);
+  if (!prune_stats_opt) {
+    SetError(ec, Error::PROFILE_BACKUP_PRUNE_FAILED);
+    return std::nullopt;
+  }
+  return prune_stats_opt;
+}
+
 struct ModpackInstaller::Data_ {
   fs::path modpack_path;
   fs::path dot_minecraft_path;
   LauncherProfilesEditor::Ptr lpe_ptr;
   std::unique_ptr<zpp::ZipArchive> zip_ptr;
+  ModpackIndex::Ptr mpi_ptr;
   bool is_prepped;
   ForgeInstaller::Ptr fi_ptr;
+  std::size_t num_jobs;
+  ForgeInstallOptions forge_install_options;
 };
 
 ModpackInstaller::ModpackInstaller() : data_(std::make_unique<ModpackInstaller::Data_>())
@@ -179,6 +270,19 @@ ModpackInstaller::Ptr ModpackInstaller::Create(const fs::path& modpack_path, std
 ModpackInstaller::Ptr ModpackInstaller::Create(const fs::path& modpack_path,
                                                const fs::path& dot_minecraft_path,
                                                std::error_code* ec)
+{
+  const fs::path launcher_profiles_path = dot_minecraft_path / "launcher_profiles.json";
+  auto lpe_ptr = LauncherProfilesEditor::Create(launcher_profiles_path, ec);
+  if (lpe_ptr == nullptr) {
+    return nullptr;
+  }
+  return Create(modpack_path, dot_minecraft_path, lpe_ptr, ec);
+}
+
+ModpackInstaller::Ptr ModpackInstaller::Create(const fs::path& modpack_path,
+                                               const fs::path& dot_minecraft_path,
+                                               const LauncherProfilesEditor::Ptr& lpe_ptr,
+                                               std::error_code* ec)
 {
   if (!fs::exists(modpack_path)) {
     SetError(ec, Error::MODPACK_NONEXISTENT);
@@ -194,21 +298,33 @@ ModpackInstaller::Ptr ModpackInstaller::Create(const fs::path& modpack_path,
     SetError(ec, Error::MODPACK_ZIP_OPEN_FAILED);
     return nullptr;
   }
-  const fs::path launcher_profiles_path = dot_minecraft_path / "launcher_profiles.json";
-  auto lpe_ptr = LauncherProfilesEditor::Create(launcher_profiles_path, ec);
-  if (lpe_ptr == nullptr) {
+  auto mpi_ptr = CreateModpackIndex(modpack_path, zip_ptr.get(), ec);
+  if (mpi_ptr == nullptr) {
     return nullptr;
   }
   auto mi_ptr = Ptr(new ModpackInstaller());
   mi_ptr->data_->modpack_path = modpack_path;
   mi_ptr->data_->dot_minecraft_path = dot_minecraft_path;
-  mi_ptr->data_->lpe_ptr = std::move(lpe_ptr);
+  mi_ptr->data_->lpe_ptr = lpe_ptr;
   mi_ptr->data_->zip_ptr = std::move(zip_ptr);
+  mi_ptr->data_->mpi_ptr = std::move(mpi_ptr);
   mi_ptr->data_->is_prepped = false;
   mi_ptr->data_->fi_ptr = nullptr;
+  mi_ptr->data_->num_jobs = GetDefaultNumJobs();
+  mi_ptr->data_->forge_install_options = GetDefaultForgeInstallOptions();
   return mi_ptr;
 }
 
+void ModpackInstaller::SetNumJobs(std::size_t num_jobs)
+{
+  data_->num_jobs = std::max<std::size_t>(num_jobs, 1);
+}
+
+void ModpackInstaller::SetForgeInstallOptions(const ForgeInstallOptions& forge_install_options)
+{
+  data_->forge_install_options = forge_install_options;
+}
+
 std::string ModpackInstaller::GetUniqueProfileName() const
 {
   return data_->lpe_ptr->GetNewUniqueName();
@@ -221,19 +337,8 @@ std::string ModpackInstaller::GetRandomProfileIcon() const
 
 bool ModpackInstaller::PrepInstaller(std::error_code* ec)
 {
-  std::optional<fs::path> temp_path_opt = CreateTempDir();
-  if (!temp_path_opt) {
-    SetError(ec, Error::MODPACK_PREP_INSTALL_TEMPDIR_FAILED);
-    return false;
-  }
-  const fs::path& temp_path = temp_path_opt.value();
-  const std::optional<fs::path> tl_dir_opt = GetTopLevelDirectory(data_->zip_ptr.get());
-  if (!ExtractOne(data_->zip_ptr.get(), temp_path, tl_dir_opt, "trollauncher/installer.jar")) {
-    SetError(ec, Error::MODPACK_PREP_INSTALL_UNZIP_FAILED);
-    return false;
-  }
-  const fs::path forge_installer_path = temp_path / "trollauncher" / "installer.jar";
-  auto fi_ptr = ForgeInstaller::Create(forge_installer_path, data_->dot_minecraft_path, ec);
+  auto fi_ptr =
+      PrepForgeInstaller(data_->zip_ptr.get(), data_->mpi_ptr, data_->dot_minecraft_path, ec);
   if (fi_ptr == nullptr) {
     return false;
   }
@@ -285,22 +390,48 @@ bool ModpackInstaller::Install(const std::string& profile_id, const std::string&
   if (!data_->is_prepped && !PrepInstaller(ec)) {
     return false;
   }
-  // Step 1: Install Forge
+  // Step 1: Install Forge, in the background, since the JVM takes a while, and it only writes to
+  // the libraries and versions of .minecraft, never to the profile directory
   progresser.InstallForgeProgress();
-  if (!data_->fi_ptr->IsInstalled()) {
-    if (!data_->fi_ptr->Install(ec)) {
-      return false;
+  std::error_code forge_ec;
+  std::future<bool> forge_future;
+  // Forge progress comes from the install thread, so it's only picked up when reporting
+  std::atomic<std::size_t> forge_percent(0);
+  // Always go through the install, since even an existing Forge gets its libraries verified
+  data_->fi_ptr->SetInstallOptions(data_->forge_install_options);
+  forge_future = std::async(std::launch::async, [&]() {
+    const auto forge_prog_func = [&forge_percent](std::size_t percent) {
+      forge_percent = percent;
+    };
+    return InstallForge(data_->fi_ptr, data_->lpe_ptr, data_->dot_minecraft_path,
+                        data_->num_jobs, forge_prog_func, &forge_ec);
+  });
+  // Step 2: Extract modpack, while Forge installs
+  const auto ex_prog_func = [&](std::size_t percent) {
+    const bool is_installing_forge =
+        (forge_future.valid()
+         && forge_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+    progresser.ExtractModpackProgress(
+        percent, (is_installing_forge ? std::optional<std::size_t>(forge_percent) : std::nullopt));
+  };
+  const bool is_extracted = ExtractAll(data_->modpack_path, data_->zip_ptr.get(), data_->mpi_ptr,
+                                       install_path, data_->num_jobs, ex_prog_func);
+  if (is_extracted) {
+    WriteInstallManifest(install_path, data_->mpi_ptr, nullptr);
+  }
+  // Always wait for Forge, even if extraction failed, since it's still writing to .minecraft
+  if (forge_future.valid()) {
+    while (forge_future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+      progresser.FinishForgeProgress(forge_percent);
     }
-    if (!data_->lpe_ptr->PatchForgeProfile(ec)) {
+    if (!forge_future.get()) {
+      if (ec != nullptr) {
+        *ec = forge_ec;
+      }
       return false;
     }
   }
-  // Step 2: Extract modpack
-  const std::optional<fs::path> tl_dir_opt = GetTopLevelDirectory(data_->zip_ptr.get());
-  const auto ex_prog_func = [&](std::size_t percent) {
-    progresser.ExtractModpackProgress(percent);
-  };
-  if (!ExtractAll(data_->zip_ptr.get(), install_path, tl_dir_opt, ex_prog_func)) {
+  if (!is_extracted) {
     SetError(ec, Error::MODPACK_UNZIP_FAILED);
     return false;
   }
@@ -313,21 +444,39 @@ bool ModpackInstaller::Install(const std::string& profile_id, const std::string&
   profile_data.version_opt = data_->fi_ptr->GetForgeVersion();
   profile_data.game_path_opt = install_path;
   profile_data.java_path_opt = JavaDetector::GetJavaVersion8();
-  if (!data_->lpe_ptr->WriteProfile(profile_data, ec)) {
+  const auto edit_func = [&]() { return data_->lpe_ptr->WriteProfile(profile_data, ec); };
+  if (!WriteProfiles(data_->lpe_ptr, data_->fi_ptr->GetInstallStats().has_value(), edit_func,
+                     ec)) {
     return false;
   }
   progresser.Done();
   return true;
 }
 
+std::optional<ForgeInstallStats> ModpackInstaller::GetForgeInstallStats() const
+{
+  if (data_->fi_ptr == nullptr) {
+    return std::nullopt;
+  }
+  return data_->fi_ptr->GetInstallStats();
+}
+
 struct ModpackUpdater::Data_ {
   std::string profile_id;
   fs::path modpack_path;
   fs::path dot_minecraft_path;
   LauncherProfilesEditor::Ptr lpe_ptr;
   std::unique_ptr<zpp::ZipArchive> zip_ptr;
+  ModpackIndex::Ptr mpi_ptr;
   bool is_prepped;
   ForgeInstaller::Ptr fi_ptr;
+  KeeplistProcessor::Ptr klp_ptr;
+  std::size_t num_jobs;
+  ForgeInstallOptions forge_install_options;
+  BackupMethod backup_method;
+  std::optional<BackupStats> backup_stats_opt;
+  BackupRetention backup_retention;
+  std::future<std::optional<PruneStats>> prune_future;
 };
 
 ModpackUpdater::ModpackUpdater() : data_(std::make_unique<ModpackUpdater::Data_>())
@@ -349,6 +498,20 @@ ModpackUpdater::Ptr ModpackUpdater::Create(const std::string profile_id,
 ModpackUpdater::Ptr ModpackUpdater::Create(const std::string profile_id,
                                            const fs::path& modpack_path,
                                            const fs::path& dot_minecraft_path, std::error_code* ec)
+{
+  const fs::path launcher_profiles_path = dot_minecraft_path / "launcher_profiles.json";
+  auto lpe_ptr = LauncherProfilesEditor::Create(launcher_profiles_path, ec);
+  if (lpe_ptr == nullptr) {
+    return nullptr;
+  }
+  return Create(profile_id, modpack_path, dot_minecraft_path, lpe_ptr, ec);
+}
+
+ModpackUpdater::Ptr ModpackUpdater::Create(const std::string profile_id,
+                                           const fs::path& modpack_path,
+                                           const fs::path& dot_minecraft_path,
+                                           const LauncherProfilesEditor::Ptr& lpe_ptr,
+                                           std::error_code* ec)
 {
   if (!fs::exists(modpack_path)) {
     SetError(ec, Error::MODPACK_NONEXISTENT);
@@ -364,41 +527,98 @@ ModpackUpdater::Ptr ModpackUpdater::Create(const std::string profile_id,
     SetError(ec, Error::MODPACK_ZIP_OPEN_FAILED);
     return nullptr;
   }
-  const fs::path launcher_profiles_path = dot_minecraft_path / "launcher_profiles.json";
-  auto lpe_ptr = LauncherProfilesEditor::Create(launcher_profiles_path, ec);
-  if (lpe_ptr == nullptr) {
+  auto mpi_ptr = CreateModpackIndex(modpack_path, zip_ptr.get(), ec);
+  if (mpi_ptr == nullptr) {
     return nullptr;
   }
   auto mu_ptr = Ptr(new ModpackUpdater());
   mu_ptr->data_->profile_id = profile_id;
   mu_ptr->data_->modpack_path = modpack_path;
   mu_ptr->data_->dot_minecraft_path = dot_minecraft_path;
-  mu_ptr->data_->lpe_ptr = std::move(lpe_ptr);
+  mu_ptr->data_->lpe_ptr = lpe_ptr;
   mu_ptr->data_->zip_ptr = std::move(zip_ptr);
+  mu_ptr->data_->mpi_ptr = std::move(mpi_ptr);
   mu_ptr->data_->is_prepped = false;
   mu_ptr->data_->fi_ptr = nullptr;
+  mu_ptr->data_->klp_ptr = nullptr;
+  mu_ptr->data_->num_jobs = GetDefaultNumJobs();
+  mu_ptr->data_->forge_install_options = GetDefaultForgeInstallOptions();
+  mu_ptr->data_->backup_method = BackupMethod::DEDUP;
+  mu_ptr->data_->backup_retention = GetDefaultBackupRetention();
   return mu_ptr;
 }
 
-bool ModpackUpdater::PrepInstaller(std::error_code* ec)
+void ModpackUpdater::SetNumJobs(std::size_t num_jobs)
 {
-  std::optional<fs::path> temp_path_opt = CreateTempDir();
-  if (!temp_path_opt) {
-    SetError(ec, Error::MODPACK_PREP_INSTALL_TEMPDIR_FAILED);
-    return false;
+  data_->num_jobs = std::max<std::size_t>(num_jobs, 1);
+}
+
+void ModpackUpdater::SetBackupMethod(BackupMethod backup_method)
+{
+  data_->backup_method = backup_method;
+}
+
+void ModpackUpdater::SetBackupRetention(const BackupRetention& backup_retention)
+{
+  data_->backup_retention = backup_retention;
+}
+
+void ModpackUpdater::SetForgeInstallOptions(const ForgeInstallOptions& forge_install_options)
+{
+  data_->forge_install_options = forge_install_options;
+}
+
+std::optional<BackupStats> ModpackUpdater::GetBackupStats() const
+{
+  return data_->backup_stats_opt;
+}
+
+std::optional<ForgeInstallStats> ModpackUpdater::GetForgeInstallStats() const
+{
+  if (data_->fi_ptr == nullptr) {
+    return std::nullopt;
   }
-  const fs::path& temp_path = temp_path_opt.value();
-  const std::optional<fs::path> tl_dir_opt = GetTopLevelDirectory(data_->zip_ptr.get());
-  if (!ExtractOne(data_->zip_ptr.get(), temp_path, tl_dir_opt, "trollauncher/installer.jar")) {
-    SetError(ec, Error::MODPACK_PREP_INSTALL_UNZIP_FAILED);
-    return false;
+  return data_->fi_ptr->GetInstallStats();
+}
+
+std::optional<PruneStats> ModpackUpdater::WaitForBackupPrune()
+{
+  if (!data_->prune_future.valid()) {
+    return std::nullopt;
   }
-  const fs::path forge_installer_path = temp_path / "trollauncher" / "installer.jar";
-  auto fi_ptr = ForgeInstaller::Create(forge_installer_path, data_->dot_minecraft_path, ec);
+  return data_->prune_future.get();
+}
+
+bool ModpackUpdater::PrepInstaller(std::error_code* ec)
+{
+  auto fi_ptr =
+      PrepForgeInstaller(data_->zip_ptr.get(), data_->mpi_ptr, data_->dot_minecraft_path, ec);
   if (fi_ptr == nullptr) {
     return false;
   }
+  // The modpack can have its own keeplist, otherwise just use the default one
+  KeeplistProcessor::Ptr klp_ptr = nullptr;
+  if (data_->mpi_ptr->FindEntry("trollauncher/keeplist") != nullptr) {
+    const std::optional<std::string> keeplist_str_opt =
+        ReadOne(data_->zip_ptr.get(), data_->mpi_ptr, "trollauncher/keeplist");
+    if (!keeplist_str_opt) {
+      SetError(ec, Error::MODPACK_PREP_INSTALL_UNZIP_FAILED);
+      return false;
+    }
+    klp_ptr = KeeplistProcessor::CreateFromString(keeplist_str_opt.value(), ec);
+    if (klp_ptr == nullptr) {
+      return false;
+    }
+  }
+  else {
+    klp_ptr = KeeplistProcessor::CreateDefault();
+    if (klp_ptr == nullptr) {
+      SetError(ec, Error::MODPACK_KEEPLIST_FAILED);
+      return false;
+    }
+  }
   data_->fi_ptr = std::move(fi_ptr);
+  data_->klp_ptr = std::move(klp_ptr);
   data_->is_prepped = true;
   return true;
 }
@@ -438,58 +658,61 @@ bool ModpackUpdater::Update(std::error_code* ec, const ProgressFunc& progress_fu
     return false;
   }
   // Step 1: Install Forge
-  progresser.InstallForgeProgress();
-  if (!data_->fi_ptr->IsInstalled()) {
-    if (!data_->fi_ptr->Install(ec)) {
-      return false;
-    }
-    if (!data_->lpe_ptr->PatchForgeProfile(ec)) {
-      return false;
-    }
+  progresser.InstallForgeProgress(0);
+  data_->fi_ptr->SetInstallOptions(data_->forge_install_options);
+  const auto forge_prog_func = [&](std::size_t percent) {
+    progresser.InstallForgeProgress(percent);
+  };
+  if (!InstallForge(data_->fi_ptr, data_->lpe_ptr, data_->dot_minecraft_path, data_->num_jobs,
+                    forge_prog_func, ec)) {
+    return false;
   }
   // Step 2: Get existing files not in the keeplist
   progresser.ProcessKeeplistProgress();
-  const auto klp_ptr = KeeplistProcessor::CreateDefault();
-  if (klp_ptr == nullptr) {
-    SetError(ec, Error::MODPACK_KEEPLIST_FAILED);
-    return false;
+  const KeeplistProcessor::Ptr& klp_ptr = data_->klp_ptr;
+  // With an install manifest, only files from the modpack are considered, so user files are left
+  // alone. Older installs don't have one, so they still need a walk of the whole profile.
+  const InstallManifest::Ptr im_ptr = InstallManifest::Load(profile_path, nullptr);
+  std::vector<fs::path> overwrite_paths;
+  if (im_ptr != nullptr) {
+    overwrite_paths = GetManifestFilePaths(profile_path, im_ptr, data_->mpi_ptr, klp_ptr);
   }
-  const std::optional<std::vector<fs::path>> all_file_paths_opt = GetDirFilePaths(profile_path);
-  if (!all_file_paths_opt) {
-    SetError(ec, Error::PROFILE_GET_FILES_FAILED);
-    return false;
+  else {
+    const std::optional<std::vector<fs::path>> all_file_paths_opt =
+        GetDirFilePaths(profile_path, klp_ptr);
+    if (!all_file_paths_opt) {
+      SetError(ec, Error::PROFILE_GET_FILES_FAILED);
+      return false;
+    }
+    overwrite_paths = klp_ptr->FilterOverwritePaths(all_file_paths_opt.value());
   }
-  const std::vector<fs::path> overwrite_paths =
-      klp_ptr->FilterOverwritePaths(all_file_paths_opt.value());
-  // Step 3: Create backup zip file of all outdated file
-  const fs::path backup_path = GetBackupZipPath(data_->dot_minecraft_path, data_->profile_id);
-  const auto bk_prog_func = [&](std::size_t percent) { progresser.BackupProgress(percent); };
-  if (!CreateBackupZipFile(backup_path, profile_path, overwrite_paths, bk_prog_func)) {
-    SetError(ec, Error::PROFILE_BACKUP_FAILED);
+  // Only touch what actually changed, comparing sizes and CRCs with the modpack
+  const UpdatePlan update_plan = PlanUpdate(data_->mpi_ptr, klp_ptr, im_ptr, profile_path,
+                                            overwrite_paths, data_->num_jobs);
+  // Step 3: Back up, remove, and extract files, all at the same time
+  const auto up_prog_func = [&](std::size_t percent) { progresser.UpdateFilesProgress(percent); };
+  data_->backup_stats_opt = std::nullopt;
+  if (!UpdateProfileFiles(data_->modpack_path, data_->zip_ptr.get(), update_plan, profile_path,
+                          data_->backup_method,
+                          GetProfileBackupsPath(data_->dot_minecraft_path, data_->profile_id),
+                          data_->num_jobs, up_prog_func, &data_->backup_stats_opt, ec)) {
     return false;
   }
-  // Step 4: Delete all outdated files
-  const auto rm_prog_func = [&](std::size_t percent) {
-    progresser.RemoveOutdatedProgress(percent);
-  };
-  RemoveOutdatedFiles(profile_path, overwrite_paths, rm_prog_func);
-  // Step 5: Extract new files not in the keeplist
-  const std::optional<fs::path> tl_dir_opt = GetTopLevelDirectory(data_->zip_ptr.get());
-  const auto ex_prog_func = [&](std::size_t percent) {
-    progresser.ExtractModpackProgress(percent);
-  };
-  if (!ExtractOverwrites(data_->zip_ptr.get(), profile_path, tl_dir_opt, klp_ptr, ex_prog_func)) {
-    SetError(ec, Error::MODPACK_UNZIP_FAILED);
-    return false;
-  }
-  // Step 6: Update profile
+  WriteInstallManifest(profile_path, data_->mpi_ptr, klp_ptr);
+  // Step 4: Update profile
   progresser.UpdateProfileProgress();
   ProfileData update_profile_data;
   update_profile_data.id = data_->profile_id;
   update_profile_data.version_opt = data_->fi_ptr->GetForgeVersion();
-  if (!data_->lpe_ptr->UpdateProfile(update_profile_data, ec)) {
+  const auto edit_func = [&]() { return data_->lpe_ptr->UpdateProfile(update_profile_data, ec); };
+  if (!WriteProfiles(data_->lpe_ptr, data_->fi_ptr->GetInstallStats().has_value(), edit_func,
+                     ec)) {
     return false;
   }
+  // Step 5: Prune old backups, in the background since the update doesn't depend on it
+  data_->prune_future = std::async(std::launch::async, PruneBackups,
+                                   GetBackupsPath(data_->dot_minecraft_path),
+                                   data_->backup_retention, data_->num_jobs);
   progresser.Done();
   return true;
 }
@@ -515,11 +738,25 @@ void ModpackInstallerProgresser::InstallForgeProgress()
   progress_func_(10, "Installing Forge...");
 }
 
-void ModpackInstallerProgresser::ExtractModpackProgress(std::size_t percent)
+void ModpackInstallerProgresser::ExtractModpackProgress(
+    std::size_t percent, std::optional<std::size_t> forge_percent_opt)
 {
   if (!progress_func_) return;
-  const std::size_t total_percent = PercentInterp(percent, 20, 89);
-  progress_func_(total_percent, "Extracting modpack...");
+  const std::size_t total_percent = PercentInterp(percent, 20, 84);
+  if (!forge_percent_opt) {
+    progress_func_(total_percent, "Extracting modpack...");
+    return;
+  }
+  progress_func_(total_percent, ("Installing Forge (" + std::to_string(forge_percent_opt.value())
+                                 + "%) and extracting modpack..."));
+}
+
+void ModpackInstallerProgresser::FinishForgeProgress(std::size_t forge_percent)
+{
+  if (!progress_func_) return;
+  const std::size_t total_percent = PercentInterp(forge_percent, 85, 89);
+  progress_func_(total_percent,
+                 "Finishing Forge install... (" + std::to_string(forge_percent) + "%)");
 }
 
 void ModpackInstallerProgresser::WriteProfileProgress()
@@ -547,10 +784,11 @@ void ModpackUpdaterProgresser::PrepInstallProgress()
   progress_func_(0, "Prepping install...");
 }
 
-void ModpackUpdaterProgresser::InstallForgeProgress()
+void ModpackUpdaterProgresser::InstallForgeProgress(std::size_t percent)
 {
   if (!progress_func_) return;
-  progress_func_(10, "Installing Forge...");
+  const std::size_t total_percent = PercentInterp(percent, 10, 19);
+  progress_func_(total_percent, "Installing Forge...");
 }
 
 void ModpackUpdaterProgresser::ProcessKeeplistProgress()
@@ -559,25 +797,11 @@ void ModpackUpdaterProgresser::ProcessKeeplistProgress()
   progress_func_(20, "Processing keeplist...");
 }
 
-void ModpackUpdaterProgresser::BackupProgress(std::size_t percent)
+void ModpackUpdaterProgresser::UpdateFilesProgress(std::size_t percent)
 {
   if (!progress_func_) return;
-  const std::size_t total_percent = PercentInterp(percent, 30, 49);
-  progress_func_(total_percent, "Backing up outdated files... (This may take a moment)");
-}
-
-void ModpackUpdaterProgresser::RemoveOutdatedProgress(std::size_t percent)
-{
-  if (!progress_func_) return;
-  const std::size_t total_percent = PercentInterp(percent, 50, 69);
-  progress_func_(total_percent, "Removing outdated files...");
-}
-
-void ModpackUpdaterProgresser::ExtractModpackProgress(std::size_t percent)
-{
-  if (!progress_func_) return;
-  const std::size_t total_percent = PercentInterp(percent, 70, 89);
-  progress_func_(total_percent, "Extracting modpack...");
+  const std::size_t total_percent = PercentInterp(percent, 30, 89);
+  progress_func_(total_percent, "Backing up and extracting files... (This may take a moment)");
 }
 
 void ModpackUpdaterProgresser::UpdateProfileProgress()
@@ -601,16 +825,59 @@ PercentProgresser::PercentProgresser(const PercentProgressFunc& progress_func,
 }
 
 void PercentProgresser::Tick()
+{
+  TickQuietly();
+  Report();
+}
+
+void PercentProgresser::TickQuietly()
+{
+  ++num_ticked_;
+}
+
+void PercentProgresser::Report()
 {
   if (!progress_func_) return;
-  num_ticked_ = std::min(num_total_, num_ticked_ + 1);
-  const std::size_t next_percent = (100 * num_ticked_) / num_total_;
+  std::lock_guard<std::mutex> lock(report_mutex_);
+  if (num_total_ == 0) return;
+  const std::size_t num_ticked = std::min(num_total_, num_ticked_.load());
+  const std::size_t next_percent = (100 * num_ticked) / num_total_;
   if (next_percent != last_percent_) {
     progress_func_(next_percent);
     last_percent_ = next_percent;
   }
 }
 
+PathGate::PathGate(std::size_t num_paths) : is_opens_(num_paths, false), is_failed_(false)
+{
+  // Do nothing
+}
+
+void PathGate::Open(std::size_t path_index)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_opens_.at(path_index) = true;
+  }
+  cond_var_.notify_all();
+}
+
+void PathGate::Fail()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_failed_ = true;
+  }
+  cond_var_.notify_all();
+}
+
+bool PathGate::Wait(std::size_t path_index)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_var_.wait(lock, [&]() { return is_opens_.at(path_index) || is_failed_; });
+  return is_opens_.at(path_index);
+}
+
 std::size_t PercentInterp(std::size_t percent, std::size_t low, std::size_t high)
 {
   return ((high - low) * percent / 100) + low;
@@ -638,11 +905,13 @@ fs::path GetDefaultInstallPath(const fs::path& dot_minecraft_path, const std::st
 
 bool ProfileLooksLikeAnInstall(const ProfileData& profile_data)
 {
+  // Check the type first, since it's cheap, and the path means hitting the disk
   const bool is_type_custom = (profile_data.type_opt && profile_data.type_opt.value() == "custom");
-  const bool is_game_path_install =
-      (profile_data.game_path_opt
-       && ProfilePathLooksLikeAnInstall(profile_data.game_path_opt.value()));
-  return is_type_custom && is_game_path_install;
+  if (!is_type_custom) {
+    return false;
+  }
+  return profile_data.game_path_opt
+         && ProfilePathLooksLikeAnInstall(profile_data.game_path_opt.value());
 }
 
 bool ProfilePathLooksLikeAnInstall(const fs::path& profile_path)
@@ -669,92 +938,146 @@ bool ProfilePathLooksLikeAnInstall(const fs::path& profile_path)
   return is_trollauncher_like && !is_minecraft_like;
 }
 
-std::optional<std::vector<fs::path>> GetDirFilePaths(const fs::path& dir_path)
+std::optional<std::vector<fs::path>> GetDirFilePaths(const fs::path& dir_path,
+                                                     const KeeplistProcessor::Ptr& klp_ptr)
 {
-  std::error_code fs_ec;
-  std::vector<fs::path> raw_file_paths;
-  const auto update_dir_iter = fs::recursive_directory_iterator(dir_path, fs_ec);
-  if (fs_ec) {
+  // Directories that are entirely in the keeplist are never entered. These are things like saves
+  // and map data, which can easily have more files than the rest of the profile put together.
+  std::vector<fs::path> file_paths;
+  std::vector<std::string> pending_dir_paths = {""};
+#if ITS_A_UNIX_SYSTEM
+  // Use readdir directly, since it already knows the file types, so nothing needs a stat
+  const int root_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0) {
     return std::nullopt;
   }
-  for (const fs::path& path : update_dir_iter) {
-    if (fs::is_regular_file(path)) {
-      raw_file_paths.push_back(path);
+  while (!pending_dir_paths.empty()) {
+    const std::string rel_dir_path = std::move(pending_dir_paths.back());
+    pending_dir_paths.pop_back();
+    const int dir_fd =
+        (rel_dir_path.empty()
+             ? dup(root_fd)
+             : openat(root_fd, rel_dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    DIR* dir_ptr = (dir_fd < 0 ? nullptr : fdopendir(dir_fd));
+    if (dir_ptr == nullptr) {
+      if (dir_fd >= 0) {
+        close(dir_fd);
+      }
+      close(root_fd);
+      return std::nullopt;
+    }
+    while (const dirent* dirent_ptr = readdir(dir_ptr)) {
+      const char* name = dirent_ptr->d_name;
+      if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+        continue;
+      }
+      unsigned char type = dirent_ptr->d_type;
+      if (type == DT_UNKNOWN) {
+        // Not every filesystem fills in the type, so fall back to a stat
+        struct stat lstat_buf;
+        if (fstatat(dir_fd, name, &lstat_buf, AT_SYMLINK_NOFOLLOW) != 0) {
+          continue;
+        }
+        type = (S_ISREG(lstat_buf.st_mode)   ? DT_REG
+                : S_ISDIR(lstat_buf.st_mode) ? DT_DIR
+                : S_ISLNK(lstat_buf.st_mode) ? DT_LNK
+                                             : DT_UNKNOWN);
+      }
+      if (type == DT_LNK) {
+        // Symlinks to files count as files, but symlinks to directories aren't followed
+        struct stat stat_buf;
+        if (fstatat(dir_fd, name, &stat_buf, 0) != 0 || !S_ISREG(stat_buf.st_mode)) {
+          continue;
+        }
+        type = DT_REG;
+      }
+      if (type == DT_REG) {
+        file_paths.emplace_back(rel_dir_path + name);
+      }
+      else if (type == DT_DIR) {
+        std::string rel_subdir_path = rel_dir_path + name + "/";
+        if (klp_ptr == nullptr || !klp_ptr->IsKeptDirectory(rel_subdir_path)) {
+          pending_dir_paths.push_back(std::move(rel_subdir_path));
+        }
+      }
     }
+    closedir(dir_ptr);
   }
-  std::vector<fs::path> relative_file_paths;
-  for (const fs::path& path : raw_file_paths) {
-    relative_file_paths.push_back(StripPrefix(path, dir_path));
+  close(root_fd);
+#else
+  std::error_code fs_ec;
+  while (!pending_dir_paths.empty()) {
+    const std::string rel_dir_path = std::move(pending_dir_paths.back());
+    pending_dir_paths.pop_back();
+    auto dir_iter = fs::directory_iterator(dir_path / rel_dir_path, fs_ec);
+    if (fs_ec) {
+      return std::nullopt;
+    }
+    for (; dir_iter != fs::directory_iterator(); dir_iter.increment(fs_ec)) {
+      const fs::directory_entry& dir_entry = *dir_iter;
+      const std::string name = dir_entry.path().filename().string();
+      if (dir_entry.is_regular_file(fs_ec)) {
+        file_paths.emplace_back(rel_dir_path + name);
+      }
+      else if (dir_entry.is_directory(fs_ec) && !dir_entry.is_symlink(fs_ec)) {
+        std::string rel_subdir_path = rel_dir_path + name + "/";
+        if (klp_ptr == nullptr || !klp_ptr->IsKeptDirectory(rel_subdir_path)) {
+          pending_dir_paths.push_back(std::move(rel_subdir_path));
+        }
+      }
+    }
+    if (fs_ec) {
+      return std::nullopt;
+    }
   }
-  return relative_file_paths;
+#endif
+  return file_paths;
 }
 
-std::optional<fs::path> GetTopLevelDirectory(zpp::ZipArchive* zip_ptr)
+std::vector<fs::path> GetManifestFilePaths(const fs::path& profile_path,
+                                           const InstallManifest::Ptr& im_ptr,
+                                           const ModpackIndex::Ptr& mpi_ptr,
+                                           const KeeplistProcessor::Ptr& klp_ptr)
 {
-  const zpp::ZipEntry first_entry = zip_ptr->getEntry(0);
-  if (first_entry.isNull()) {
-    return std::nullopt;
-  }
-  const fs::path entry_path = first_entry.getName();
-  if (!entry_path.has_parent_path()) {
-    return std::nullopt;
-  }
-  const fs::path maybe_tl_dir = *entry_path.begin();
-  if (maybe_tl_dir == "mods" || maybe_tl_dir == "config" || maybe_tl_dir == "trollauncher") {
-    return std::nullopt;
-  }
-  for (std::size_t ii = 1; ii < static_cast<std::size_t>(zip_ptr->getEntriesCount()); ++ii) {
-    const zpp::ZipEntry other_entry = zip_ptr->getEntry(ii);
-    if (!other_entry.isFile()) {
-      continue;
+  // Files the new modpack would overwrite are included too, so they still get backed up
+  std::error_code fs_ec;
+  std::unordered_set<std::string> seen_paths;
+  std::vector<fs::path> file_paths;
+  const auto add_path = [&](const std::string& path) {
+    if (!klp_ptr->IsOverwritePath(path) || !seen_paths.insert(path).second) {
+      return;
     }
-    const fs::path other_entry_path = other_entry.getName();
-    if (!other_entry_path.has_parent_path() || *other_entry_path.begin() != maybe_tl_dir) {
-      return std::nullopt;
+    if (fs::is_regular_file(profile_path / path, fs_ec)) {
+      file_paths.push_back(path);
     }
+  };
+  for (const ManifestFile& file : im_ptr->GetFiles()) {
+    add_path(file.path);
   }
-  return maybe_tl_dir;
+  for (const ModpackEntry& entry : mpi_ptr->GetEntries()) {
+    add_path(entry.path);
+  }
+  return file_paths;
 }
 
-fs::path StripPrefix(const fs::path& orig_path, const fs::path& prefix_path)
+ModpackIndex::Ptr CreateModpackIndex(const fs::path& modpack_path,
+                                     const zpp::ZipArchive* zip_ptr, std::error_code* ec)
 {
-  const std::size_t orig_length = std::distance(orig_path.begin(), orig_path.end());
-  const std::size_t prefix_length = std::distance(prefix_path.begin(), prefix_path.end());
-  if (orig_length < prefix_length) {
-    return orig_path;
+  auto mpi_ptr = ModpackIndex::Create(modpack_path, ec);
+  if (mpi_ptr == nullptr) {
+    return nullptr;
   }
-  const fs::path orig_prefix_path =
-      std::accumulate(orig_path.begin(), std::next(orig_path.begin(), prefix_length), fs::path(),
-                      [](const auto& p, const auto& r) { return p / r; });
-  if (orig_prefix_path != prefix_path) {
-    return orig_path;
+  // Entries are extracted by index, so the index must agree with Libzip
+  if (mpi_ptr->GetNumZipEntries() != static_cast<std::size_t>(zip_ptr->getEntriesCount())) {
+    SetError(ec, Error::MODPACK_INDEX_FAILED);
+    return nullptr;
   }
-  const fs::path orig_remainder_path =
-      std::accumulate(std::next(orig_path.begin(), prefix_length), orig_path.end(), fs::path(),
-                      [](const auto& p, const auto& r) { return p / r; });
-  return orig_remainder_path;
+  return mpi_ptr;
 }
 
-bool ExtractOne(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
-                const std::optional<fs::path>& add_prefix_opt, const fs::path& entry_path)
+bool ExtractEntry(const zpp::ZipArchive* zip_ptr, const zpp::ZipEntry& zip_entry,
+                  const fs::path& dest_path)
 {
-  std::error_code fs_ec;
-  const fs::path complete_path =
-      (add_prefix_opt ? add_prefix_opt.value() / entry_path : entry_path);
-  zpp::ZipEntry zip_entry = zip_ptr->getEntry(complete_path.generic_string());
-  if (!zip_entry.isFile()) {
-    return false;
-  }
-  const fs::path dest_path = extract_path / entry_path;
-  // Create the parent directory if we need to
-  const fs::path dest_parent_path = dest_path.parent_path();
-  if (!fs::exists(dest_parent_path)) {
-    fs::create_directories(dest_parent_path, fs_ec);
-    if (fs_ec) {
-      return false;
-    }
-  }
-  // Create the actual file
   const std::ios_base::openmode ofs_flags =
       std::ios_base::binary | std::ios_base::out | std::ios_base::trunc;
   std::ofstream file_ofs(dest_path, ofs_flags);
@@ -768,115 +1091,362 @@ bool ExtractOne(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
   return true;
 }
 
-bool ExtractAll(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
-                const std::optional<fs::path>& strip_prefix_opt,
-                const PercentProgressFunc& progress_func)
+std::optional<std::string> ReadOne(const zpp::ZipArchive* zip_ptr,
+                                   const ModpackIndex::Ptr& mpi_ptr, const std::string& entry_path)
 {
-  return ExtractOverwrites(zip_ptr, extract_path, strip_prefix_opt, nullptr, progress_func);
+  const ModpackEntry* entry_ptr = mpi_ptr->FindEntry(entry_path);
+  if (entry_ptr == nullptr) {
+    return std::nullopt;
+  }
+  const zpp::ZipEntry zip_entry =
+      zip_ptr->getEntry(static_cast<zpp::libzippp_int64>(entry_ptr->zip_index));
+  if (!zip_entry.isFile()) {
+    return std::nullopt;
+  }
+  std::ostringstream entry_oss;
+  if (zip_ptr->readEntry(zip_entry, entry_oss) != LIBZIPPP_OK) {
+    return std::nullopt;
+  }
+  return entry_oss.str();
 }
 
-bool ExtractOverwrites(const zpp::ZipArchive* zip_ptr, const fs::path& extract_path,
-                       const std::optional<fs::path>& strip_prefix_opt,
-                       const KeeplistProcessor::Ptr& klp_ptr,
-                       const PercentProgressFunc& progress_func)
+ForgeInstaller::Ptr PrepForgeInstaller(const zpp::ZipArchive* zip_ptr,
+                                       const ModpackIndex::Ptr& mpi_ptr,
+                                       const fs::path& dot_minecraft_path, std::error_code* ec)
 {
-  std::error_code fs_ec;
-  const std::vector<zpp::ZipEntry> zip_entries = zip_ptr->getEntries();
-  PercentProgresser progresser(progress_func, zip_entries.size());
-  for (const auto& zip_entry : zip_entries) {
-    if (!zip_entry.isFile()) {
-      continue;
+  const std::string installer_entry_path = "trollauncher/installer.jar";
+  const ModpackEntry* entry_ptr = mpi_ptr->FindEntry(installer_entry_path);
+  if (entry_ptr == nullptr) {
+    SetError(ec, Error::MODPACK_PREP_INSTALL_UNZIP_FAILED);
+    return nullptr;
+  }
+  RemoveStaleTempDirs(STALE_TEMP_DIR_AGE);
+  // Most modpacks share a handful of Forge builds, so usually this is a hit
+  const fs::path forge_cache_path = GetForgeCachePath(dot_minecraft_path);
+  auto fi_ptr = ForgeInstaller::CreateFromCache(forge_cache_path, entry_ptr->crc, entry_ptr->size,
+                                                dot_minecraft_path);
+  if (fi_ptr != nullptr) {
+    return fi_ptr;
+  }
+  // The installer is only read into memory, it gets written out later if it actually has to run
+  std::optional<std::string> installer_data_opt = ReadOne(zip_ptr, mpi_ptr, installer_entry_path);
+  if (!installer_data_opt) {
+    SetError(ec, Error::MODPACK_PREP_INSTALL_UNZIP_FAILED);
+    return nullptr;
+  }
+  fi_ptr = ForgeInstaller::CreateFromData(std::move(installer_data_opt.value()),
+                                          dot_minecraft_path, ec);
+  if (fi_ptr == nullptr) {
+    return nullptr;
+  }
+  // Not being able to cache it is fine, it just won't be any faster next time
+  fi_ptr->AddToCache(forge_cache_path);
+  return fi_ptr;
+}
+
+bool InstallForge(const ForgeInstaller::Ptr& fi_ptr, const LauncherProfilesEditor::Ptr& lpe_ptr,
+                  const fs::path& dot_minecraft_path, std::size_t num_jobs,
+                  const ForgeProgressFunc& progress_func, std::error_code* ec)
+{
+  // The installer rewrites launcher_profiles.json itself, so nobody else can be editing it while
+  // it runs. Always taken before the Forge lock, so the two can't deadlock. A shared editor in a
+  // transaction already holds it, and picks up whatever the installer wrote when it commits.
+  FileLock::Ptr profiles_lock_ptr = nullptr;
+  if (!lpe_ptr->IsInTransaction()) {
+    profiles_lock_ptr = LockLauncherProfiles(dot_minecraft_path / "launcher_profiles.json", ec);
+    if (profiles_lock_ptr == nullptr) {
+      return false;
     }
-    const fs::path entry_path = zip_entry.getName();
-    const fs::path stripped_entry_path =
-        (strip_prefix_opt ? StripPrefix(entry_path, strip_prefix_opt.value()) : entry_path);
-    if (klp_ptr != nullptr && !klp_ptr->IsOverwritePath(stripped_entry_path)) {
+  }
+  // Other processes might be installing the same Forge into the same .minecraft, so only the
+  // first one runs the installer, and the rest wait for it and then use what it installed
+  const fs::path lock_path =
+      GetLocksPath(dot_minecraft_path) / ("forge-" + fi_ptr->GetForgeVersion() + ".lock");
+  const FileLock::Ptr lock_ptr = FileLock::Acquire(lock_path);
+  if (lock_ptr == nullptr) {
+    SetError(ec, Error::FORGE_INSTALLER_LOCK_FAILED);
+    return false;
+  }
+  // The version JSON existing doesn't mean the libraries survived, so check those too. Running
+  // the installer again fixes anything that's missing or corrupt.
+  if (fi_ptr->IsInstalled() && IsForgeVerified(fi_ptr, num_jobs)) {
+    return true;
+  }
+  if (!fi_ptr->Install(ec, progress_func)) {
+    return false;
+  }
+  if (!IsForgeVerified(fi_ptr, num_jobs)) {
+    SetError(ec, Error::FORGE_INSTALLER_BAD_INSTALL);
+    return false;
+  }
+  return true;
+}
+
+bool WriteProfiles(const LauncherProfilesEditor::Ptr& lpe_ptr, bool is_forge_new,
+                   const std::function<bool()>& edit_func, std::error_code* ec)
+{
+  // A fresh Forge needs its profile patched too, and it all goes out in a single write. A shared
+  // editor that's already in a transaction only stages it, and whoever began it commits.
+  if (lpe_ptr->IsInTransaction()) {
+    return (!is_forge_new || lpe_ptr->PatchForgeProfile(ec)) && edit_func();
+  }
+  if (!lpe_ptr->BeginTransaction(ec)) {
+    return false;
+  }
+  if ((is_forge_new && !lpe_ptr->PatchForgeProfile(ec)) || !edit_func()) {
+    lpe_ptr->AbortTransaction();
+    return false;
+  }
+  return lpe_ptr->CommitTransaction(ec);
+}
+
+bool IsForgeVerified(const ForgeInstaller::Ptr& fi_ptr, std::size_t num_jobs)
+{
+  const std::optional<ForgeVerifyStats> verify_stats_opt = fi_ptr->VerifyInstall(num_jobs);
+  return verify_stats_opt && verify_stats_opt->bad_library_paths.empty();
+}
+
+bool ExtractAll(const fs::path& modpack_path, const zpp::ZipArchive* zip_ptr,
+                const ModpackIndex::Ptr& mpi_ptr, const fs::path& extract_path,
+                std::size_t num_jobs, const PercentProgressFunc& progress_func)
+{
+  std::vector<const ModpackEntry*> entry_ptrs;
+  entry_ptrs.reserve(mpi_ptr->GetEntries().size());
+  for (const ModpackEntry& entry : mpi_ptr->GetEntries()) {
+    entry_ptrs.push_back(&entry);
+  }
+  PercentProgresser progresser(progress_func, entry_ptrs.size());
+  return ExtractEntries(modpack_path, zip_ptr, entry_ptrs, extract_path, num_jobs, &progresser,
+                        nullptr);
+}
+
+bool ExtractEntries(const fs::path& modpack_path, const zpp::ZipArchive* zip_ptr,
+                    const std::vector<const ModpackEntry*>& entry_ptrs,
+                    const fs::path& extract_path, std::size_t num_jobs,
+                    PercentProgresser* progresser_ptr, const BeforeExtractFunc& before_func)
+{
+  std::error_code fs_ec;
+  struct ExtractJob {
+    const ModpackEntry* entry_ptr;
+    fs::path dest_path;
+  };
+  std::vector<ExtractJob> extract_jobs;
+  extract_jobs.reserve(entry_ptrs.size());
+  for (const ModpackEntry* entry_ptr : entry_ptrs) {
+    extract_jobs.push_back(ExtractJob{entry_ptr, extract_path / entry_ptr->path});
+  }
+  // Schedule the biggest entries first, so no worker gets stuck with a big one at the end
+  std::stable_sort(extract_jobs.begin(), extract_jobs.end(),
+                   [](const ExtractJob& aa, const ExtractJob& bb) {
+                     return aa.entry_ptr->size > bb.entry_ptr->size;
+                   });
+  // Create all the parent directories up front, so the workers don't race to create them
+  std::unordered_set<std::string> dest_parent_strs;
+  for (const ExtractJob& extract_job : extract_jobs) {
+    const fs::path dest_parent_path = extract_job.dest_path.parent_path();
+    if (!dest_parent_strs.insert(dest_parent_path.string()).second) {
       continue;
     }
-    const fs::path dest_path = extract_path / stripped_entry_path;
-    // Create the parent directory if we need to
-    const fs::path dest_parent_path = dest_path.parent_path();
     if (!fs::exists(dest_parent_path)) {
       fs::create_directories(dest_parent_path, fs_ec);
       if (fs_ec) {
         return false;
       }
     }
-    // Create the actual file
-    const std::ios_base::openmode ofs_flags =
-        std::ios_base::binary | std::ios_base::out | std::ios_base::trunc;
-    std::ofstream file_ofs(dest_path, ofs_flags);
-    if (!file_ofs.good()) {
-      return false;
+  }
+  // Every worker needs its own read handle, because a zip archive can't be shared across threads.
+  // The first worker can just borrow the one we already have open. (Entries are looked up by
+  // index, because an entry can only be read through the archive it came from.)
+  const std::size_t num_workers =
+      std::max<std::size_t>(std::min(num_jobs, extract_jobs.size()), 1);
+  std::vector<std::unique_ptr<zpp::ZipArchive>> worker_zip_ptrs(num_workers);
+  std::vector<StoredEntryCopier::Ptr> worker_sec_ptrs(num_workers);
+  const auto extract_func = [&](std::size_t worker_index, std::size_t job_index) {
+    const ExtractJob& extract_job = extract_jobs.at(job_index);
+    const ModpackEntry& entry = *extract_job.entry_ptr;
+    if (before_func) {
+      const ExtractAction extract_action = before_func(entry);
+      if (extract_action == ExtractAction::ABORT) {
+        return false;
+      }
+      else if (extract_action == ExtractAction::SKIP) {
+        progresser_ptr->TickQuietly();
+        return true;
+      }
     }
-    const int zip_error_code = zip_ptr->readEntry(zip_entry, file_ofs);
-    if (zip_error_code != LIBZIPPP_OK) {
+    // Stored entries are just copied, but anything that goes wrong falls through to Libzip
+    if (entry.is_stored) {
+      StoredEntryCopier::Ptr& sec_ptr = worker_sec_ptrs.at(worker_index);
+      if (sec_ptr == nullptr) {
+        sec_ptr = StoredEntryCopier::Create(modpack_path);
+      }
+      if (sec_ptr != nullptr
+          && sec_ptr->Copy(entry.local_header_offset, entry.size, extract_job.dest_path)) {
+        progresser_ptr->TickQuietly();
+        return true;
+      }
+    }
+    const zpp::ZipArchive* worker_zip_ptr = zip_ptr;
+    if (worker_index != 0) {
+      std::unique_ptr<zpp::ZipArchive>& own_zip_ptr = worker_zip_ptrs.at(worker_index);
+      if (own_zip_ptr == nullptr) {
+        own_zip_ptr = std::make_unique<zpp::ZipArchive>(modpack_path.string());
+        if (!own_zip_ptr->open(zpp::ZipArchive::READ_ONLY)) {
+          return false;
+        }
+      }
+      worker_zip_ptr = own_zip_ptr.get();
+    }
+    const zpp::ZipEntry zip_entry =
+        worker_zip_ptr->getEntry(static_cast<zpp::libzippp_int64>(entry.zip_index));
+    if (!zip_entry.isFile() || !ExtractEntry(worker_zip_ptr, zip_entry, extract_job.dest_path)) {
       return false;
     }
-    progresser.Tick();
-  }
-  return true;
-}
-
-fs::path GetBackupZipPath(const fs::path& dot_minecraft_path, const std::string& id)
-{
-  const std::string time_str = ([]() {
-    const auto now_chrono = std::chrono::system_clock::now();
-    std::time_t now_time_t = std::chrono::system_clock::to_time_t(now_chrono);
-    char time_c_str[sizeof "00000000_000000"];
-    std::strftime(time_c_str, sizeof time_c_str, "%Y%m%d_%H%M%S", std::gmtime(&now_time_t));
-    return std::string(time_c_str);
-  }());
-  return dot_minecraft_path / "trollauncher" / "backups" / id / (time_str + ".zip");
+    progresser_ptr->TickQuietly();
+    return true;
+  };
+  const auto poll_func = [&]() { progresser_ptr->Report(); };
+  return ParallelForEach(num_workers, extract_jobs.size(), extract_func, poll_func);
 }
 
-bool CreateBackupZipFile(const fs::path& backup_path, const fs::path& profile_path,
-                         const std::vector<fs::path>& overwrite_paths,
-                         const PercentProgressFunc& progress_func)
+bool UpdateProfileFiles(const fs::path& modpack_path, const zpp::ZipArchive* zip_ptr,
+                        const UpdatePlan& update_plan, const fs::path& profile_path,
+                        BackupMethod backup_method, const fs::path& backups_path,
+                        std::size_t num_jobs, const PercentProgressFunc& progress_func,
+                        std::optional<BackupStats>* backup_stats_opt_ptr, std::error_code* ec)
 {
-  std::error_code fs_ec;
-  PercentProgresser progresser(progress_func, overwrite_paths.size());
-  if (fs::exists(backup_path)) {
-    return false;
+  // The backup, removal and extraction all overlap, with a few rules to keep it correct:
+  //   - Added files don't depend on anything, so they're extracted right away
+  //   - Modified files are extracted once they're backed up
+  //   - Deleted files are removed once they're backed up
+  //   - Renamed files are moved once they're backed up, or extracted if that doesn't work
+  //   - Anything landing on a modified or deleted path waits for that path first
+  //   - Empty directories are only pruned at the very end, since extraction might still need them
+  // Paths are matched ignoring case, because some filesystems do too.
+  const bool backup_removes_files = BackupMethodRemovesFiles(backup_method);
+  // Back up modified files in the same order they're extracted, so workers rarely wait
+  std::vector<const ModpackEntry*> modify_entry_ptrs = update_plan.modify_entries;
+  std::stable_sort(modify_entry_ptrs.begin(), modify_entry_ptrs.end(),
+                   [](const ModpackEntry* aa_ptr, const ModpackEntry* bb_ptr) {
+                     return aa_ptr->size > bb_ptr->size;
+                   });
+  std::vector<fs::path> outdated_paths;
+  std::unordered_map<std::string, std::size_t> gate_index_map;
+  for (const ModpackEntry* entry_ptr : modify_entry_ptrs) {
+    gate_index_map.emplace(ToLowerAscii(entry_ptr->path), outdated_paths.size());
+    outdated_paths.emplace_back(entry_ptr->path);
   }
-  const fs::path backup_parent_path = backup_path.parent_path();
-  if (!fs::exists(backup_parent_path)) {
-    fs::create_directories(backup_parent_path, fs_ec);
-    if (fs_ec) {
+  const std::size_t delete_begin_index = outdated_paths.size();
+  for (const fs::path& delete_path : update_plan.delete_paths) {
+    gate_index_map.emplace(ToLowerAscii(delete_path.generic_string()), outdated_paths.size());
+    outdated_paths.push_back(delete_path);
+  }
+  const std::size_t rename_begin_index = outdated_paths.size();
+  std::unordered_map<const ModpackEntry*, std::size_t> rename_index_map;
+  for (const UpdateRename& rename : update_plan.renames) {
+    rename_index_map.emplace(rename.entry_ptr, outdated_paths.size());
+    outdated_paths.push_back(rename.from_path);
+  }
+  std::vector<const ModpackEntry*> extract_entry_ptrs = update_plan.GetExtractEntries();
+  for (const UpdateRename& rename : update_plan.renames) {
+    extract_entry_ptrs.push_back(rename.entry_ptr);
+  }
+  PercentProgresser progresser(progress_func, outdated_paths.size() + extract_entry_ptrs.size());
+  const FileRemover::Ptr fr_ptr = FileRemover::Create(profile_path, outdated_paths);
+  PathGate gate(outdated_paths.size());
+  const auto file_func = [&](std::size_t path_index) {
+    const bool is_delete = (path_index >= delete_begin_index && path_index < rename_begin_index);
+    if (is_delete && !backup_removes_files) {
+      fr_ptr->Remove(path_index);
+    }
+    gate.Open(path_index);
+    progresser.TickQuietly();
+  };
+  std::future<std::optional<BackupStats>> backup_future;
+  if (!outdated_paths.empty()) {
+    backup_future = std::async(std::launch::async, [&]() {
+      std::optional<BackupStats> backup_stats_opt = CreateBackup(
+          backup_method, backups_path, profile_path, outdated_paths, num_jobs, nullptr, file_func);
+      if (!backup_stats_opt) {
+        gate.Fail();
+      }
+      return backup_stats_opt;
+    });
+  }
+  const auto before_func = [&](const ModpackEntry& entry) {
+    // Renames too, since a rename target might only differ in case from a file that's still
+    // waiting to be backed up, or to be deleted after it is
+    const auto gate_index_iter = gate_index_map.find(ToLowerAscii(entry.path));
+    if (gate_index_iter != gate_index_map.end() && !gate.Wait(gate_index_iter->second)) {
+      return ExtractAction::ABORT;
+    }
+    const auto rename_index_iter = rename_index_map.find(&entry);
+    if (rename_index_iter != rename_index_map.end()) {
+      const std::size_t path_index = rename_index_iter->second;
+      if (!gate.Wait(path_index)) {
+        return ExtractAction::ABORT;
+      }
+      if (backup_removes_files) {
+        return ExtractAction::EXTRACT;
+      }
+      // Anything that can't be moved will just have to be extracted instead
+      std::error_code fs_ec;
+      fs::rename(profile_path / outdated_paths.at(path_index), profile_path / entry.path, fs_ec);
+      if (!fs_ec) {
+        return ExtractAction::SKIP;
+      }
+      fr_ptr->Remove(path_index);
+      return ExtractAction::EXTRACT;
+    }
+    return ExtractAction::EXTRACT;
+  };
+  const bool is_extracted = ExtractEntries(modpack_path, zip_ptr, extract_entry_ptrs, profile_path,
+                                           num_jobs, &progresser, before_func);
+  // Always let the backup finish, since some files might already be replaced
+  if (backup_future.valid()) {
+    while (backup_future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+      progresser.Report();
+    }
+    *backup_stats_opt_ptr = backup_future.get();
+    if (!backup_stats_opt_ptr->has_value()) {
+      SetError(ec, Error::PROFILE_BACKUP_FAILED);
       return false;
     }
   }
-  auto zip_ptr = std::make_unique<zpp::ZipArchive>(backup_path.string());
-  if (!zip_ptr->open(zpp::ZipArchive::NEW)) {
+  if (!is_extracted) {
+    SetError(ec, Error::MODPACK_UNZIP_FAILED);
     return false;
   }
-  for (const fs::path& overwrite_path : overwrite_paths) {
-    const fs::path full_path = profile_path / overwrite_path;
-    if (!zip_ptr->addFile(overwrite_path.generic_string(), full_path.string())) {
-      zip_ptr->close();
-      fs::remove(backup_path, fs_ec);
-      return false;
+  fr_ptr->RemoveEmptyDirectories();
+  return true;
+}
+
+std::string ToLowerAscii(std::string str)
+{
+  for (char& ch : str) {
+    if (ch >= 'A' && ch <= 'Z') {
+      ch = static_cast<char>(ch - 'A' + 'a');
     }
   }
-  // TODO Note that nothing is written to disk until the zip is closed, so this
-  // is what will take up the time in this function. (Not calls to "addFile".)
-  // In later versions of Libzip we could use the function
-  // "zip_register_progress_callback_with_state", but unfortunately that's not
-  // available for the Libzip packaged with 18.04. The best solution would be to
-  // add Libzip as a subproject, but there isn't a Wrap available for it.
-  zip_ptr->close();
-  return true;
+  return str;
 }
 
-void RemoveOutdatedFiles(const fs::path& profile_path, const std::vector<fs::path>& overwrite_paths,
-                         const PercentProgressFunc& progress_func)
+void WriteInstallManifest(const fs::path& profile_path, const ModpackIndex::Ptr& mpi_ptr,
+                          const KeeplistProcessor::Ptr& klp_ptr)
 {
-  std::error_code fs_ec;
-  PercentProgresser progresser(progress_func, overwrite_paths.size());
-  for (const fs::path& overwrite_path : overwrite_paths) {
-    const fs::path full_path = profile_path / overwrite_path;
-    fs::remove(full_path, fs_ec);
-    progresser.Tick();
+  std::vector<const ModpackEntry*> entry_ptrs;
+  entry_ptrs.reserve(mpi_ptr->GetEntries().size());
+  for (const ModpackEntry& entry : mpi_ptr->GetEntries()) {
+    if (klp_ptr == nullptr || klp_ptr->IsOverwritePath(entry.path)) {
+      entry_ptrs.push_back(&entry);
+    }
+  }
+  const auto im_ptr = InstallManifest::Create(mpi_ptr->GetPackHash());
+  im_ptr->AddEntries(profile_path, entry_ptrs);
+  if (!im_ptr->Save(profile_path, nullptr)) {
+    // The manifest is only an optimization, but a stale one would be wrong, so get rid of it
+    std::error_code fs_ec;
+    fs::remove(InstallManifest::GetManifestPath(profile_path), fs_ec);
   }
 }
 
@@ -24,7 +24,12 @@
 #include <memory>
 #include <optional>
 #include <system_error>
+#include <vector>
 
+#include "trollauncher/backup_creator.hpp"
+#include "trollauncher/backup_pruner.hpp"
+#include "trollauncher/forge_installer.hpp"
+#include "trollauncher/launcher_profiles_editor.hpp"
 #include "trollauncher/profile_data.hpp"
 
 namespace tl {
@@ -34,6 +39,8 @@ using ProgressFunc = std::function<void(std::size_t, const std::string&)>;
 std::vector<ProfileData> GetInstalledProfiles(std::error_code* ec);
 std::vector<ProfileData> GetInstalledProfiles(const std::filesystem::path& dot_minecraft_path,
                                               std::error_code* ec);
+std::optional<PruneStats> PruneInstalledBackups(const BackupRetention& retention,
+                                                std::size_t num_jobs, std::error_code* ec);
 
 class ModpackInstaller final {
  public:
@@ -42,10 +49,17 @@ class ModpackInstaller final {
   static Ptr Create(const std::filesystem::path& modpack_path, std::error_code* ec);
   static Ptr Create(const std::filesystem::path& modpack_path,
                     const std::filesystem::path& dot_minecraft_path, std::error_code* ec);
+  // Installers sharing an editor can put all their profiles in a single transaction
+  static Ptr Create(const std::filesystem::path& modpack_path,
+                    const std::filesystem::path& dot_minecraft_path,
+                    const LauncherProfilesEditor::Ptr& lpe_ptr, std::error_code* ec);
 
   std::string GetUniqueProfileName() const;
   std::string GetRandomProfileIcon() const;
 
+  void SetNumJobs(std::size_t num_jobs);
+  void SetForgeInstallOptions(const ForgeInstallOptions& forge_install_options);
+
   bool PrepInstaller(std::error_code* ec);
   std::optional<bool> IsForgeInstalled();
 
@@ -54,6 +68,8 @@ class ModpackInstaller final {
   bool Install(const std::string& profile_id, const std::string& profile_name,
                const std::string& profile_icon, const std::filesystem::path& install_path,
                std::error_code* ec, const ProgressFunc& progress_func = nullptr);
+  // Only set if Forge actually had to be installed
+  std::optional<ForgeInstallStats> GetForgeInstallStats() const;
 
  private:
   ModpackInstaller();
@@ -70,11 +86,26 @@ class ModpackUpdater final {
                     std::error_code* ec);
   static Ptr Create(const std::string profile_id, const std::filesystem::path& modpack_path,
                     const std::filesystem::path& dot_minecraft_path, std::error_code* ec);
+  // Updaters sharing an editor can put all their profiles in a single transaction
+  static Ptr Create(const std::string profile_id, const std::filesystem::path& modpack_path,
+                    const std::filesystem::path& dot_minecraft_path,
+                    const LauncherProfilesEditor::Ptr& lpe_ptr, std::error_code* ec);
+
+  void SetNumJobs(std::size_t num_jobs);
+  void SetBackupMethod(BackupMethod backup_method);
+  void SetBackupRetention(const BackupRetention& backup_retention);
+  void SetForgeInstallOptions(const ForgeInstallOptions& forge_install_options);
 
   bool PrepInstaller(std::error_code* ec);
   std::optional<bool> IsForgeInstalled();
 
   bool Update(std::error_code* ec, const ProgressFunc& progress_func = nullptr);
+  // Only set if Forge actually had to be installed
+  std::optional<ForgeInstallStats> GetForgeInstallStats() const;
+  // Only set after an update that had something to back up
+  std::optional<BackupStats> GetBackupStats() const;
+  // Old backups are pruned in the background after an update, and this waits for it to finish
+  std::optional<PruneStats> WaitForBackupPrune();
 
  private:
   ModpackUpdater();
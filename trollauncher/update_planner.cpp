@@ -0,0 +1,185 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/update_planner.hpp"
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "trollauncher/hashing.hpp"
+#include "trollauncher/worker_pool.hpp"
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+struct DiskFile {
+  fs::path path;
+  std::optional<std::uintmax_t> size_opt;
+  std::optional<std::uint32_t> crc_opt;
+};
+
+void StatDiskFile(const InstallManifest::Ptr& im_ptr, const fs::path& profile_path,
+                  DiskFile* disk_file_ptr);
+
+}  // namespace
+
+std::vector<const ModpackEntry*> UpdatePlan::GetExtractEntries() const
+{
+  std::vector<const ModpackEntry*> extract_entries;
+  extract_entries.reserve(add_entries.size() + modify_entries.size());
+  extract_entries.insert(extract_entries.end(), add_entries.begin(), add_entries.end());
+  extract_entries.insert(extract_entries.end(), modify_entries.begin(), modify_entries.end());
+  return extract_entries;
+}
+
+UpdatePlan PlanUpdate(const ModpackIndex::Ptr& mpi_ptr, const KeeplistProcessor::Ptr& klp_ptr,
+                      const InstallManifest::Ptr& im_ptr, const fs::path& profile_path,
+                      const std::vector<fs::path>& overwrite_paths, std::size_t num_jobs)
+{
+  std::vector<DiskFile> disk_files;
+  disk_files.reserve(overwrite_paths.size());
+  std::unordered_map<std::string, std::size_t> disk_file_map;
+  for (const fs::path& overwrite_path : overwrite_paths) {
+    disk_file_map.emplace(overwrite_path.generic_string(), disk_files.size());
+    disk_files.push_back(DiskFile{overwrite_path, std::nullopt, std::nullopt});
+  }
+  // Match up the modpack with the disk, remembering which files will need to be hashed
+  struct Comparison {
+    const ModpackEntry* entry_ptr;
+    DiskFile* disk_file_ptr;
+  };
+  std::vector<const ModpackEntry*> new_entries;
+  std::vector<Comparison> comparisons;
+  std::unordered_set<std::size_t> matched_disk_indices;
+  for (const ModpackEntry& entry : mpi_ptr->GetEntries()) {
+    if (klp_ptr != nullptr && !klp_ptr->IsOverwritePath(entry.path)) {
+      continue;
+    }
+    const auto disk_file_iter = disk_file_map.find(entry.path);
+    if (disk_file_iter == disk_file_map.end()) {
+      new_entries.push_back(&entry);
+      continue;
+    }
+    const std::size_t disk_index = std::get<1>(*disk_file_iter);
+    matched_disk_indices.insert(disk_index);
+    comparisons.push_back(Comparison{&entry, &disk_files.at(disk_index)});
+  }
+  std::vector<DiskFile*> old_disk_file_ptrs;
+  for (std::size_t ii = 0; ii < disk_files.size(); ++ii) {
+    if (matched_disk_indices.count(ii) == 0) {
+      old_disk_file_ptrs.push_back(&disk_files.at(ii));
+    }
+  }
+  // Only files whose size could match need a CRC, which skips hashing most changed files
+  std::unordered_set<std::uint64_t> new_entry_sizes;
+  for (const ModpackEntry* entry_ptr : new_entries) {
+    new_entry_sizes.insert(entry_ptr->size);
+  }
+  std::vector<DiskFile*> hash_disk_file_ptrs;
+  for (const Comparison& comparison : comparisons) {
+    DiskFile& disk_file = *comparison.disk_file_ptr;
+    StatDiskFile(im_ptr, profile_path, &disk_file);
+    if (disk_file.size_opt && disk_file.size_opt.value() == comparison.entry_ptr->size
+        && !disk_file.crc_opt) {
+      hash_disk_file_ptrs.push_back(&disk_file);
+    }
+  }
+  for (DiskFile* disk_file_ptr : old_disk_file_ptrs) {
+    StatDiskFile(im_ptr, profile_path, disk_file_ptr);
+    if (disk_file_ptr->size_opt && new_entry_sizes.count(disk_file_ptr->size_opt.value()) != 0
+        && !disk_file_ptr->crc_opt) {
+      hash_disk_file_ptrs.push_back(disk_file_ptr);
+    }
+  }
+  const auto hash_func = [&](std::size_t, std::size_t hash_index) {
+    DiskFile& disk_file = *hash_disk_file_ptrs.at(hash_index);
+    disk_file.crc_opt = GetFileCrc32(profile_path / disk_file.path);
+    return true;
+  };
+  ParallelForEach(num_jobs, hash_disk_file_ptrs.size(), hash_func);
+  UpdatePlan update_plan;
+  for (const Comparison& comparison : comparisons) {
+    const DiskFile& disk_file = *comparison.disk_file_ptr;
+    if (disk_file.crc_opt && disk_file.crc_opt.value() == comparison.entry_ptr->crc) {
+      update_plan.unchanged_entries.push_back(comparison.entry_ptr);
+    }
+    else {
+      update_plan.modify_entries.push_back(comparison.entry_ptr);
+    }
+  }
+  // Any old file with the same content as a new file can just be moved there
+  std::multimap<std::pair<std::uint64_t, std::uint32_t>, const DiskFile*> old_content_map;
+  for (const DiskFile* disk_file_ptr : old_disk_file_ptrs) {
+    if (disk_file_ptr->size_opt && disk_file_ptr->crc_opt) {
+      old_content_map.emplace(
+          std::make_pair(disk_file_ptr->size_opt.value(), disk_file_ptr->crc_opt.value()),
+          disk_file_ptr);
+    }
+  }
+  std::unordered_set<const DiskFile*> renamed_disk_file_ptrs;
+  for (const ModpackEntry* entry_ptr : new_entries) {
+    const auto old_content_iter =
+        old_content_map.find(std::make_pair(entry_ptr->size, entry_ptr->crc));
+    if (old_content_iter == old_content_map.end()) {
+      update_plan.add_entries.push_back(entry_ptr);
+      continue;
+    }
+    const DiskFile* disk_file_ptr = std::get<1>(*old_content_iter);
+    update_plan.renames.push_back(UpdateRename{disk_file_ptr->path, entry_ptr});
+    renamed_disk_file_ptrs.insert(disk_file_ptr);
+    old_content_map.erase(old_content_iter);
+  }
+  for (const DiskFile* disk_file_ptr : old_disk_file_ptrs) {
+    if (renamed_disk_file_ptrs.count(disk_file_ptr) == 0) {
+      update_plan.delete_paths.push_back(disk_file_ptr->path);
+    }
+  }
+  return update_plan;
+}
+
+namespace {
+
+void StatDiskFile(const InstallManifest::Ptr& im_ptr, const fs::path& profile_path,
+                  DiskFile* disk_file_ptr)
+{
+  std::error_code fs_ec;
+  const fs::path full_path = profile_path / disk_file_ptr->path;
+  const std::uintmax_t size = fs::file_size(full_path, fs_ec);
+  if (fs_ec) {
+    return;
+  }
+  disk_file_ptr->size_opt = size;
+  if (im_ptr == nullptr) {
+    return;
+  }
+  // If the file wasn't touched since it was installed, the recorded CRC is still good
+  const std::optional<std::int64_t> mtime_opt = InstallManifest::GetFileMtime(full_path);
+  if (mtime_opt) {
+    disk_file_ptr->crc_opt =
+        im_ptr->GetKnownCrc(disk_file_ptr->path.generic_string(), size, mtime_opt.value());
+  }
+}
+
+}  // namespace
+
+}  // namespace tl
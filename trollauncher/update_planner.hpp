@@ -0,0 +1,63 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_UPDATE_PLANNER_HPP_
+#define TROLLAUNCHER_UPDATE_PLANNER_HPP_
+
+#include <filesystem>
+#include <vector>
+
+#include "trollauncher/install_manifest.hpp"
+#include "trollauncher/keeplist_processor.hpp"
+#include "trollauncher/modpack_index.hpp"
+
+namespace tl {
+
+struct UpdateRename {
+  std::filesystem::path from_path;
+  const ModpackEntry* entry_ptr;
+};
+
+/**
+ * The difference between the files in a profile and the files in a modpack, ignoring anything in
+ * the keeplist. All paths are relative to the profile directory. Files that are unchanged don't
+ * need to be touched at all, and a rename is a file that only moved (same size and CRC).
+ */
+struct UpdatePlan {
+  std::vector<const ModpackEntry*> add_entries;
+  std::vector<const ModpackEntry*> modify_entries;
+  std::vector<std::filesystem::path> delete_paths;
+  std::vector<UpdateRename> renames;
+  std::vector<const ModpackEntry*> unchanged_entries;
+
+  std::vector<const ModpackEntry*> GetExtractEntries() const;
+};
+
+/**
+ * Compare the modpack to the existing files of a profile, which should already be filtered by the
+ * keeplist. File sizes are compared first, and only files with matching sizes are hashed. If there
+ * is an install manifest, files with the same size and mtime as recorded use the recorded CRC.
+ */
+UpdatePlan PlanUpdate(const ModpackIndex::Ptr& mpi_ptr, const KeeplistProcessor::Ptr& klp_ptr,
+                      const InstallManifest::Ptr& im_ptr, const std::filesystem::path& profile_path,
+                      const std::vector<std::filesystem::path>& overwrite_paths,
+                      std::size_t num_jobs);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_UPDATE_PLANNER_HPP_
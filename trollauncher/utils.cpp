@@ -18,6 +18,7 @@
 
 #include "trollauncher/utils.hpp"
 
+#include <cstdint>
 #include <cstdlib>
 
 #include <date/date.h>
@@ -30,6 +31,8 @@ namespace {
 namespace fs = std::filesystem;
 namespace bfs = boost::filesystem;
 
+static const std::string TEMP_DIR_PREFIX = "TL-";
+
 static const std::vector<char> alpha_numerics = {
     'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r',
     's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '1', '2', '3', '4', '5', '6', '7', '8', '9', '0',
@@ -269,6 +272,12 @@ static const std::vector<std::string> default_launcher_icons = {
     "Wool",
 };
 
+std::optional<int> ParseDigits(const std::string& str, std::size_t* pos_ptr,
+                               std::size_t num_digits);
+bool ParseChar(const std::string& str, std::size_t* pos_ptr, char cc);
+std::int64_t DaysFromCivil(std::int64_t year, int month, int day);
+int GetDaysInMonth(int year, int month);
+
 }  // namespace
 
 std::optional<std::string> GetEnvironmentVar(const std::string& name)
@@ -290,7 +299,7 @@ std::optional<fs::path> CreateTempDir()
     return std::nullopt;
   }
   boost::system::error_code bfs_ec;
-  const bfs::path unique_bpath = bfs::unique_path("TL-%%%%-%%%%-%%%%-%%%%", bfs_ec);
+  const bfs::path unique_bpath = bfs::unique_path(TEMP_DIR_PREFIX + "%%%%-%%%%-%%%%-%%%%", bfs_ec);
   if (bfs_ec) {
     return std::nullopt;
   }
@@ -307,6 +316,32 @@ std::optional<fs::path> CreateTempDir()
   return dest_path;
 }
 
+void RemoveStaleTempDirs(std::chrono::hours max_age)
+{
+  // Older versions never cleaned up after themselves, and crashes still won't
+  std::error_code fs_ec;
+  const fs::path temp_path = fs::temp_directory_path(fs_ec);
+  if (fs_ec) {
+    return;
+  }
+  const auto stale_time = fs::file_time_type::clock::now() - max_age;
+  for (fs::directory_iterator temp_iter(temp_path, fs_ec), end_iter;
+       !fs_ec && temp_iter != end_iter; temp_iter.increment(fs_ec)) {
+    const fs::path& stale_path = temp_iter->path();
+    if (stale_path.filename().string().rfind(TEMP_DIR_PREFIX, 0) != 0) {
+      continue;
+    }
+    std::error_code stale_ec;
+    if (!temp_iter->is_directory(stale_ec) || stale_ec) {
+      continue;
+    }
+    const fs::file_time_type write_time = fs::last_write_time(stale_path, stale_ec);
+    if (!stale_ec && write_time < stale_time) {
+      fs::remove_all(stale_path, stale_ec);
+    }
+  }
+}
+
 std::string GetRandomId()
 {
   std::string id;
@@ -337,13 +372,62 @@ const std::vector<std::string>& GetDefaultLauncherIcons()
 
 std::optional<std::chrono::system_clock::time_point> TimeFromString(const std::string& time_str)
 {
-  std::chrono::system_clock::time_point time_point;
-  std::istringstream isstream(time_str);
-  isstream >> date::parse("%Y-%m-%dT%H:%M:%SZ", time_point);
-  if (isstream.fail() || isstream.bad()) {
+  // Parsed by hand, since a string stream and "date::parse" is a lot of work for every profile
+  // E.g., "2019-12-12T03:11:18.000Z", with any number of fractional digits, or none at all
+  std::size_t pos = 0;
+  const std::optional<int> year_opt = ParseDigits(time_str, &pos, 4);
+  if (!year_opt || !ParseChar(time_str, &pos, '-')) {
+    return std::nullopt;
+  }
+  const std::optional<int> month_opt = ParseDigits(time_str, &pos, 2);
+  if (!month_opt || month_opt.value() < 1 || month_opt.value() > 12
+      || !ParseChar(time_str, &pos, '-')) {
+    return std::nullopt;
+  }
+  const std::optional<int> day_opt = ParseDigits(time_str, &pos, 2);
+  if (!day_opt || day_opt.value() < 1
+      || day_opt.value() > GetDaysInMonth(year_opt.value(), month_opt.value())
+      || !ParseChar(time_str, &pos, 'T')) {
     return std::nullopt;
   }
-  return time_point;
+  const std::optional<int> hour_opt = ParseDigits(time_str, &pos, 2);
+  if (!hour_opt || hour_opt.value() > 23 || !ParseChar(time_str, &pos, ':')) {
+    return std::nullopt;
+  }
+  const std::optional<int> minute_opt = ParseDigits(time_str, &pos, 2);
+  if (!minute_opt || minute_opt.value() > 59 || !ParseChar(time_str, &pos, ':')) {
+    return std::nullopt;
+  }
+  const std::optional<int> second_opt = ParseDigits(time_str, &pos, 2);
+  if (!second_opt || second_opt.value() > 59) {
+    return std::nullopt;
+  }
+  // Anything past nanoseconds is just dropped
+  std::int64_t num_nanos = 0;
+  if (ParseChar(time_str, &pos, '.')) {
+    std::size_t num_frac_digits = 0;
+    for (; pos < time_str.size() && time_str[pos] >= '0' && time_str[pos] <= '9'; ++pos) {
+      if (num_frac_digits < 9) {
+        num_nanos = num_nanos * 10 + (time_str[pos] - '0');
+        ++num_frac_digits;
+      }
+    }
+    if (num_frac_digits == 0) {
+      return std::nullopt;
+    }
+    for (; num_frac_digits < 9; ++num_frac_digits) {
+      num_nanos *= 10;
+    }
+  }
+  if (!ParseChar(time_str, &pos, 'Z') || pos != time_str.size()) {
+    return std::nullopt;
+  }
+  const std::int64_t num_days = DaysFromCivil(year_opt.value(), month_opt.value(), day_opt.value());
+  const std::int64_t num_seconds = num_days * 86400 + hour_opt.value() * 3600
+                                   + minute_opt.value() * 60 + second_opt.value();
+  const auto since_epoch = std::chrono::seconds(num_seconds) + std::chrono::nanoseconds(num_nanos);
+  return std::chrono::system_clock::time_point(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(since_epoch));
 }
 
 std::string StringFromTime(const std::chrono::system_clock::time_point& time_point)
@@ -351,4 +435,54 @@ std::string StringFromTime(const std::chrono::system_clock::time_point& time_poi
   return date::format("%Y-%m-%dT%H:%M:%SZ", date::floor<std::chrono::milliseconds>(time_point));
 }
 
+namespace {
+
+std::optional<int> ParseDigits(const std::string& str, std::size_t* pos_ptr,
+                               std::size_t num_digits)
+{
+  if (*pos_ptr + num_digits > str.size()) {
+    return std::nullopt;
+  }
+  int value = 0;
+  for (std::size_t ii = 0; ii < num_digits; ++ii) {
+    const char cc = str[*pos_ptr + ii];
+    if (cc < '0' || cc > '9') {
+      return std::nullopt;
+    }
+    value = value * 10 + (cc - '0');
+  }
+  *pos_ptr += num_digits;
+  return value;
+}
+
+bool ParseChar(const std::string& str, std::size_t* pos_ptr, char cc)
+{
+  if (*pos_ptr >= str.size() || str[*pos_ptr] != cc) {
+    return false;
+  }
+  ++*pos_ptr;
+  return true;
+}
+
+std::int64_t DaysFromCivil(std::int64_t year, int month, int day)
+{
+  // Howard Hinnant's "days_from_civil", which is what the date library does too
+  year -= (month <= 2 ? 1 : 0);
+  const std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const std::int64_t year_of_era = year - era * 400;
+  const std::int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const std::int64_t day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+int GetDaysInMonth(int year, int month)
+{
+  static const int days_in_months[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  const bool is_leap_year = (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+  return (month == 2 && is_leap_year) ? 29 : days_in_months[month - 1];
+}
+
+}  // namespace
+
 }  // namespace tl
@@ -32,6 +32,7 @@ namespace tl {
 
 std::optional<std::string> GetEnvironmentVar(const std::string& name);
 std::optional<std::filesystem::path> CreateTempDir();
+void RemoveStaleTempDirs(std::chrono::hours max_age);
 std::string GetRandomId();
 std::string GetRandomName();
 std::string GetRandomIcon();
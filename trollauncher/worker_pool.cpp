@@ -0,0 +1,118 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace tl {
+
+namespace {
+
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+
+}  // namespace
+
+std::size_t GetDefaultNumJobs()
+{
+  // This is allowed to return zero if it can't be determined
+  const std::size_t num_cores = std::thread::hardware_concurrency();
+  return std::max<std::size_t>(num_cores, 1);
+}
+
+bool ParallelForEach(std::size_t num_jobs, std::size_t num_items, const WorkFunc& work_func,
+                     const PollFunc& poll_func)
+{
+  const std::size_t num_workers = std::max<std::size_t>(std::min(num_jobs, num_items), 1);
+  std::atomic<std::size_t> next_item_index(0);
+  std::atomic<bool> failed(false);
+  const auto worker_loop = [&](std::size_t worker_index) {
+    try {
+      while (!failed) {
+        const std::size_t item_index = next_item_index++;
+        if (item_index >= num_items) {
+          return;
+        }
+        if (!work_func(worker_index, item_index)) {
+          failed = true;
+        }
+      }
+    }
+    catch (...) {
+      failed = true;
+    }
+  };
+  // Don't bother with threads if there's only one worker
+  if (num_workers == 1) {
+    worker_loop(0);
+    if (poll_func) {
+      poll_func();
+    }
+    return !failed;
+  }
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  std::size_t num_running = 0;
+  std::vector<std::thread> threads;
+  for (std::size_t worker_index = 0; worker_index < num_workers; ++worker_index) {
+    try {
+      std::lock_guard<std::mutex> lock(mutex);
+      threads.emplace_back([&, worker_index]() {
+        worker_loop(worker_index);
+        std::lock_guard<std::mutex> lock(mutex);
+        --num_running;
+        done_cv.notify_one();
+      });
+      ++num_running;
+    }
+    catch (const std::system_error&) {
+      // Just make do with the threads we already have
+      break;
+    }
+  }
+  if (threads.empty()) {
+    worker_loop(0);
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (num_running != 0) {
+      done_cv.wait_for(lock, POLL_INTERVAL);
+      if (poll_func) {
+        lock.unlock();
+        poll_func();
+        lock.lock();
+      }
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  if (poll_func) {
+    poll_func();
+  }
+  return !failed;
+}
+
+}  // namespace tl
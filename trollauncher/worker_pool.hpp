@@ -0,0 +1,48 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_WORKER_POOL_HPP_
+#define TROLLAUNCHER_WORKER_POOL_HPP_
+
+#include <cstddef>
+#include <functional>
+
+namespace tl {
+
+using WorkFunc = std::function<bool(std::size_t worker_index, std::size_t item_index)>;
+using PollFunc = std::function<void()>;
+
+std::size_t GetDefaultNumJobs();
+
+/**
+ * Call the work function once for every item index in [0, num_items), using at most num_jobs
+ * worker threads. Items are handed out in index order, so sort the items beforehand to control
+ * scheduling. The worker index is in [0, num_jobs), and can be used to look up per-worker state.
+ *
+ * While the workers run, the calling thread periodically calls the poll function. That is the
+ * place to report progress, so that progress callbacks (e.g., the GUI) stay on the calling thread.
+ *
+ * If any call to the work function returns false, no more items are started, and this returns
+ * false once all the workers have stopped.
+ */
+bool ParallelForEach(std::size_t num_jobs, std::size_t num_items, const WorkFunc& work_func,
+                     const PollFunc& poll_func = nullptr);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_WORKER_POOL_HPP_
@@ -0,0 +1,493 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/zip_utils.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+
+#include <zlib.h>
+
+#include "trollauncher/hashing.hpp"
+
+#ifndef ITS_A_UNIX_SYSTEM
+#ifndef _WIN32
+#define ITS_A_UNIX_SYSTEM true
+#else
+#define ITS_A_UNIX_SYSTEM false
+#endif
+#endif
+
+#if ITS_A_UNIX_SYSTEM
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr std::uint32_t LOCAL_HEADER_SIG = 0x04034b50;
+constexpr std::uint32_t CENTRAL_HEADER_SIG = 0x02014b50;
+constexpr std::uint32_t EOCD_SIG = 0x06054b50;
+constexpr std::uint32_t ZIP64_EOCD_SIG = 0x06064b50;
+constexpr std::uint32_t ZIP64_EOCD_LOCATOR_SIG = 0x07064b50;
+constexpr std::uint16_t ZIP64_EXTRA_ID = 0x0001;
+constexpr std::size_t LOCAL_HEADER_SIZE = 30;
+constexpr std::size_t CENTRAL_HEADER_SIZE = 46;
+constexpr std::size_t EOCD_SIZE = 22;
+constexpr std::size_t ZIP64_EOCD_SIZE = 56;
+constexpr std::size_t ZIP64_EOCD_LOCATOR_SIZE = 20;
+constexpr std::size_t MAX_COMMENT_SIZE = 0xffff;
+constexpr std::uint16_t FLAG_ENCRYPTED = 0x0001;
+// Deflate can't do better than about 1032:1, so anything claiming more is garbage
+constexpr std::uint64_t MAX_DEFLATE_RATIO = 1032;
+
+using ReadAtFunc = std::function<bool(std::uint64_t offset, char* bytes, std::size_t size)>;
+
+std::uint16_t ReadU16(const char* bytes);
+std::uint32_t ReadU32(const char* bytes);
+std::uint64_t ReadU64(const char* bytes);
+bool ReadAt(std::ifstream* ifs_ptr, std::uint64_t offset, char* bytes, std::size_t size);
+std::optional<std::vector<ZipCentralEntry>> ReadCentralDirectory(std::uint64_t file_size,
+                                                                 const ReadAtFunc& read_at);
+std::optional<ZipCentralEntry> ParseCentralEntry(const std::vector<char>& cd_bytes,
+                                                 std::size_t* cd_pos_ptr);
+std::optional<std::string> Inflate(std::string_view compressed_data,
+                                   std::uint64_t uncompressed_size);
+
+}  // namespace
+
+std::optional<std::vector<ZipCentralEntry>> ReadZipCentralDirectory(const fs::path& zip_path)
+{
+  std::ifstream zip_ifs(zip_path, std::ios_base::binary);
+  if (!zip_ifs.good()) {
+    return std::nullopt;
+  }
+  zip_ifs.seekg(0, std::ios_base::end);
+  const std::uint64_t file_size = zip_ifs.tellg();
+  return ReadCentralDirectory(file_size, [&zip_ifs](std::uint64_t offset, char* bytes,
+                                                    std::size_t size) {
+    return ReadAt(&zip_ifs, offset, bytes, size);
+  });
+}
+
+std::optional<std::vector<ZipCentralEntry>> ReadBufferZipCentralDirectory(
+    std::string_view zip_data)
+{
+  return ReadCentralDirectory(zip_data.size(), [zip_data](std::uint64_t offset, char* bytes,
+                                                          std::size_t size) {
+    if (offset > zip_data.size() || size > zip_data.size() - offset) {
+      return false;
+    }
+    std::copy_n(zip_data.data() + offset, size, bytes);
+    return true;
+  });
+}
+
+std::optional<std::string> ReadBufferZipEntry(std::string_view zip_data,
+                                              const ZipCentralEntry& central_entry)
+{
+  if ((central_entry.flags & FLAG_ENCRYPTED) != 0) {
+    return std::nullopt;
+  }
+  const std::uint64_t local_header_offset = central_entry.local_header_offset;
+  if (local_header_offset > zip_data.size()
+      || zip_data.size() - local_header_offset < LOCAL_HEADER_SIZE) {
+    return std::nullopt;
+  }
+  const char* local_ptr = zip_data.data() + local_header_offset;
+  if (ReadU32(local_ptr) != LOCAL_HEADER_SIG) {
+    return std::nullopt;
+  }
+  const std::uint64_t data_offset = local_header_offset + LOCAL_HEADER_SIZE
+                                    + ReadU16(local_ptr + 26) + ReadU16(local_ptr + 28);
+  if (data_offset > zip_data.size()
+      || zip_data.size() - data_offset < central_entry.compressed_size) {
+    return std::nullopt;
+  }
+  const std::string_view compressed_data =
+      zip_data.substr(static_cast<std::size_t>(data_offset),
+                      static_cast<std::size_t>(central_entry.compressed_size));
+  std::optional<std::string> entry_data_opt;
+  if (central_entry.method == ZIP_METHOD_STORE) {
+    if (central_entry.compressed_size == central_entry.uncompressed_size) {
+      entry_data_opt = std::string(compressed_data);
+    }
+  }
+  else if (central_entry.method == ZIP_METHOD_DEFLATE) {
+    entry_data_opt = Inflate(compressed_data, central_entry.uncompressed_size);
+  }
+  if (!entry_data_opt
+      || Crc32Update(0, entry_data_opt.value().data(), entry_data_opt.value().size())
+             != central_entry.crc) {
+    return std::nullopt;
+  }
+  return entry_data_opt;
+}
+
+#if ITS_A_UNIX_SYSTEM
+
+struct StoredEntryCopier::Data_ {
+  int zip_fd;
+};
+
+StoredEntryCopier::StoredEntryCopier() : data_(std::make_unique<StoredEntryCopier::Data_>())
+{
+  data_->zip_fd = -1;
+}
+
+StoredEntryCopier::~StoredEntryCopier()
+{
+  if (data_->zip_fd >= 0) {
+    ::close(data_->zip_fd);
+  }
+}
+
+StoredEntryCopier::Ptr StoredEntryCopier::Create(const fs::path& zip_path)
+{
+  const int zip_fd = ::open(zip_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (zip_fd < 0) {
+    return nullptr;
+  }
+  auto sec_ptr = Ptr(new StoredEntryCopier());
+  sec_ptr->data_->zip_fd = zip_fd;
+  return sec_ptr;
+}
+
+bool StoredEntryCopier::CanCopy(const ZipCentralEntry& central_entry)
+{
+  return (central_entry.method == ZIP_METHOD_STORE && (central_entry.flags & FLAG_ENCRYPTED) == 0
+          && central_entry.compressed_size == central_entry.uncompressed_size);
+}
+
+bool StoredEntryCopier::Copy(std::uint64_t local_header_offset, std::uint64_t size,
+                             const fs::path& dest_path)
+{
+  // The local header has its own name and extra field lengths, which need not match the central
+  // directory, so it has to be read to find where the data actually starts
+  char local_bytes[LOCAL_HEADER_SIZE];
+  const ssize_t num_read = ::pread(data_->zip_fd, local_bytes, LOCAL_HEADER_SIZE,
+                                   static_cast<off_t>(local_header_offset));
+  if (num_read != static_cast<ssize_t>(LOCAL_HEADER_SIZE)
+      || ReadU32(local_bytes) != LOCAL_HEADER_SIG) {
+    return false;
+  }
+  off_t data_offset = static_cast<off_t>(local_header_offset + LOCAL_HEADER_SIZE
+                                         + ReadU16(local_bytes + 26) + ReadU16(local_bytes + 28));
+  const int dest_fd = ::open(dest_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (dest_fd < 0) {
+    return false;
+  }
+  std::uint64_t num_remaining = size;
+#ifdef __linux__
+  // Try "copy_file_range" first, which can also reflink, then "sendfile" for older kernels
+  bool use_copy_file_range = true;
+  while (num_remaining != 0) {
+    const std::size_t chunk_size =
+        static_cast<std::size_t>(std::min<std::uint64_t>(num_remaining, 1 << 30));
+    const ssize_t num_copied =
+        (use_copy_file_range
+             ? ::copy_file_range(data_->zip_fd, &data_offset, dest_fd, nullptr, chunk_size, 0)
+             : ::sendfile(dest_fd, data_->zip_fd, &data_offset, chunk_size));
+    if (num_copied < 0 && errno == EINTR) {
+      continue;
+    }
+    if (num_copied < 0 && use_copy_file_range
+        && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+      use_copy_file_range = false;
+      continue;
+    }
+    if (num_copied <= 0) {
+      break;
+    }
+    num_remaining -= static_cast<std::uint64_t>(num_copied);
+  }
+#endif
+  // Fall back to a plain copy loop for anything left over
+  std::vector<char> buffer;
+  while (num_remaining != 0) {
+    buffer.resize(static_cast<std::size_t>(std::min<std::uint64_t>(num_remaining, 1 << 20)));
+    const ssize_t num_buf_read = ::pread(data_->zip_fd, buffer.data(), buffer.size(), data_offset);
+    if (num_buf_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (num_buf_read <= 0) {
+      break;
+    }
+    ssize_t num_written = 0;
+    while (num_written < num_buf_read) {
+      const ssize_t num_write = ::write(dest_fd, buffer.data() + num_written,
+                                        static_cast<std::size_t>(num_buf_read - num_written));
+      if (num_write < 0 && errno == EINTR) {
+        continue;
+      }
+      if (num_write <= 0) {
+        break;
+      }
+      num_written += num_write;
+    }
+    if (num_written != num_buf_read) {
+      break;
+    }
+    data_offset += num_buf_read;
+    num_remaining -= static_cast<std::uint64_t>(num_buf_read);
+  }
+  const bool close_ok = (::close(dest_fd) == 0);
+  return num_remaining == 0 && close_ok;
+}
+
+#else
+
+struct StoredEntryCopier::Data_ {
+  // Nothing, not supported
+};
+
+StoredEntryCopier::StoredEntryCopier() : data_(std::make_unique<StoredEntryCopier::Data_>())
+{
+  // Do nothing
+}
+
+StoredEntryCopier::~StoredEntryCopier() = default;
+
+StoredEntryCopier::Ptr StoredEntryCopier::Create(const fs::path&)
+{
+  // Not supported, the caller should fall back to extracting normally
+  return nullptr;
+}
+
+bool StoredEntryCopier::CanCopy(const ZipCentralEntry&)
+{
+  return false;
+}
+
+bool StoredEntryCopier::Copy(std::uint64_t, std::uint64_t, const fs::path&)
+{
+  return false;
+}
+
+#endif
+
+namespace {
+
+std::uint16_t ReadU16(const char* bytes)
+{
+  const auto* ubytes = reinterpret_cast<const unsigned char*>(bytes);
+  return static_cast<std::uint16_t>(ubytes[0] | (ubytes[1] << 8));
+}
+
+std::uint32_t ReadU32(const char* bytes)
+{
+  return static_cast<std::uint32_t>(ReadU16(bytes))
+         | (static_cast<std::uint32_t>(ReadU16(bytes + 2)) << 16);
+}
+
+std::uint64_t ReadU64(const char* bytes)
+{
+  return static_cast<std::uint64_t>(ReadU32(bytes))
+         | (static_cast<std::uint64_t>(ReadU32(bytes + 4)) << 32);
+}
+
+bool ReadAt(std::ifstream* ifs_ptr, std::uint64_t offset, char* bytes, std::size_t size)
+{
+  ifs_ptr->clear();
+  ifs_ptr->seekg(static_cast<std::streamoff>(offset));
+  ifs_ptr->read(bytes, static_cast<std::streamsize>(size));
+  return ifs_ptr->good() && static_cast<std::size_t>(ifs_ptr->gcount()) == size;
+}
+
+std::optional<ZipCentralEntry> ParseCentralEntry(const std::vector<char>& cd_bytes,
+                                                 std::size_t* cd_pos_ptr)
+{
+  const std::size_t cd_pos = *cd_pos_ptr;
+  if (cd_pos + CENTRAL_HEADER_SIZE > cd_bytes.size()) {
+    return std::nullopt;
+  }
+  const char* header_ptr = &cd_bytes[cd_pos];
+  if (ReadU32(header_ptr) != CENTRAL_HEADER_SIG) {
+    return std::nullopt;
+  }
+  const std::size_t name_length = ReadU16(header_ptr + 28);
+  const std::size_t extra_length = ReadU16(header_ptr + 30);
+  const std::size_t comment_length = ReadU16(header_ptr + 32);
+  const std::size_t next_cd_pos =
+      cd_pos + CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+  if (next_cd_pos > cd_bytes.size()) {
+    return std::nullopt;
+  }
+  ZipCentralEntry central_entry;
+  central_entry.flags = ReadU16(header_ptr + 8);
+  central_entry.method = ReadU16(header_ptr + 10);
+  central_entry.crc = ReadU32(header_ptr + 16);
+  central_entry.compressed_size = ReadU32(header_ptr + 20);
+  central_entry.uncompressed_size = ReadU32(header_ptr + 24);
+  central_entry.local_header_offset = ReadU32(header_ptr + 42);
+  central_entry.name.assign(header_ptr + CENTRAL_HEADER_SIZE, name_length);
+  // Values that don't fit are stored in the Zip64 extra field, but only the ones that overflowed,
+  // and always in this order: uncompressed size, compressed size, local header offset
+  const char* extra_ptr = header_ptr + CENTRAL_HEADER_SIZE + name_length;
+  const char* const extra_end_ptr = extra_ptr + extra_length;
+  while (extra_ptr + 4 <= extra_end_ptr) {
+    const std::uint16_t extra_id = ReadU16(extra_ptr);
+    const std::size_t extra_size = ReadU16(extra_ptr + 2);
+    const char* field_ptr = extra_ptr + 4;
+    const char* const field_end_ptr = field_ptr + extra_size;
+    if (field_end_ptr > extra_end_ptr) {
+      break;
+    }
+    if (extra_id == ZIP64_EXTRA_ID) {
+      for (std::uint64_t* value_ptr :
+           {&central_entry.uncompressed_size, &central_entry.compressed_size,
+            &central_entry.local_header_offset}) {
+        if (*value_ptr != 0xffffffff) {
+          continue;
+        }
+        if (field_ptr + 8 > field_end_ptr) {
+          return std::nullopt;
+        }
+        *value_ptr = ReadU64(field_ptr);
+        field_ptr += 8;
+      }
+    }
+    extra_ptr = field_end_ptr;
+  }
+  *cd_pos_ptr = next_cd_pos;
+  return central_entry;
+}
+
+std::optional<std::vector<ZipCentralEntry>> ReadCentralDirectory(std::uint64_t file_size,
+                                                                 const ReadAtFunc& read_at)
+{
+  if (file_size < EOCD_SIZE) {
+    return std::nullopt;
+  }
+  // The end of central directory record is at the end, followed by a comment of unknown length
+  const std::size_t tail_size =
+      static_cast<std::size_t>(std::min<std::uint64_t>(file_size, EOCD_SIZE + MAX_COMMENT_SIZE));
+  const std::uint64_t tail_offset = file_size - tail_size;
+  std::vector<char> tail_bytes(tail_size);
+  if (!read_at(tail_offset, tail_bytes.data(), tail_size)) {
+    return std::nullopt;
+  }
+  std::optional<std::size_t> eocd_pos_opt;
+  for (std::size_t pos = tail_size - EOCD_SIZE + 1; pos-- > 0;) {
+    if (ReadU32(&tail_bytes[pos]) == EOCD_SIG) {
+      eocd_pos_opt = pos;
+      break;
+    }
+  }
+  if (!eocd_pos_opt) {
+    return std::nullopt;
+  }
+  const char* eocd_ptr = &tail_bytes[eocd_pos_opt.value()];
+  std::uint64_t num_entries = ReadU16(eocd_ptr + 10);
+  std::uint64_t cd_size = ReadU32(eocd_ptr + 12);
+  std::uint64_t cd_offset = ReadU32(eocd_ptr + 16);
+  // Check for Zip64, where the real values are in another record further back
+  if (num_entries == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff) {
+    const std::uint64_t eocd_offset = tail_offset + eocd_pos_opt.value();
+    if (eocd_offset < ZIP64_EOCD_LOCATOR_SIZE) {
+      return std::nullopt;
+    }
+    char locator_bytes[ZIP64_EOCD_LOCATOR_SIZE];
+    if (!read_at(eocd_offset - ZIP64_EOCD_LOCATOR_SIZE, locator_bytes,
+                ZIP64_EOCD_LOCATOR_SIZE)
+        || ReadU32(locator_bytes) != ZIP64_EOCD_LOCATOR_SIG) {
+      return std::nullopt;
+    }
+    char zip64_eocd_bytes[ZIP64_EOCD_SIZE];
+    if (!read_at(ReadU64(locator_bytes + 8), zip64_eocd_bytes, ZIP64_EOCD_SIZE)
+        || ReadU32(zip64_eocd_bytes) != ZIP64_EOCD_SIG) {
+      return std::nullopt;
+    }
+    num_entries = ReadU64(zip64_eocd_bytes + 32);
+    cd_size = ReadU64(zip64_eocd_bytes + 40);
+    cd_offset = ReadU64(zip64_eocd_bytes + 48);
+  }
+  if (cd_offset + cd_size > file_size) {
+    return std::nullopt;
+  }
+  std::vector<char> cd_bytes(static_cast<std::size_t>(cd_size));
+  if (!read_at(cd_offset, cd_bytes.data(), cd_bytes.size())) {
+    return std::nullopt;
+  }
+  std::vector<ZipCentralEntry> central_entries;
+  central_entries.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(num_entries, cd_size)));
+  std::size_t cd_pos = 0;
+  for (std::uint64_t ii = 0; ii < num_entries; ++ii) {
+    std::optional<ZipCentralEntry> central_entry_opt = ParseCentralEntry(cd_bytes, &cd_pos);
+    if (!central_entry_opt) {
+      return std::nullopt;
+    }
+    central_entries.push_back(std::move(central_entry_opt.value()));
+  }
+  return central_entries;
+}
+
+std::optional<std::string> Inflate(std::string_view compressed_data,
+                                   std::uint64_t uncompressed_size)
+{
+  if (uncompressed_size > (compressed_data.size() + 1) * MAX_DEFLATE_RATIO) {
+    return std::nullopt;
+  }
+  std::string data(static_cast<std::size_t>(uncompressed_size), '\0');
+  z_stream zstream;
+  zstream.zalloc = Z_NULL;
+  zstream.zfree = Z_NULL;
+  zstream.opaque = Z_NULL;
+  zstream.next_in = Z_NULL;
+  zstream.avail_in = 0;
+  if (inflateInit2(&zstream, -MAX_WBITS) != Z_OK) {
+    return std::nullopt;
+  }
+  // Zlib only takes 32-bit lengths, so feed it in chunks
+  constexpr std::size_t max_chunk_size = 1 << 30;
+  std::size_t in_pos = 0;
+  std::size_t out_pos = 0;
+  int zlib_result = Z_OK;
+  while (zlib_result == Z_OK) {
+    const std::size_t in_chunk_size =
+        std::min(compressed_data.size() - in_pos, max_chunk_size);
+    const std::size_t out_chunk_size = std::min(data.size() - out_pos, max_chunk_size);
+    zstream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(compressed_data.data() + in_pos));
+    zstream.avail_in = static_cast<uInt>(in_chunk_size);
+    zstream.next_out = reinterpret_cast<Bytef*>(data.data() + out_pos);
+    zstream.avail_out = static_cast<uInt>(out_chunk_size);
+    zlib_result = inflate(&zstream, Z_NO_FLUSH);
+    in_pos += in_chunk_size - zstream.avail_in;
+    out_pos += out_chunk_size - zstream.avail_out;
+  }
+  inflateEnd(&zstream);
+  if (zlib_result != Z_STREAM_END || out_pos != data.size()) {
+    return std::nullopt;
+  }
+  return data;
+}
+
+}  // namespace
+
+}  // namespace tl
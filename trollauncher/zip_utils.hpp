@@ -0,0 +1,92 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_ZIP_UTILS_HPP_
+#define TROLLAUNCHER_ZIP_UTILS_HPP_
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tl {
+
+constexpr std::uint16_t ZIP_METHOD_STORE = 0;
+constexpr std::uint16_t ZIP_METHOD_DEFLATE = 8;
+
+/**
+ * An entry from the central directory of a zip file, as it's stored on disk. Entries are read in
+ * central directory order, which is the same order Libzip uses for entry indices.
+ */
+struct ZipCentralEntry {
+  std::string name;
+  std::uint16_t flags;
+  std::uint16_t method;
+  std::uint32_t crc;
+  std::uint64_t compressed_size;
+  std::uint64_t uncompressed_size;
+  std::uint64_t local_header_offset;
+};
+
+std::optional<std::vector<ZipCentralEntry>> ReadZipCentralDirectory(
+    const std::filesystem::path& zip_path);
+
+/**
+ * The same, but for a zip file that's already in memory, like a jar inside a modpack. Single
+ * entries can then be read out of the buffer (stored or deflated only), and are checked against
+ * their CRC, so a nested zip never needs to be written to disk just to peek inside it.
+ */
+std::optional<std::vector<ZipCentralEntry>> ReadBufferZipCentralDirectory(
+    std::string_view zip_data);
+std::optional<std::string> ReadBufferZipEntry(std::string_view zip_data,
+                                              const ZipCentralEntry& central_entry);
+
+/**
+ * Copies stored (uncompressed) entries straight out of a zip file, bypassing the zip library. On
+ * Linux the copy is done in the kernel with "copy_file_range" (or "sendfile"), so the data never
+ * passes through user space. (Filesystems that support reflinks may also share the blocks.)
+ *
+ * This is only a fast path. Creation fails on systems without support, and copying fails for
+ * entries that can't be copied raw, in which case the caller should extract normally.
+ */
+class StoredEntryCopier final {
+ public:
+  using Ptr = std::shared_ptr<StoredEntryCopier>;
+
+  ~StoredEntryCopier();
+
+  static Ptr Create(const std::filesystem::path& zip_path);
+
+  static bool CanCopy(const ZipCentralEntry& central_entry);
+
+  bool Copy(std::uint64_t local_header_offset, std::uint64_t size,
+            const std::filesystem::path& dest_path);
+
+ private:
+  StoredEntryCopier();
+
+  struct Data_;
+  std::unique_ptr<Data_> data_;
+};
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_ZIP_UTILS_HPP_
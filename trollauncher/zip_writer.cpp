@@ -0,0 +1,525 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "trollauncher/zip_writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+
+#include <zlib.h>
+
+#include "trollauncher/worker_pool.hpp"
+#include "trollauncher/zip_utils.hpp"
+
+namespace tl {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// Blocks are big enough that priming each one with a dictionary is cheap, but small enough that
+// big files still get split up between the jobs
+static constexpr std::size_t BLOCK_SIZE = 512 * 1024;
+static constexpr std::size_t DICT_SIZE = 32 * 1024;
+static constexpr std::size_t BLOCKS_PER_JOB = 4;
+static constexpr std::uint64_t ZIP32_LIMIT = 0xFFFFFFFF;
+// Deflate can expand incompressible data slightly, so start using Zip64 a little early
+static constexpr std::uint64_t ZIP64_SIZE_THRESHOLD = 0xF0000000;
+
+struct SourceFile {
+  const ZipWriterFile* file_ptr;
+  std::uint64_t size;
+  std::uint16_t dos_time;
+  std::uint16_t dos_date;
+};
+
+struct Block {
+  std::size_t source_index;
+  std::uint64_t offset;
+  std::size_t length;
+  bool is_last;
+};
+
+struct CompressedBlock {
+  std::vector<unsigned char> data;
+  std::uint32_t crc;
+};
+
+struct CentralRecord {
+  std::string name;
+  std::uint16_t flags;
+  std::uint16_t dos_time;
+  std::uint16_t dos_date;
+  std::uint32_t crc;
+  std::uint64_t compressed_size;
+  std::uint64_t uncompressed_size;
+  std::uint64_t local_header_offset;
+  bool is_zip64;
+};
+
+/**
+ * Writes the zip file itself, one entry at a time. Local headers are written with empty CRCs and
+ * sizes, which are patched once the entry is done, so nothing needs to be known ahead of time.
+ */
+class SequentialZipWriter {
+ public:
+  SequentialZipWriter(const fs::path& zip_path, std::uint16_t method);
+
+  bool IsGood() const;
+  void BeginEntry(const SourceFile& source_file);
+  void WriteEntryData(const CompressedBlock& compressed_block, std::size_t length);
+  void EndEntry();
+  bool Finish();
+  void Close();
+
+ private:
+  void Write(const std::string& bytes);
+
+  std::ofstream zip_ofs_;
+  std::uint16_t method_;
+  std::uint64_t offset_;
+  CentralRecord current_record_;
+  std::vector<CentralRecord> records_;
+  bool is_good_;
+};
+
+std::optional<CompressedBlock> CompressBlock(const SourceFile& source_file, const Block& block,
+                                             std::uint16_t method);
+void GetDosTime(const fs::path& path, const std::chrono::system_clock::duration& clock_offset,
+                std::uint16_t* dos_time_ptr, std::uint16_t* dos_date_ptr);
+void AppendLe16(std::string* bytes_ptr, std::uint16_t value);
+void AppendLe32(std::string* bytes_ptr, std::uint32_t value);
+void AppendLe64(std::string* bytes_ptr, std::uint64_t value);
+
+}  // namespace
+
+bool WriteZipFile(const fs::path& zip_path, const std::vector<ZipWriterFile>& files,
+                  std::uint16_t method, std::size_t num_jobs,
+                  const ZipWriterProgressFunc& progress_func)
+{
+  if (method != ZIP_METHOD_STORE && method != ZIP_METHOD_DEFLATE) {
+    return false;
+  }
+  std::error_code fs_ec;
+  // Convert file times to system times with one fixed offset, so every entry is converted the same
+  const std::chrono::system_clock::duration clock_offset =
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::system_clock::now().time_since_epoch()
+          - fs::file_time_type::clock::now().time_since_epoch());
+  std::vector<SourceFile> source_files;
+  source_files.reserve(files.size());
+  std::vector<Block> blocks;
+  for (const ZipWriterFile& file : files) {
+    const std::uintmax_t size = fs::file_size(file.source_path, fs_ec);
+    if (fs_ec) {
+      return false;
+    }
+    SourceFile source_file{&file, size, 0, 0};
+    GetDosTime(file.source_path, clock_offset, &source_file.dos_time, &source_file.dos_date);
+    // Even an empty file gets one (empty) block, which is where its entry is written
+    for (std::uint64_t offset = 0;; offset += BLOCK_SIZE) {
+      const std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(
+          size - offset, BLOCK_SIZE));
+      const bool is_last = (offset + length == size);
+      blocks.push_back(Block{source_files.size(), offset, length, is_last});
+      if (is_last) {
+        break;
+      }
+    }
+    source_files.push_back(source_file);
+  }
+  SequentialZipWriter zip_writer(zip_path, method);
+  if (!zip_writer.IsGood()) {
+    zip_writer.Close();
+    fs::remove(zip_path, fs_ec);
+    return false;
+  }
+  // Whichever worker finishes the next block in order does the writing, while the others keep
+  // compressing. Workers wait before starting blocks too far ahead, which bounds the memory use.
+  const std::size_t window_size = std::max<std::size_t>(num_jobs, 1) * BLOCKS_PER_JOB;
+  std::mutex state_mutex;
+  std::condition_variable state_cv;
+  std::map<std::size_t, CompressedBlock> done_blocks;
+  std::size_t next_write_index = 0;
+  bool is_writing = false;
+  bool has_failed = false;
+  std::atomic<std::size_t> num_files_written = 0;
+  const auto work_func = [&](std::size_t, std::size_t block_index) {
+    {
+      std::unique_lock<std::mutex> state_lock(state_mutex);
+      state_cv.wait(state_lock, [&]() {
+        return has_failed || block_index < next_write_index + window_size;
+      });
+      if (has_failed) {
+        return false;
+      }
+    }
+    const Block& block = blocks.at(block_index);
+    std::optional<CompressedBlock> compressed_block_opt =
+        CompressBlock(source_files.at(block.source_index), block, method);
+    std::unique_lock<std::mutex> state_lock(state_mutex);
+    if (!compressed_block_opt) {
+      has_failed = true;
+      state_cv.notify_all();
+      return false;
+    }
+    done_blocks.emplace(block_index, std::move(compressed_block_opt.value()));
+    if (is_writing) {
+      return true;
+    }
+    is_writing = true;
+    while (!has_failed) {
+      const auto done_block_iter = done_blocks.find(next_write_index);
+      if (done_block_iter == done_blocks.end()) {
+        break;
+      }
+      const CompressedBlock compressed_block = std::move(std::get<1>(*done_block_iter));
+      done_blocks.erase(done_block_iter);
+      state_lock.unlock();
+      const Block& write_block = blocks.at(next_write_index);
+      if (write_block.offset == 0) {
+        zip_writer.BeginEntry(source_files.at(write_block.source_index));
+      }
+      zip_writer.WriteEntryData(compressed_block, write_block.length);
+      if (write_block.is_last) {
+        zip_writer.EndEntry();
+        ++num_files_written;
+      }
+      state_lock.lock();
+      has_failed = has_failed || !zip_writer.IsGood();
+      ++next_write_index;
+      state_cv.notify_all();
+    }
+    is_writing = false;
+    return !has_failed;
+  };
+  const auto poll_func = [&]() {
+    if (progress_func) {
+      progress_func(num_files_written);
+    }
+  };
+  const bool success = (ParallelForEach(num_jobs, blocks.size(), work_func, poll_func)
+                        && next_write_index == blocks.size() && zip_writer.Finish());
+  if (!success) {
+    zip_writer.Close();
+    fs::remove(zip_path, fs_ec);
+    return false;
+  }
+  poll_func();
+  return true;
+}
+
+namespace {
+
+SequentialZipWriter::SequentialZipWriter(const fs::path& zip_path, std::uint16_t method)
+    : zip_ofs_(zip_path, std::ios_base::binary | std::ios_base::trunc),
+      method_(method),
+      offset_(0),
+      current_record_(),
+      records_(),
+      is_good_(zip_ofs_.good())
+{
+  // Do nothing
+}
+
+bool SequentialZipWriter::IsGood() const
+{
+  return is_good_ && zip_ofs_.good();
+}
+
+void SequentialZipWriter::BeginEntry(const SourceFile& source_file)
+{
+  const std::string& name = source_file.file_ptr->name;
+  const bool is_utf8 = std::any_of(name.begin(), name.end(),
+                                   [](char ch) { return static_cast<unsigned char>(ch) >= 0x80; });
+  current_record_ = CentralRecord{
+      name,
+      static_cast<std::uint16_t>(is_utf8 ? 0x0800 : 0x0000),
+      source_file.dos_time,
+      source_file.dos_date,
+      0,
+      0,
+      0,
+      offset_,
+      source_file.size >= ZIP64_SIZE_THRESHOLD,
+  };
+  const bool is_zip64 = current_record_.is_zip64;
+  std::string header;
+  AppendLe32(&header, 0x04034b50);
+  AppendLe16(&header, (is_zip64 ? 45 : 20));
+  AppendLe16(&header, current_record_.flags);
+  AppendLe16(&header, method_);
+  AppendLe16(&header, current_record_.dos_time);
+  AppendLe16(&header, current_record_.dos_date);
+  AppendLe32(&header, 0);
+  AppendLe32(&header, (is_zip64 ? 0xFFFFFFFF : 0));
+  AppendLe32(&header, (is_zip64 ? 0xFFFFFFFF : 0));
+  AppendLe16(&header, static_cast<std::uint16_t>(name.size()));
+  AppendLe16(&header, (is_zip64 ? 20 : 0));
+  header += name;
+  if (is_zip64) {
+    AppendLe16(&header, 0x0001);
+    AppendLe16(&header, 16);
+    AppendLe64(&header, 0);
+    AppendLe64(&header, 0);
+  }
+  Write(header);
+}
+
+void SequentialZipWriter::WriteEntryData(const CompressedBlock& compressed_block,
+                                         std::size_t length)
+{
+  zip_ofs_.write(reinterpret_cast<const char*>(compressed_block.data.data()),
+                 compressed_block.data.size());
+  offset_ += compressed_block.data.size();
+  current_record_.crc = crc32_combine(current_record_.crc, compressed_block.crc, length);
+  current_record_.compressed_size += compressed_block.data.size();
+  current_record_.uncompressed_size += length;
+}
+
+void SequentialZipWriter::EndEntry()
+{
+  CentralRecord& record = current_record_;
+  if (!record.is_zip64 && record.compressed_size >= ZIP32_LIMIT) {
+    is_good_ = false;
+    return;
+  }
+  // Go back and fill in the local header, now that the CRC and sizes are known
+  std::string crc_bytes;
+  AppendLe32(&crc_bytes, record.crc);
+  zip_ofs_.seekp(record.local_header_offset + 14);
+  zip_ofs_.write(crc_bytes.data(), crc_bytes.size());
+  std::string size_bytes;
+  if (record.is_zip64) {
+    AppendLe64(&size_bytes, record.uncompressed_size);
+    AppendLe64(&size_bytes, record.compressed_size);
+    zip_ofs_.seekp(record.local_header_offset + 30 + record.name.size() + 4);
+  }
+  else {
+    AppendLe32(&size_bytes, static_cast<std::uint32_t>(record.compressed_size));
+    AppendLe32(&size_bytes, static_cast<std::uint32_t>(record.uncompressed_size));
+  }
+  zip_ofs_.write(size_bytes.data(), size_bytes.size());
+  zip_ofs_.seekp(offset_);
+  records_.push_back(std::move(record));
+}
+
+bool SequentialZipWriter::Finish()
+{
+  const std::uint64_t central_dir_offset = offset_;
+  for (const CentralRecord& record : records_) {
+    const bool is_offset_zip64 = (record.local_header_offset >= ZIP32_LIMIT);
+    std::string extra;
+    if (record.is_zip64) {
+      AppendLe64(&extra, record.uncompressed_size);
+      AppendLe64(&extra, record.compressed_size);
+    }
+    if (is_offset_zip64) {
+      AppendLe64(&extra, record.local_header_offset);
+    }
+    const bool needs_zip64 = !extra.empty();
+    std::string header;
+    AppendLe32(&header, 0x02014b50);
+    AppendLe16(&header, (needs_zip64 ? 45 : 20));
+    AppendLe16(&header, (needs_zip64 ? 45 : 20));
+    AppendLe16(&header, record.flags);
+    AppendLe16(&header, method_);
+    AppendLe16(&header, record.dos_time);
+    AppendLe16(&header, record.dos_date);
+    AppendLe32(&header, record.crc);
+    AppendLe32(&header, (record.is_zip64 ? 0xFFFFFFFF
+                                         : static_cast<std::uint32_t>(record.compressed_size)));
+    AppendLe32(&header, (record.is_zip64 ? 0xFFFFFFFF
+                                         : static_cast<std::uint32_t>(record.uncompressed_size)));
+    AppendLe16(&header, static_cast<std::uint16_t>(record.name.size()));
+    AppendLe16(&header, static_cast<std::uint16_t>(needs_zip64 ? extra.size() + 4 : 0));
+    AppendLe16(&header, 0);
+    AppendLe16(&header, 0);
+    AppendLe16(&header, 0);
+    AppendLe32(&header, 0);
+    AppendLe32(&header, (is_offset_zip64 ? 0xFFFFFFFF
+                                         : static_cast<std::uint32_t>(record.local_header_offset)));
+    header += record.name;
+    if (needs_zip64) {
+      AppendLe16(&header, 0x0001);
+      AppendLe16(&header, static_cast<std::uint16_t>(extra.size()));
+      header += extra;
+    }
+    Write(header);
+  }
+  const std::uint64_t central_dir_size = offset_ - central_dir_offset;
+  const std::uint64_t num_records = records_.size();
+  const bool needs_zip64 = (num_records >= 0xFFFF || central_dir_size >= ZIP32_LIMIT
+                            || central_dir_offset >= ZIP32_LIMIT);
+  const auto num_records_16 =
+      static_cast<std::uint16_t>(std::min<std::uint64_t>(num_records, 0xFFFF));
+  std::string end_records;
+  if (needs_zip64) {
+    const std::uint64_t zip64_end_offset = offset_;
+    AppendLe32(&end_records, 0x06064b50);
+    AppendLe64(&end_records, 44);
+    AppendLe16(&end_records, 45);
+    AppendLe16(&end_records, 45);
+    AppendLe32(&end_records, 0);
+    AppendLe32(&end_records, 0);
+    AppendLe64(&end_records, num_records);
+    AppendLe64(&end_records, num_records);
+    AppendLe64(&end_records, central_dir_size);
+    AppendLe64(&end_records, central_dir_offset);
+    AppendLe32(&end_records, 0x07064b50);
+    AppendLe32(&end_records, 0);
+    AppendLe64(&end_records, zip64_end_offset);
+    AppendLe32(&end_records, 1);
+  }
+  AppendLe32(&end_records, 0x06054b50);
+  AppendLe16(&end_records, 0);
+  AppendLe16(&end_records, 0);
+  AppendLe16(&end_records, num_records_16);
+  AppendLe16(&end_records, num_records_16);
+  AppendLe32(&end_records, static_cast<std::uint32_t>(std::min(central_dir_size, ZIP32_LIMIT)));
+  AppendLe32(&end_records, static_cast<std::uint32_t>(std::min(central_dir_offset, ZIP32_LIMIT)));
+  AppendLe16(&end_records, 0);
+  Write(end_records);
+  zip_ofs_.close();
+  return is_good_ && !zip_ofs_.fail();
+}
+
+void SequentialZipWriter::Close()
+{
+  zip_ofs_.close();
+}
+
+void SequentialZipWriter::Write(const std::string& bytes)
+{
+  zip_ofs_.write(bytes.data(), bytes.size());
+  offset_ += bytes.size();
+}
+
+std::optional<CompressedBlock> CompressBlock(const SourceFile& source_file, const Block& block,
+                                             std::uint16_t method)
+{
+  // Read a little of the previous block too, which is used as the dictionary
+  const std::size_t dict_length =
+      (method == ZIP_METHOD_DEFLATE
+           ? static_cast<std::size_t>(std::min<std::uint64_t>(block.offset, DICT_SIZE))
+           : 0);
+  std::vector<unsigned char> input(dict_length + block.length);
+  std::ifstream source_ifs(source_file.file_ptr->source_path, std::ios_base::binary);
+  source_ifs.seekg(block.offset - dict_length);
+  source_ifs.read(reinterpret_cast<char*>(input.data()), input.size());
+  if (!source_ifs.good() || static_cast<std::size_t>(source_ifs.gcount()) != input.size()) {
+    return std::nullopt;
+  }
+  if (method == ZIP_METHOD_STORE) {
+    const std::uint32_t crc = crc32(0, input.data(), block.length);
+    return CompressedBlock{std::move(input), crc};
+  }
+  z_stream zstream{};
+  if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY)
+      != Z_OK) {
+    return std::nullopt;
+  }
+  if (dict_length != 0 && deflateSetDictionary(&zstream, input.data(), dict_length) != Z_OK) {
+    deflateEnd(&zstream);
+    return std::nullopt;
+  }
+  CompressedBlock compressed_block;
+  compressed_block.crc = crc32(0, input.data() + dict_length, block.length);
+  // Only the last block finishes the stream, the others just flush to a byte boundary
+  const int flush = (block.is_last ? Z_FINISH : Z_SYNC_FLUSH);
+  std::vector<unsigned char>& output = compressed_block.data;
+  output.resize(deflateBound(&zstream, block.length) + 16);
+  zstream.next_in = input.data() + dict_length;
+  zstream.avail_in = block.length;
+  zstream.next_out = output.data();
+  zstream.avail_out = output.size();
+  while (true) {
+    const int result = deflate(&zstream, flush);
+    if (result == Z_STREAM_ERROR) {
+      deflateEnd(&zstream);
+      return std::nullopt;
+    }
+    if (block.is_last ? result == Z_STREAM_END
+                      : (zstream.avail_in == 0 && zstream.avail_out != 0)) {
+      break;
+    }
+    // The bound should always be enough, but just in case
+    const std::size_t used_size = output.size() - zstream.avail_out;
+    output.resize(output.size() * 2);
+    zstream.next_out = output.data() + used_size;
+    zstream.avail_out = output.size() - used_size;
+  }
+  output.resize(output.size() - zstream.avail_out);
+  deflateEnd(&zstream);
+  return compressed_block;
+}
+
+void GetDosTime(const fs::path& path, const std::chrono::system_clock::duration& clock_offset,
+                std::uint16_t* dos_time_ptr, std::uint16_t* dos_date_ptr)
+{
+  // DOS dates start in 1980, so that's the default for anything weird
+  *dos_time_ptr = 0;
+  *dos_date_ptr = (1 << 5) | 1;
+  std::error_code fs_ec;
+  const fs::file_time_type file_time = fs::last_write_time(path, fs_ec);
+  if (fs_ec) {
+    return;
+  }
+  const std::chrono::system_clock::time_point system_time(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(file_time.time_since_epoch())
+      + clock_offset);
+  const std::time_t time_t_time = std::chrono::system_clock::to_time_t(system_time);
+  const std::tm* tm_ptr = std::localtime(&time_t_time);
+  if (tm_ptr == nullptr || tm_ptr->tm_year < 80 || tm_ptr->tm_year > 207) {
+    return;
+  }
+  *dos_time_ptr = static_cast<std::uint16_t>((tm_ptr->tm_hour << 11) | (tm_ptr->tm_min << 5)
+                                             | (tm_ptr->tm_sec / 2));
+  *dos_date_ptr = static_cast<std::uint16_t>(((tm_ptr->tm_year - 80) << 9)
+                                             | ((tm_ptr->tm_mon + 1) << 5) | tm_ptr->tm_mday);
+}
+
+void AppendLe16(std::string* bytes_ptr, std::uint16_t value)
+{
+  bytes_ptr->push_back(static_cast<char>(value & 0xFF));
+  bytes_ptr->push_back(static_cast<char>((value >> 8) & 0xFF));
+}
+
+void AppendLe32(std::string* bytes_ptr, std::uint32_t value)
+{
+  AppendLe16(bytes_ptr, static_cast<std::uint16_t>(value & 0xFFFF));
+  AppendLe16(bytes_ptr, static_cast<std::uint16_t>((value >> 16) & 0xFFFF));
+}
+
+void AppendLe64(std::string* bytes_ptr, std::uint64_t value)
+{
+  AppendLe32(bytes_ptr, static_cast<std::uint32_t>(value & 0xFFFFFFFF));
+  AppendLe32(bytes_ptr, static_cast<std::uint32_t>((value >> 32) & 0xFFFFFFFF));
+}
+
+}  // namespace
+
+}  // namespace tl
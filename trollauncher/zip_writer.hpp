@@ -0,0 +1,55 @@
+// Copyright (c) 2020 Tim Perkins
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the “Software”), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef TROLLAUNCHER_ZIP_WRITER_HPP_
+#define TROLLAUNCHER_ZIP_WRITER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace tl {
+
+struct ZipWriterFile {
+  std::filesystem::path source_path;
+  std::string name;
+};
+
+using ZipWriterProgressFunc = std::function<void(std::size_t num_files_written)>;
+
+/**
+ * Write a new zip file containing the given files, deflating them on up to num_jobs threads. The
+ * method can also be ZIP_METHOD_STORE, which skips compression entirely.
+ *
+ * Files are split into fixed size blocks, and each block is deflated on its own (primed with the
+ * end of the previous block, like pigz). Blocks are written strictly in order, one at a time, so
+ * the output is exactly the same for any number of jobs. Only a few blocks per job are ever held
+ * in memory, no matter how big the files are.
+ *
+ * Progress is reported on the calling thread. If anything fails, the partial zip file is removed.
+ */
+bool WriteZipFile(const std::filesystem::path& zip_path, const std::vector<ZipWriterFile>& files,
+                  std::uint16_t method, std::size_t num_jobs,
+                  const ZipWriterProgressFunc& progress_func = nullptr);
+
+}  // namespace tl
+
+#endif  // TROLLAUNCHER_ZIP_WRITER_HPP_